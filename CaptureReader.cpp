@@ -0,0 +1,231 @@
+//
+//  CaptureReader.cpp
+//  Simple-Rtsp-Client
+//
+
+#include "CaptureReader.hpp"
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Log.hpp"
+
+#define MODULE_TAG "CaptureReader"
+
+#define PCAP_MAGIC (0xa1b2c3d4)
+#define PCAP_MAGIC_NS (0xa1b23c4d)
+#define PCAP_HEADER_SIZE (24)
+#define PCAP_RECORD_SIZE (16)
+
+#define LINKTYPE_NULL (0)
+#define LINKTYPE_ETHERNET (1)
+#define LINKTYPE_RAW (101)
+#define LINKTYPE_LINUX_SLL (113)
+#define LINKTYPE_IPV4 (228)
+
+#define RTPDUMP_MAGIC "#!rtpplay1.0 "
+// source and start time after the text line
+#define RTPDUMP_HEADER_SIZE (16)
+#define RTPDUMP_RECORD_SIZE (8)
+
+namespace RK {
+
+    CaptureReader::CaptureReader() {
+    }
+
+    CaptureReader::~CaptureReader() {
+        Close();
+    }
+
+    bool CaptureReader::Open(const std::string &path) {
+        Close();
+
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            log(MODULE_TAG, "failed to open %s %s", path.c_str(), strerror(errno));
+            return false;
+        }
+
+        struct stat st;
+        if (::fstat(fd, &st) < 0 || st.st_size < PCAP_HEADER_SIZE) {
+            log(MODULE_TAG, "%s is too short for a capture", path.c_str());
+            ::close(fd);
+            return false;
+        }
+
+        void *base = ::mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            log(MODULE_TAG, "failed to map %s %s", path.c_str(), strerror(errno));
+            return false;
+        }
+        // read front to back once
+        ::madvise(base, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+        _Base = (const unsigned char *)base;
+        _Size = (size_t)st.st_size;
+
+        uint32_t magic;
+        ::memcpy(&magic, _Base, sizeof(magic));
+        if (magic == PCAP_MAGIC || magic == PCAP_MAGIC_NS || __builtin_bswap32(magic) == PCAP_MAGIC || __builtin_bswap32(magic) == PCAP_MAGIC_NS) {
+            _Format = CaptureFormatPcap;
+            _Swapped = magic != PCAP_MAGIC && magic != PCAP_MAGIC_NS;
+            _Nanoseconds = (_Swapped ? __builtin_bswap32(magic) : magic) == PCAP_MAGIC_NS;
+            _LinkType = Read32(_Base + 20) & 0xffff;
+            _Start = PCAP_HEADER_SIZE;
+        } else if (::memcmp(_Base, RTPDUMP_MAGIC, strlen(RTPDUMP_MAGIC)) == 0) {
+            const unsigned char *eol = (const unsigned char *)::memchr(_Base, '\n', _Size);
+            if (!eol || (size_t)(eol + 1 - _Base) + RTPDUMP_HEADER_SIZE > _Size) {
+                log(MODULE_TAG, "truncated rtpdump header in %s", path.c_str());
+                Close();
+                return false;
+            }
+            _Format = CaptureFormatRtpdump;
+            _Start = eol + 1 - _Base + RTPDUMP_HEADER_SIZE;
+        } else {
+            log(MODULE_TAG, "%s is neither pcap nor rtpdump", path.c_str());
+            Close();
+            return false;
+        }
+
+        Rewind();
+        return true;
+    }
+
+    void CaptureReader::Close() {
+        if (_Base) {
+            ::munmap((void *)_Base, _Size);
+        }
+        _Base = nullptr;
+        _Size = 0;
+        _Format = CaptureFormatUnknown;
+    }
+
+    void CaptureReader::Rewind() {
+        _Pos = _Start;
+        _HasFirst = false;
+    }
+
+    uint32_t CaptureReader::Read32(const unsigned char *p) const {
+        uint32_t v;
+        ::memcpy(&v, p, sizeof(v));
+        return _Swapped ? __builtin_bswap32(v) : v;
+    }
+
+    bool CaptureReader::Next(CapturePacket *packet) {
+        switch (_Format) {
+            case CaptureFormatPcap:
+                return NextPcap(packet);
+            case CaptureFormatRtpdump:
+                return NextRtpdump(packet);
+            default:
+                return false;
+        }
+    }
+
+    bool CaptureReader::NextPcap(CapturePacket *packet) {
+        while (_Pos + PCAP_RECORD_SIZE <= _Size) {
+            const unsigned char *record = _Base + _Pos;
+            uint32_t caplen = Read32(record + 8);
+            if (_Pos + PCAP_RECORD_SIZE + caplen > _Size) {
+                break;
+            }
+            _Pos += PCAP_RECORD_SIZE + caplen;
+
+            int64_t time = (int64_t)Read32(record) * 1000000 + (_Nanoseconds ? Read32(record + 4) / 1000 : Read32(record + 4));
+            if (!_HasFirst) {
+                _HasFirst = true;
+                _First = time;
+            }
+
+            if (ParseUdp(record + PCAP_RECORD_SIZE, caplen, packet)) {
+                packet->timeUs = time - _First;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool CaptureReader::ParseUdp(const unsigned char *frame, size_t size, CapturePacket *packet) {
+        size_t offset = 0;
+        uint16_t ethertype = 0x0800;
+
+        switch (_LinkType) {
+            case LINKTYPE_ETHERNET:
+                if (size < 14) {
+                    return false;
+                }
+                offset = 14;
+                ethertype = frame[12] << 8 | frame[13];
+                // vlan tags
+                while (ethertype == 0x8100 && size >= offset + 4) {
+                    ethertype = frame[offset + 2] << 8 | frame[offset + 3];
+                    offset += 4;
+                }
+                break;
+            case LINKTYPE_LINUX_SLL:
+                if (size < 16) {
+                    return false;
+                }
+                offset = 16;
+                ethertype = frame[14] << 8 | frame[15];
+                break;
+            case LINKTYPE_NULL:
+                offset = 4;
+                break;
+            case LINKTYPE_RAW:
+            case LINKTYPE_IPV4:
+                break;
+            default:
+                return false;
+        }
+
+        const unsigned char *ip = frame + offset;
+        if (ethertype != 0x0800 || size < offset + 20 || (ip[0] >> 4) != 4 || ip[9] != 17) {
+            return false;
+        }
+        // more fragments or a fragment offset, reassembly is out of scope
+        if ((ip[6] & 0x20) || ((ip[6] & 0x1f) << 8 | ip[7])) {
+            return false;
+        }
+
+        size_t ihl = (ip[0] & 0x0f) * 4;
+        size_t total = ip[2] << 8 | ip[3];
+        if (offset + total > size || total < ihl + 8) {
+            return false;
+        }
+
+        const unsigned char *udp = ip + ihl;
+        packet->port = udp[2] << 8 | udp[3];
+        packet->data = udp + 8;
+        packet->size = total - ihl - 8;
+        // rtcp payload types 200..207 collide with rtp types 72..79 plus marker, which rfc 5761 rules out
+        packet->rtcp = packet->size >= 2 && packet->data[1] >= 200 && packet->data[1] <= 207;
+        return true;
+    }
+
+    bool CaptureReader::NextRtpdump(CapturePacket *packet) {
+        while (_Pos + RTPDUMP_RECORD_SIZE <= _Size) {
+            const unsigned char *record = _Base + _Pos;
+            size_t length = record[0] << 8 | record[1];
+            size_t plen = record[2] << 8 | record[3];
+            uint32_t offset = (uint32_t)record[4] << 24 | record[5] << 16 | record[6] << 8 | record[7];
+            if (length < RTPDUMP_RECORD_SIZE || _Pos + length > _Size) {
+                break;
+            }
+            _Pos += length;
+
+            packet->data = record + RTPDUMP_RECORD_SIZE;
+            packet->size = length - RTPDUMP_RECORD_SIZE;
+            packet->timeUs = (int64_t)offset * 1000;
+            packet->port = 0;
+            // plen is 0 for rtcp records
+            packet->rtcp = plen == 0;
+            if (packet->size > 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+}
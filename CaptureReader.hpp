@@ -0,0 +1,64 @@
+//
+//  CaptureReader.hpp
+//  Simple-Rtsp-Client
+//
+
+#ifndef CaptureReader_hpp
+#define CaptureReader_hpp
+
+#include <memory>
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace RK {
+
+    enum CaptureFormat {
+        CaptureFormatUnknown = 0,
+        CaptureFormatPcap,          // classic pcap, micro or nanosecond, either byte order
+        CaptureFormatRtpdump,       // rtptools rtpdump binary format
+    };
+
+    struct CapturePacket {
+        const unsigned char *data;  // udp payload, points into the mapping
+        size_t size;
+        int64_t timeUs;             // capture time relative to the first packet
+        uint16_t port;              // udp destination port, 0 for rtpdump
+        bool rtcp;
+    };
+
+    // walks the udp payloads of a capture file mapped read only, no copies.
+    // non udp and fragmented ipv4 packets are skipped.
+    class CaptureReader {
+    public:
+        typedef std::shared_ptr<CaptureReader> Ptr;
+        CaptureReader();
+        ~CaptureReader();
+
+        bool Open(const std::string &path);
+        void Close();
+        // false at the end of the file
+        bool Next(CapturePacket *packet);
+        void Rewind();
+        CaptureFormat Format() const { return _Format; }
+    protected:
+        bool NextPcap(CapturePacket *packet);
+        bool NextRtpdump(CapturePacket *packet);
+        bool ParseUdp(const unsigned char *frame, size_t size, CapturePacket *packet);
+        uint32_t Read32(const unsigned char *p) const;
+    private:
+        CaptureFormat _Format = CaptureFormatUnknown;
+        const unsigned char *_Base = nullptr;
+        size_t _Size = 0;
+        size_t _Start = 0;          // first record
+        size_t _Pos = 0;
+
+        bool _Swapped = false;
+        bool _Nanoseconds = false;
+        uint32_t _LinkType = 0;
+        bool _HasFirst = false;
+        int64_t _First = 0;
+    };
+
+} //namespace RK
+#endif /* CaptureReader_hpp */
@@ -0,0 +1,151 @@
+//
+//  CpuAffinity.cpp
+//  Simple-Rtsp-Client
+//
+
+#include "CpuAffinity.hpp"
+#include <algorithm>
+#include <limits.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "Log.hpp"
+
+#define MODULE_TAG "CpuAffinity"
+
+// from linux/mempolicy.h, not pulling in libnuma for one syscall
+#define CPU_AFFINITY_MPOL_PREFERRED (1)
+
+namespace RK {
+
+    // parses a kernel cpu list like "0-3,8,10-11"
+    static std::vector<int> ReadCpuList(const char *path) {
+        std::vector<int> cpus;
+        FILE *fp = ::fopen(path, "r");
+        if (!fp) {
+            return cpus;
+        }
+
+        int first = 0, last = 0;
+        char sep = 0;
+        while (::fscanf(fp, "%d", &first) == 1) {
+            last = first;
+            if (::fscanf(fp, "%c", &sep) == 1 && sep == '-') {
+                if (::fscanf(fp, "%d", &last) != 1) {
+                    break;
+                }
+                ::fscanf(fp, "%c", &sep);
+            }
+            for (int cpu = first; cpu <= last; cpu++) {
+                cpus.push_back(cpu);
+            }
+        }
+
+        ::fclose(fp);
+        return cpus;
+    }
+
+    std::vector<int> OnlineCpus() {
+        std::vector<int> cpus = ReadCpuList("/sys/devices/system/cpu/online");
+        if (cpus.empty()) {
+            long n = ::sysconf(_SC_NPROCESSORS_ONLN);
+            for (int cpu = 0; cpu < n; cpu++) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    int NodeOfCpu(int cpu) {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+        DIR *dir = ::opendir(path);
+        if (!dir) {
+            return 0;
+        }
+
+        int node = 0;
+        struct dirent *entry;
+        while ((entry = ::readdir(dir)) != NULL) {
+            if (::sscanf(entry->d_name, "node%d", &node) == 1) {
+                break;
+            }
+        }
+
+        ::closedir(dir);
+        return node;
+    }
+
+    std::vector<int> CpusOfNode(int node) {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        std::vector<int> cpus = ReadCpuList(path);
+        return cpus.empty() ? OnlineCpus() : cpus;
+    }
+
+    bool PinCurrentThread(const std::vector<int> &cpus) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &set);
+            }
+        }
+
+        int r = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+        if (r != 0) {
+            log(MODULE_TAG, "failed to set thread affinity %s", strerror(r));
+            return false;
+        }
+        return true;
+    }
+
+    bool PreferNode(int node) {
+        if (node < 0 || node >= (int)(sizeof(unsigned long) * 8)) {
+            return false;
+        }
+
+        unsigned long mask = 1UL << node;
+        if (::syscall(SYS_set_mempolicy, CPU_AFFINITY_MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1) < 0) {
+            // ENOSYS on kernels built without numa, first touch still applies
+            if (errno != ENOSYS) {
+                log(MODULE_TAG, "failed to prefer numa node %d %s", node, strerror(errno));
+            }
+            return false;
+        }
+        return true;
+    }
+
+    static void *ThreadMain(void *arg) {
+        std::function<void()> *body = (std::function<void()> *)arg;
+        (*body)();
+        delete body;
+        return NULL;
+    }
+
+    bool StartThread(pthread_t *thread, size_t stackSize, std::function<void()> body) {
+        pthread_attr_t attr;
+        ::pthread_attr_init(&attr);
+        if (stackSize > 0) {
+            // glibc wants at least PTHREAD_STACK_MIN and a page multiple
+            size_t page = (size_t)::sysconf(_SC_PAGESIZE);
+            stackSize = std::max(stackSize, (size_t)PTHREAD_STACK_MIN);
+            ::pthread_attr_setstacksize(&attr, (stackSize + page - 1) / page * page);
+        }
+
+        std::function<void()> *arg = new std::function<void()>(body);
+        int r = ::pthread_create(thread, &attr, ThreadMain, arg);
+        ::pthread_attr_destroy(&attr);
+        if (r != 0) {
+            log(MODULE_TAG, "failed to start thread %s", strerror(r));
+            delete arg;
+            return false;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,33 @@
+//
+//  CpuAffinity.hpp
+//  Simple-Rtsp-Client
+//
+
+#ifndef CpuAffinity_hpp
+#define CpuAffinity_hpp
+
+#include <functional>
+#include <vector>
+#include <pthread.h>
+#include <stddef.h>
+
+namespace RK {
+
+    // online cpus, in kernel order
+    std::vector<int> OnlineCpus();
+    // numa node of a cpu, 0 on machines without numa information
+    int NodeOfCpu(int cpu);
+    std::vector<int> CpusOfNode(int node);
+
+    // both act on the calling thread
+    bool PinCurrentThread(const std::vector<int> &cpus);
+    // later page faults of this thread are served from node when it has
+    // memory, so buffers first touched here stay local
+    bool PreferNode(int node);
+
+    // a thread with a fixed stack instead of the 8 MB default (0 keeps it),
+    // for sessions numbered in the thousands. join or detach it with pthreads.
+    bool StartThread(pthread_t *thread, size_t stackSize, std::function<void()> body);
+
+} //namespace RK
+#endif /* CpuAffinity_hpp */
@@ -0,0 +1,291 @@
+//
+//  EventLoop.cpp
+//  Simple-Rtsp-Client
+//
+
+#include "EventLoop.hpp"
+#include "CpuAffinity.hpp"
+#include <future>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "Log.hpp"
+
+#define MODULE_TAG "EventLoop"
+
+#define EVENT_LOOP_MAX_EVENTS (64)
+// plenty for the rtsp/rtp handlers, raise it with SetStackSize for heavy callbacks
+#define EVENT_LOOP_STACK_SIZE (256 * 1024)
+
+namespace RK {
+
+    static uint32_t ToEpoll(int events) {
+        uint32_t r = 0;
+        if (events & EventRead) {
+            r |= EPOLLIN;
+        }
+        if (events & EventWrite) {
+            r |= EPOLLOUT;
+        }
+        return r;
+    }
+
+    EventLoop::EventLoop() {
+        _Running = false;
+        _Terminated = false;
+        _LoopThread = pthread_t();
+        _StackSize = EVENT_LOOP_STACK_SIZE;
+
+        _Epollfd = ::epoll_create1(EPOLL_CLOEXEC);
+        _Wakeupfd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (_Epollfd < 0 || _Wakeupfd < 0) {
+            log(MODULE_TAG, "event loop init failed error %s", strerror(errno));
+            return;
+        }
+
+        struct epoll_event ev;
+        ::memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = _Wakeupfd;
+        ::epoll_ctl(_Epollfd, EPOLL_CTL_ADD, _Wakeupfd, &ev);
+    }
+
+    EventLoop::~EventLoop() {
+        Stop();
+
+        if (_Wakeupfd >= 0) {
+            ::close(_Wakeupfd);
+        }
+        if (_Epollfd >= 0) {
+            ::close(_Epollfd);
+        }
+    }
+
+    bool EventLoop::Start() {
+        if (_Epollfd < 0 || _Wakeupfd < 0) {
+            return false;
+        }
+        if (_Running.exchange(true)) {
+            return true;
+        }
+
+        _Terminated = false;
+        _Drained = false;
+        bool started = StartThread(&_LoopThread, _StackSize, [this] {
+            if (_Cpu >= 0 && PinCurrentThread(std::vector<int>(1, _Cpu))) {
+                PreferNode(NodeOfCpu(_Cpu));
+            }
+            Loop();
+        });
+        if (!started) {
+            _Running = false;
+            return false;
+        }
+        return true;
+    }
+
+    void EventLoop::Stop() {
+        if (!_Running) {
+            return;
+        }
+
+        _Terminated = true;
+        Wakeup();
+
+        if (IsInLoopThread()) {
+            // stopped from one of our own callbacks, can't join ourselves
+            ::pthread_detach(_LoopThread);
+        } else {
+            ::pthread_join(_LoopThread, NULL);
+        }
+        _Running = false;
+        _LoopThread = pthread_t();
+    }
+
+    bool EventLoop::IsInLoopThread() const {
+        return _Running && ::pthread_equal(_LoopThread, ::pthread_self());
+    }
+
+    void EventLoop::Wakeup() {
+        uint64_t one = 1;
+        ssize_t r = ::write(_Wakeupfd, &one, sizeof(one));
+        (void)r;
+    }
+
+    void EventLoop::Post(Task task) {
+        {
+            std::lock_guard<std::mutex> lock(_TaskLock);
+            if (!_Drained) {
+                _Tasks.push_back(std::move(task));
+                task = nullptr;
+            }
+        }
+
+        if (task) {
+            // the loop thread already exited, nothing else runs our tasks
+            task();
+        } else {
+            Wakeup();
+        }
+    }
+
+    void EventLoop::RunInLoop(Task task) {
+        if (!_Running || IsInLoopThread()) {
+            task();
+        } else {
+            Post(std::move(task));
+        }
+    }
+
+    void EventLoop::RunInLoopSync(Task task) {
+        if (!_Running || IsInLoopThread()) {
+            task();
+            return;
+        }
+
+        std::promise<void> done;
+        Post([&task, &done] {
+            task();
+            done.set_value();
+        });
+        done.get_future().wait();
+    }
+
+    bool EventLoop::AddFd(int fd, int events, IOHandler handler) {
+        struct epoll_event ev;
+        ::memset(&ev, 0, sizeof(ev));
+        ev.events = ToEpoll(events);
+        ev.data.fd = fd;
+        if (::epoll_ctl(_Epollfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            log(MODULE_TAG, "failed to watch fd %d error %s", fd, strerror(errno));
+            return false;
+        }
+
+        _Handlers[fd] = std::make_shared<IOHandler>(std::move(handler));
+        return true;
+    }
+
+    bool EventLoop::ModifyFd(int fd, int events) {
+        struct epoll_event ev;
+        ::memset(&ev, 0, sizeof(ev));
+        ev.events = ToEpoll(events);
+        ev.data.fd = fd;
+        if (::epoll_ctl(_Epollfd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+            log(MODULE_TAG, "failed to modify fd %d error %s", fd, strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    void EventLoop::RemoveFd(int fd) {
+        if (_Handlers.erase(fd)) {
+            ::epoll_ctl(_Epollfd, EPOLL_CTL_DEL, fd, NULL);
+        }
+    }
+
+    uint64_t EventLoop::RunAfter(int ms, Task task) {
+        Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(ms);
+        uint64_t timer = ++_TimerSeq;
+
+        _TimerQueue.insert(std::make_pair(deadline, timer));
+        _Timers[timer] = std::make_pair(deadline, std::move(task));
+        return timer;
+    }
+
+    void EventLoop::Cancel(uint64_t timer) {
+        auto it = _Timers.find(timer);
+        if (it != _Timers.end()) {
+            _TimerQueue.erase(std::make_pair(it->second.first, timer));
+            _Timers.erase(it);
+        }
+    }
+
+    void EventLoop::RunTasks(bool drain) {
+        std::vector<Task> tasks;
+        {
+            std::lock_guard<std::mutex> lock(_TaskLock);
+            tasks.swap(_Tasks);
+            _Drained = drain;
+        }
+
+        for (auto &task : tasks) {
+            task();
+        }
+    }
+
+    int EventLoop::RunTimers() {
+        while (!_TimerQueue.empty()) {
+            auto first = _TimerQueue.begin();
+            Clock::time_point now = Clock::now();
+            if (first->first > now) {
+                // round up so we never spin on a sub millisecond remainder
+                return (int)std::chrono::duration_cast<std::chrono::milliseconds>(first->first - now).count() + 1;
+            }
+
+            uint64_t timer = first->second;
+            _TimerQueue.erase(first);
+            auto it = _Timers.find(timer);
+            Task task = std::move(it->second.second);
+            _Timers.erase(it);
+            task();
+        }
+
+        return -1;
+    }
+
+    void EventLoop::Loop() {
+        struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+        while (!_Terminated) {
+            RunTasks(false);
+            int timeout = RunTimers();
+            if (_Terminated) {
+                break;
+            }
+
+            int r = ::epoll_wait(_Epollfd, events, EVENT_LOOP_MAX_EVENTS, timeout);
+            if (r < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                log(MODULE_TAG, "event error %s", strerror(errno));
+                break;
+            }
+
+            for (int i = 0; i < r; i++) {
+                int fd = events[i].data.fd;
+                if (fd == _Wakeupfd) {
+                    uint64_t count;
+                    ssize_t n = ::read(_Wakeupfd, &count, sizeof(count));
+                    (void)n;
+                    continue;
+                }
+
+                // an earlier handler in this batch may have removed the fd
+                auto it = _Handlers.find(fd);
+                if (it == _Handlers.end()) {
+                    continue;
+                }
+
+                int mask = 0;
+                if (events[i].events & (EPOLLIN | EPOLLHUP)) {
+                    mask |= EventRead;
+                }
+                if (events[i].events & EPOLLOUT) {
+                    mask |= EventWrite;
+                }
+                if (events[i].events & EPOLLERR) {
+                    mask |= EventError;
+                }
+
+                std::shared_ptr<IOHandler> handler = it->second;
+                (*handler)(mask);
+            }
+        }
+
+        // later posts run inline, waiters in RunInLoopSync never hang on a stopped loop
+        RunTasks(true);
+    }
+}
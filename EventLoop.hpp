@@ -0,0 +1,95 @@
+//
+//  EventLoop.hpp
+//  Simple-Rtsp-Client
+//
+
+#ifndef EventLoop_hpp
+#define EventLoop_hpp
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace RK {
+
+    enum EventLoopEvents {
+        EventRead = 1 << 0,
+        EventWrite = 1 << 1,
+        EventError = 1 << 2,
+    };
+
+    // one thread multiplexing the sockets and timers of any number of sessions.
+    // Post() is thread safe, everything else must be called on the loop thread
+    // (or before Start()).
+    class EventLoop {
+    public:
+        typedef std::shared_ptr<EventLoop> Ptr;
+        typedef std::function<void(int events)> IOHandler;
+        typedef std::function<void()> Task;
+
+        EventLoop();
+        ~EventLoop();
+
+        // pin the loop thread to cpu and prefer that cpu's numa node for
+        // what it allocates, call before Start. -1 (default) leaves it alone
+        void SetAffinity(int cpu) { _Cpu = cpu; }
+        int Cpu() const { return _Cpu; }
+        // stack of the loop thread, callbacks run on it. call before Start
+        void SetStackSize(size_t bytes) { _StackSize = bytes; }
+
+        bool Start();
+        void Stop();
+        bool IsRunning() const { return _Running; }
+        bool IsInLoopThread() const;
+
+        void Post(Task task);
+        // run now when called on the loop thread, otherwise post
+        void RunInLoop(Task task);
+        // run on the loop and wait for it, inline when the loop is not running
+        void RunInLoopSync(Task task);
+
+        bool AddFd(int fd, int events, IOHandler handler);
+        bool ModifyFd(int fd, int events);
+        void RemoveFd(int fd);
+
+        uint64_t RunAfter(int ms, Task task);
+        void Cancel(uint64_t timer);
+    protected:
+        typedef std::chrono::steady_clock Clock;
+
+        void Loop();
+        void Wakeup();
+        void RunTasks(bool drain);
+        int RunTimers();
+    private:
+        std::atomic<bool> _Running;
+        std::atomic<bool> _Terminated;
+        pthread_t _LoopThread;
+
+        int _Cpu = -1;
+        size_t _StackSize;
+        int _Epollfd = -1;
+        int _Wakeupfd = -1;
+
+        std::mutex _TaskLock;
+        std::vector<Task> _Tasks;
+        bool _Drained = false;
+
+        std::map<int, std::shared_ptr<IOHandler>> _Handlers;
+
+        uint64_t _TimerSeq = 0;
+        std::set<std::pair<Clock::time_point, uint64_t>> _TimerQueue;
+        std::map<uint64_t, std::pair<Clock::time_point, Task>> _Timers;
+    };
+
+} //namespace RK
+#endif /* EventLoop_hpp */
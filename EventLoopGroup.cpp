@@ -0,0 +1,63 @@
+//
+//  EventLoopGroup.cpp
+//  Simple-Rtsp-Client
+//
+
+#include "EventLoopGroup.hpp"
+#include <map>
+#include "CpuAffinity.hpp"
+#include "Log.hpp"
+
+#define MODULE_TAG "EventLoopGroup"
+
+namespace RK {
+
+    EventLoopGroup::Ptr EventLoopGroup::Create(const std::vector<int> &cpus) {
+        std::vector<int> list = cpus.empty() ? OnlineCpus() : cpus;
+
+        if (cpus.empty()) {
+            // alternate nodes so consecutive sessions spread over all sockets
+            std::map<int, std::vector<int>> nodes;
+            for (int cpu : list) {
+                nodes[NodeOfCpu(cpu)].push_back(cpu);
+            }
+            list.clear();
+            for (size_t i = 0, added = 1; added; i++) {
+                added = 0;
+                for (auto &node : nodes) {
+                    if (i < node.second.size()) {
+                        list.push_back(node.second[i]);
+                        added++;
+                    }
+                }
+            }
+        }
+
+        Ptr group(new EventLoopGroup());
+        group->_Next = 0;
+        for (int cpu : list) {
+            EventLoop::Ptr loop = std::make_shared<EventLoop>();
+            loop->SetAffinity(cpu);
+            if (!loop->Start()) {
+                log(MODULE_TAG, "failed to start loop for cpu %d", cpu);
+                continue;
+            }
+            group->_Loops.push_back(loop);
+        }
+
+        if (group->_Loops.empty()) {
+            return nullptr;
+        }
+        return group;
+    }
+
+    EventLoopGroup::~EventLoopGroup() {
+        for (auto &loop : _Loops) {
+            loop->Stop();
+        }
+    }
+
+    EventLoop::Ptr EventLoopGroup::Next() {
+        return _Loops[_Next++ % _Loops.size()];
+    }
+}
@@ -0,0 +1,41 @@
+//
+//  EventLoopGroup.hpp
+//  Simple-Rtsp-Client
+//
+
+#ifndef EventLoopGroup_hpp
+#define EventLoopGroup_hpp
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "EventLoop.hpp"
+
+namespace RK {
+
+    // one pinned event loop per cpu. sessions are sharded over the loops,
+    // each session then lives entirely on one core and its numa node:
+    //
+    //     EventLoopGroup::Ptr group = EventLoopGroup::Create();
+    //     RtspPlayer::Ptr player = std::make_shared<RtspPlayer>(group->Next());
+    class EventLoopGroup {
+    public:
+        typedef std::shared_ptr<EventLoopGroup> Ptr;
+
+        // one loop per listed cpu, every online cpu when empty
+        static Ptr Create(const std::vector<int> &cpus = std::vector<int>());
+        ~EventLoopGroup();
+
+        // round robin over the loops
+        EventLoop::Ptr Next();
+        EventLoop::Ptr At(size_t index) const { return _Loops[index % _Loops.size()]; }
+        size_t Size() const { return _Loops.size(); }
+    protected:
+        EventLoopGroup() {}
+    private:
+        std::vector<EventLoop::Ptr> _Loops;
+        std::atomic<size_t> _Next;
+    };
+
+} //namespace RK
+#endif /* EventLoopGroup_hpp */
@@ -0,0 +1,134 @@
+//
+//  FrameAligner.cpp
+//  Simple-Rtsp-Client
+//
+
+#include "FrameAligner.hpp"
+
+namespace RK {
+
+    FrameAligner::FrameAligner(EventLoop::Ptr loop, int maxDelayMs, Output output) {
+        _Loop = loop;
+        _MaxDelayMs = maxDelayMs;
+        _Output = output;
+    }
+
+    FrameAligner::~FrameAligner() {
+        // runs after every Push already posted
+        _Loop->RunInLoopSync([this] {
+            if (_Timer) {
+                _Loop->Cancel(_Timer);
+                _Timer = 0;
+            }
+        });
+    }
+
+    int FrameAligner::AddTrack() {
+        _Tracks.push_back(Track());
+        return (int)_Tracks.size() - 1;
+    }
+
+    void FrameAligner::Push(int track, const MediaFrame &frame) {
+        if (track < 0 || track >= (int)_Tracks.size()) {
+            return;
+        }
+
+        std::shared_ptr<Held> held = std::make_shared<Held>();
+        held->frame = frame;
+        held->data.assign(frame.data, frame.data + frame.size);
+        held->deadline = Clock::now() + std::chrono::milliseconds(_MaxDelayMs);
+
+        _Loop->RunInLoop([this, track, held] {
+            HandlePush(track, *held);
+        });
+    }
+
+    void FrameAligner::Flush() {
+        _Loop->RunInLoopSync([this] {
+            Release(true);
+        });
+    }
+
+    void FrameAligner::HandlePush(int track, Held &held) {
+        held.frame.data = held.data.data();
+        if (held.frame.wallclock == 0) {
+            _Output(track, held.frame);
+            return;
+        }
+
+        Track &t = _Tracks[track];
+        if (held.frame.wallclock > t.latest) {
+            t.latest = held.frame.wallclock;
+        }
+        t.frames.push_back(std::move(held));
+        Release(false);
+    }
+
+    void FrameAligner::Release(bool flush) {
+        while (true) {
+            // oldest head by wall clock, and whether any head waited too long
+            int next = -1;
+            bool expired = flush;
+            Clock::time_point now = Clock::now();
+            for (size_t i = 0; i < _Tracks.size(); i++) {
+                if (_Tracks[i].frames.empty()) {
+                    continue;
+                }
+                const Held &head = _Tracks[i].frames.front();
+                if (next < 0 || head.frame.wallclock < _Tracks[next].frames.front().frame.wallclock) {
+                    next = (int)i;
+                }
+                if (head.deadline <= now) {
+                    expired = true;
+                }
+            }
+            if (next < 0) {
+                break;
+            }
+
+            int64_t wallclock = _Tracks[next].frames.front().frame.wallclock;
+            bool ready = true;
+            for (size_t i = 0; i < _Tracks.size() && !expired; i++) {
+                if ((int)i != next && _Tracks[i].latest < wallclock) {
+                    ready = false;
+                    break;
+                }
+            }
+            if (!ready && !expired) {
+                break;
+            }
+
+            Held held = std::move(_Tracks[next].frames.front());
+            _Tracks[next].frames.pop_front();
+            held.frame.data = held.data.data();
+            _Output(next, held.frame);
+        }
+
+        Schedule();
+    }
+
+    void FrameAligner::Schedule() {
+        if (_Timer) {
+            _Loop->Cancel(_Timer);
+            _Timer = 0;
+        }
+
+        bool any = false;
+        Clock::time_point deadline;
+        for (auto &t : _Tracks) {
+            if (!t.frames.empty() && (!any || t.frames.front().deadline < deadline)) {
+                deadline = t.frames.front().deadline;
+                any = true;
+            }
+        }
+        if (!any) {
+            return;
+        }
+
+        int ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+        _Timer = _Loop->RunAfter(ms > 0 ? ms + 1 : 0, [this] {
+            _Timer = 0;
+            Release(false);
+        });
+    }
+}
@@ -0,0 +1,66 @@
+//
+//  FrameAligner.hpp
+//  Simple-Rtsp-Client
+//
+
+#ifndef FrameAligner_hpp
+#define FrameAligner_hpp
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "EventLoop.hpp"
+#include "RtspPlayer.hpp"
+
+namespace RK {
+
+    // merges frames of several tracks (audio and video of one session, or
+    // cameras of different sessions) into sender wall clock order. a frame
+    // is held until every other track has passed its wall clock, but never
+    // longer than maxDelayMs, so a stalled track costs the others at most
+    // that much latency. frames without a wall clock (no rtcp sender report
+    // yet) pass straight through.
+    class FrameAligner {
+    public:
+        typedef std::shared_ptr<FrameAligner> Ptr;
+        typedef std::function<void(int track, const MediaFrame &frame)> Output;
+
+        // output runs on the loop thread
+        FrameAligner(EventLoop::Ptr loop, int maxDelayMs, Output output);
+        ~FrameAligner();
+
+        // returns the track id for Push, call before the first Push
+        int AddTrack();
+        // thread safe, the frame is copied
+        void Push(int track, const MediaFrame &frame);
+        // releases everything held, in order
+        void Flush();
+    protected:
+        typedef std::chrono::steady_clock Clock;
+
+        struct Held {
+            MediaFrame frame;
+            std::vector<unsigned char> data;
+            Clock::time_point deadline;
+        };
+
+        struct Track {
+            std::deque<Held> frames;
+            int64_t latest = 0;     // newest wall clock pushed
+        };
+
+        void HandlePush(int track, Held &held);
+        void Release(bool flush);
+        void Schedule();
+    private:
+        EventLoop::Ptr _Loop;
+        int _MaxDelayMs;
+        Output _Output;
+
+        std::vector<Track> _Tracks;
+        uint64_t _Timer = 0;
+    };
+
+} //namespace RK
+#endif /* FrameAligner_hpp */
@@ -0,0 +1,295 @@
+//
+//  FrameRing.cpp
+//  Simple-Rtsp-Client
+//
+
+#include "FrameRing.hpp"
+#include <new>
+#include <chrono>
+#include <thread>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#include "Log.hpp"
+
+#define MODULE_TAG "FrameRing"
+
+#define FRAME_RING_MAGIC (0x524b4652) // "RKFR"
+#define FRAME_RING_VERSION (2)
+#define FRAME_RING_BUSY (1ULL << 63)
+#define FRAME_RING_ALIGN(x) (((x) + 63) & ~((size_t)63))
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "frame ring needs lock free 64 bit atomics");
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "frame ring needs lock free 32 bit atomics");
+
+namespace RK {
+
+    static void FutexWake(std::atomic<uint32_t> *addr) {
+#ifdef __linux__
+        // not FUTEX_PRIVATE_FLAG, subscribers live in other processes
+        ::syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+    }
+
+    static void FutexWait(std::atomic<uint32_t> *addr, uint32_t expect, int timeoutMs) {
+#ifdef __linux__
+        struct timespec ts;
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+        ::syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT, expect, timeoutMs < 0 ? NULL : &ts, NULL, 0);
+#else
+        (void)addr;
+        (void)expect;
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs < 0 || timeoutMs > 1 ? 1 : timeoutMs));
+#endif
+    }
+
+    static std::string ShmName(const std::string &name) {
+        return name[0] == '/' ? name : "/" + name;
+    }
+
+    FrameRing::FrameRing() {
+    }
+
+    FrameRing::~FrameRing() {
+        Close();
+    }
+
+    bool FrameRing::Map(int fd, size_t size, bool create) {
+        if (create && ::ftruncate(fd, (off_t)size) < 0) {
+            log(MODULE_TAG, "failed to resize shm %s error %s", _name.c_str(), strerror(errno));
+            return false;
+        }
+
+        void *addr = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            log(MODULE_TAG, "failed to map shm %s error %s", _name.c_str(), strerror(errno));
+            return false;
+        }
+
+        _base = (unsigned char *)addr;
+        _mapSize = size;
+        _header = (FrameRingHeader *)_base;
+        return true;
+    }
+
+    bool FrameRing::Create(const std::string &name, uint32_t slotCount, uint32_t slotSize) {
+        if (name.empty() || slotCount == 0 || slotSize == 0) {
+            log(MODULE_TAG, "invalid frame ring parameter");
+            return false;
+        }
+
+        Close();
+        _name = ShmName(name);
+        _owner = true;
+
+        int fd = ::shm_open(_name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+        if (fd < 0) {
+            log(MODULE_TAG, "failed to create shm %s error %s", _name.c_str(), strerror(errno));
+            return false;
+        }
+
+        _slotStride = FRAME_RING_ALIGN(sizeof(FrameRingSlot) + slotSize);
+        size_t size = FRAME_RING_ALIGN(sizeof(FrameRingHeader)) + _slotStride * slotCount;
+        bool mapped = Map(fd, size, true);
+        ::close(fd);
+        if (!mapped) {
+            Close();
+            return false;
+        }
+
+        new (_header) FrameRingHeader();
+        _header->version = FRAME_RING_VERSION;
+        _header->slotCount = slotCount;
+        _header->slotSize = slotSize;
+        _header->head.store(0, std::memory_order_relaxed);
+        _header->futex.store(0, std::memory_order_relaxed);
+        _header->waiters.store(0, std::memory_order_relaxed);
+        for (uint32_t i = 0; i < slotCount; i++) {
+            FrameRingSlot *slot = new (_base + FRAME_RING_ALIGN(sizeof(FrameRingHeader)) + _slotStride * i) FrameRingSlot();
+            // no frame has this sequence yet, subscribers never match it
+            slot->seq.store(FRAME_RING_BUSY, std::memory_order_relaxed);
+        }
+
+        // subscribers check the magic last, publish it after the layout
+        std::atomic_thread_fence(std::memory_order_release);
+        _header->magic = FRAME_RING_MAGIC;
+        return true;
+    }
+
+    bool FrameRing::Open(const std::string &name) {
+        Close();
+        _name = ShmName(name);
+        _owner = false;
+
+        int fd = ::shm_open(_name.c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            log(MODULE_TAG, "failed to open shm %s error %s", _name.c_str(), strerror(errno));
+            return false;
+        }
+
+        struct stat st;
+        if (::fstat(fd, &st) < 0 || (size_t)st.st_size < FRAME_RING_ALIGN(sizeof(FrameRingHeader))) {
+            log(MODULE_TAG, "invalid shm %s size", _name.c_str());
+            ::close(fd);
+            return false;
+        }
+
+        bool mapped = Map(fd, (size_t)st.st_size, false);
+        ::close(fd);
+        if (!mapped) {
+            Close();
+            return false;
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (_header->magic != FRAME_RING_MAGIC || _header->version != FRAME_RING_VERSION) {
+            log(MODULE_TAG, "shm %s is not a frame ring", _name.c_str());
+            Close();
+            return false;
+        }
+
+        _slotStride = FRAME_RING_ALIGN(sizeof(FrameRingSlot) + _header->slotSize);
+        if (FRAME_RING_ALIGN(sizeof(FrameRingHeader)) + _slotStride * _header->slotCount > _mapSize) {
+            log(MODULE_TAG, "shm %s is truncated", _name.c_str());
+            Close();
+            return false;
+        }
+
+        return true;
+    }
+
+    void FrameRing::Close() {
+        if (_base) {
+            ::munmap(_base, _mapSize);
+        }
+        if (_owner && !_name.empty()) {
+            ::shm_unlink(_name.c_str());
+        }
+
+        _base = nullptr;
+        _header = nullptr;
+        _mapSize = 0;
+        _owner = false;
+    }
+
+    FrameRingSlot *FrameRing::GetSlot(uint64_t seq) const {
+        return (FrameRingSlot *)(_base + FRAME_RING_ALIGN(sizeof(FrameRingHeader)) + _slotStride * (seq % _header->slotCount));
+    }
+
+    bool FrameRing::Publish(const unsigned char *data, size_t size, uint32_t timestamp, int64_t pts, int64_t wallclock, uint32_t flags) {
+        if (!_header || !_owner) {
+            return false;
+        }
+
+        if (size > _header->slotSize) {
+            log(MODULE_TAG, "frame %zu bytes exceeds slot size %u, dropped", size, _header->slotSize);
+            return false;
+        }
+
+        uint64_t seq = _header->head.load(std::memory_order_relaxed);
+        FrameRingSlot *slot = GetSlot(seq);
+
+        // seqlock: readers racing with this write see the busy bit and drop
+        // the frame. the fences keep the payload between the two sequence
+        // stores, the readers' acquire fences pair with them
+        slot->seq.store(seq | FRAME_RING_BUSY, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        ::memcpy((unsigned char *)(slot + 1), data, size);
+        slot->size = (uint32_t)size;
+        slot->flags = flags;
+        slot->timestamp = timestamp;
+        slot->pts = pts;
+        slot->wallclock = wallclock;
+        std::atomic_thread_fence(std::memory_order_release);
+        slot->seq.store(seq, std::memory_order_relaxed);
+
+        _header->head.store(seq + 1, std::memory_order_release);
+        _header->futex.fetch_add(1, std::memory_order_release);
+        if (_header->waiters.load(std::memory_order_acquire)) {
+            FutexWake(&_header->futex);
+        }
+
+        return true;
+    }
+
+    uint64_t FrameRing::Head() const {
+        return _header ? _header->head.load(std::memory_order_acquire) : 0;
+    }
+
+    uint64_t FrameRing::Oldest() const {
+        if (!_header) {
+            return 0;
+        }
+
+        uint64_t head = Head();
+        return head > _header->slotCount ? head - _header->slotCount : 0;
+    }
+
+    bool FrameRing::Wait(uint64_t seq, int timeoutMs) {
+        if (!_header) {
+            return false;
+        }
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        while (Head() <= seq) {
+            int remain = -1;
+            if (timeoutMs >= 0) {
+                remain = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+                if (remain <= 0) {
+                    return false;
+                }
+            }
+
+            uint32_t expect = _header->futex.load(std::memory_order_acquire);
+            _header->waiters.fetch_add(1, std::memory_order_acq_rel);
+            if (Head() <= seq) {
+                FutexWait(&_header->futex, expect, remain);
+            }
+            _header->waiters.fetch_sub(1, std::memory_order_acq_rel);
+        }
+
+        return true;
+    }
+
+    bool FrameRing::Acquire(uint64_t seq, FrameRingFrame *frame) {
+        if (!_header || seq >= Head() || seq < Oldest()) {
+            return false;
+        }
+
+        FrameRingSlot *slot = GetSlot(seq);
+        if (slot->seq.load(std::memory_order_relaxed) != seq) {
+            return false;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        frame->data = (const unsigned char *)(slot + 1);
+        frame->size = slot->size;
+        frame->flags = slot->flags;
+        frame->timestamp = slot->timestamp;
+        frame->pts = slot->pts;
+        frame->wallclock = slot->wallclock;
+
+        // the fields above are read before the re-check, a writer that got
+        // in between has moved the sequence on
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot->seq.load(std::memory_order_relaxed) != seq) {
+            return false;
+        }
+        return frame->size <= _header->slotSize;
+    }
+
+    bool FrameRing::Validate(uint64_t seq) {
+        // same re-check for the payload, after the caller copied it
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return GetSlot(seq)->seq.load(std::memory_order_relaxed) == seq;
+    }
+}
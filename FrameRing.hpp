@@ -0,0 +1,85 @@
+//
+//  FrameRing.hpp
+//  Simple-Rtsp-Client
+//
+
+#ifndef FrameRing_hpp
+#define FrameRing_hpp
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace RK {
+
+    enum FrameRingFlags {
+        FrameRingKeyFrame = 1 << 0,
+    };
+
+    // shared memory layout:
+    // [FrameRingHeader][FrameRingSlot + payload] * slotCount
+    // one publisher, any number of subscribers in other processes.
+    struct FrameRingHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t slotCount;
+        uint32_t slotSize;              // payload bytes per slot
+        std::atomic<uint64_t> head;     // sequence of the next frame to publish
+        std::atomic<uint32_t> futex;    // bumped on every publish, subscribers sleep on it
+        std::atomic<uint32_t> waiters;
+    };
+
+    struct FrameRingSlot {
+        std::atomic<uint64_t> seq;      // frame sequence, FRAME_RING_BUSY set while writing
+        uint32_t size;
+        uint32_t flags;
+        uint32_t timestamp;
+        uint32_t reserved;
+        int64_t pts;
+        int64_t wallclock;
+    };
+
+    struct FrameRingFrame {
+        const unsigned char *data;      // points into the mapping, valid until Validate() fails
+        uint32_t size;
+        uint32_t flags;
+        uint32_t timestamp;             // rtp timestamp
+        int64_t pts;                    // see MediaFrame
+        int64_t wallclock;
+    };
+
+    class FrameRing {
+    public:
+        typedef std::shared_ptr<FrameRing> Ptr;
+        FrameRing();
+        ~FrameRing();
+
+        // publisher side
+        bool Create(const std::string &name, uint32_t slotCount, uint32_t slotSize);
+        bool Publish(const unsigned char *data, size_t size, uint32_t timestamp, int64_t pts, int64_t wallclock, uint32_t flags);
+
+        // subscriber side
+        bool Open(const std::string &name);
+        bool Wait(uint64_t seq, int timeoutMs);
+        bool Acquire(uint64_t seq, FrameRingFrame *frame);
+        bool Validate(uint64_t seq);
+        uint64_t Head() const;
+        uint64_t Oldest() const;
+
+        void Close();
+    protected:
+        FrameRingSlot *GetSlot(uint64_t seq) const;
+        bool Map(int fd, size_t size, bool create);
+    private:
+        std::string _name;
+        bool _owner = false;
+        unsigned char *_base = nullptr;
+        size_t _mapSize = 0;
+        FrameRingHeader *_header = nullptr;
+        size_t _slotStride = 0;
+    };
+
+} //namespace RK
+#endif /* FrameRing_hpp */
@@ -0,0 +1,296 @@
+//
+//  FrameSink.cpp
+//  Simple-Rtsp-Client
+//
+
+#include "FrameSink.hpp"
+#include "NalParser.hpp"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "Log.hpp"
+
+#define MODULE_TAG "FrameSink"
+
+// unsent bytes a fan-out client may pile up before it is dropped
+#define FANOUT_BACKLOG_SIZE (4 * 1024 * 1024)
+#define FANOUT_SNDBUF_SIZE (1024 * 1024)
+
+namespace RK {
+
+    const std::vector<unsigned char> &FrameSink::MissingSets(const MediaFrame &frame) {
+        _Missing.clear();
+        if (!frame.keyframe) {
+            return _Missing;
+        }
+
+        // a new stream may not even be the same codec
+        if (frame.codec != _Codec) {
+            _Codec = frame.codec;
+            for (std::vector<unsigned char> &set : _Sets) {
+                set.clear();
+            }
+        }
+        bool h265 = frame.codec == VideoCodecH265;
+        // vps, sps and pps types, h264 has no vps
+        static const int h264Types[] = {-1, 7, 8};
+        static const int h265Types[] = {32, 33, 34};
+        const int *types = h265 ? h265Types : h264Types;
+        bool found[3] = {!h265, false, false};
+        ForEachNalu(frame.data, frame.size, [this, types, &found](const unsigned char *nalu, size_t size) {
+            int type = NaluType(_Codec, nalu);
+            for (int i = 0; i < 3; i++) {
+                if (type == types[i]) {
+                    found[i] = true;
+                    _Sets[i].assign(nalu, nalu + size);
+                }
+            }
+        });
+        if ((found[0] && found[1] && found[2]) || _Sets[1].empty() || _Sets[2].empty() || (h265 && _Sets[0].empty())) {
+            return _Missing;
+        }
+
+        // all of them, a pps may depend on its sps being parsed first
+        const unsigned char header[] = {0, 0, 0, 1};
+        for (const std::vector<unsigned char> &set : _Sets) {
+            if (!set.empty()) {
+                _Missing.insert(_Missing.end(), header, header + sizeof(header));
+                _Missing.insert(_Missing.end(), set.begin(), set.end());
+            }
+        }
+        return _Missing;
+    }
+
+    FileSink::FileSink() {
+    }
+
+    FileSink::~FileSink() {
+        if (_File) {
+            ::fclose(_File);
+        }
+    }
+
+    bool FileSink::Open(const std::string &path) {
+        _File = ::fopen(path.c_str(), "ab");
+        if (!_File) {
+            log(MODULE_TAG, "failed to open %s %s", path.c_str(), strerror(errno));
+            return false;
+        }
+        _Path = path;
+        return true;
+    }
+
+    void FileSink::Write(const MediaFrame &frame) {
+        const std::vector<unsigned char> &sets = MissingSets(frame);
+        if (!_File || (!_Synced && !frame.keyframe)) {
+            return;
+        }
+
+        bool failed = false;
+        if (!_Synced && !sets.empty()) {
+            failed = ::fwrite(sets.data(), 1, sets.size(), _File) != sets.size();
+        }
+        _Synced = true;
+        if (failed || ::fwrite(frame.data, 1, frame.size, _File) != frame.size) {
+            log(MODULE_TAG, "write to %s failed %s, recording stopped", _Path.c_str(), strerror(errno));
+            ::fclose(_File);
+            _File = nullptr;
+        }
+    }
+
+    void FileSink::Reset() {
+        _Synced = false;
+    }
+
+    FanoutSink::FanoutSink(EventLoop::Ptr loop) {
+        _Loop = loop;
+    }
+
+    FanoutSink::~FanoutSink() {
+        _Loop->RunInLoopSync([this] {
+            if (_Socket >= 0) {
+                _Loop->RemoveFd(_Socket);
+                ::close(_Socket);
+            }
+            for (auto &client : _Clients) {
+                Close(client.fd);
+            }
+        });
+    }
+
+    bool FanoutSink::Listen(unsigned short port) {
+        _Socket = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (_Socket < 0) {
+            log(MODULE_TAG, "failed to create socket %s", strerror(errno));
+            return false;
+        }
+
+        int reuse = 1;
+        ::setsockopt(_Socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        struct sockaddr_in addr;
+        ::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        if (::bind(_Socket, (struct sockaddr *)&addr, sizeof(addr)) < 0 || ::listen(_Socket, 16) < 0) {
+            log(MODULE_TAG, "failed to listen on port %d %s", port, strerror(errno));
+            ::close(_Socket);
+            _Socket = -1;
+            return false;
+        }
+        _Port = port;
+
+        bool added = false;
+        _Loop->RunInLoopSync([this, &added] {
+            added = _Loop->AddFd(_Socket, EventRead, [this](int) {
+                HandleAccept();
+            });
+        });
+        return added;
+    }
+
+    void FanoutSink::HandleAccept() {
+        while (true) {
+            int fd = ::accept4(_Socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    log(MODULE_TAG, "accept on port %d failed %s", _Port, strerror(errno));
+                }
+                return;
+            }
+
+            int nodelay = 1;
+            int sndbuf = FANOUT_SNDBUF_SIZE;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+            ::setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+            // clients send nothing, readable means it hung up
+            std::lock_guard<std::mutex> lock(_Lock);
+            if (!_Loop->AddFd(fd, EventRead, [this, fd](int events) {
+                HandleClient(fd, events);
+            })) {
+                ::close(fd);
+                continue;
+            }
+            Client client;
+            client.fd = fd;
+            client.synced = false;
+            client.writable = false;
+            _Clients.push_back(client);
+        }
+    }
+
+    void FanoutSink::HandleClient(int fd, int events) {
+        std::lock_guard<std::mutex> lock(_Lock);
+        auto it = std::find_if(_Clients.begin(), _Clients.end(), [fd](const Client &client) {
+            return client.fd == fd;
+        });
+        if (it == _Clients.end()) {
+            return;
+        }
+
+        bool alive = true;
+        if (events & (EventRead | EventError)) {
+            char buf[256];
+            ssize_t got = ::recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+            alive = got > 0 || (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+        }
+        // the backlog goes out as soon as the socket takes it, not with the next frame
+        if (alive && (events & EventWrite)) {
+            alive = Flush(*it);
+            if (alive && it->pending.empty()) {
+                it->writable = false;
+                _Loop->ModifyFd(fd, EventRead);
+            }
+        }
+        if (!alive) {
+            _Clients.erase(it);
+            Close(fd);
+        }
+    }
+
+    void FanoutSink::Close(int fd) {
+        // loop thread only, the fd may not be reused while the loop watches it
+        _Loop->RemoveFd(fd);
+        ::close(fd);
+    }
+
+    bool FanoutSink::Flush(Client &client) {
+        if (client.pending.empty()) {
+            return true;
+        }
+        ssize_t sent = ::send(client.fd, client.pending.data(), client.pending.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            return false;
+        }
+        client.pending.erase(client.pending.begin(), client.pending.begin() + (sent > 0 ? sent : 0));
+        return true;
+    }
+
+    bool FanoutSink::Send(Client &client, const unsigned char *data, size_t size) {
+        // keep byte order, nothing new goes out before the backlog
+        if (!Flush(client)) {
+            return false;
+        }
+
+        size_t offset = 0;
+        if (client.pending.empty()) {
+            ssize_t sent = ::send(client.fd, data, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                return false;
+            }
+            offset = sent > 0 ? sent : 0;
+        }
+
+        if (client.pending.size() + size - offset > FANOUT_BACKLOG_SIZE) {
+            log(MODULE_TAG, "client on port %d too slow, dropped", _Port);
+            return false;
+        }
+        client.pending.insert(client.pending.end(), data + offset, data + size);
+        if (!client.pending.empty() && !client.writable) {
+            // the loop may be this thread, and Write holds the lock
+            client.writable = true;
+            int fd = client.fd;
+            _Loop->RunInLoop([this, fd] {
+                _Loop->ModifyFd(fd, EventRead | EventWrite);
+            });
+        }
+        return true;
+    }
+
+    void FanoutSink::Write(const MediaFrame &frame) {
+        std::lock_guard<std::mutex> lock(_Lock);
+        const std::vector<unsigned char> &sets = MissingSets(frame);
+        for (size_t i = 0; i < _Clients.size();) {
+            Client &client = _Clients[i];
+            bool joining = !client.synced && frame.keyframe;
+            client.synced = client.synced || frame.keyframe;
+            if ((joining && !sets.empty() && !Send(client, sets.data(), sets.size())) ||
+                (client.synced && !Send(client, frame.data, frame.size))) {
+                int fd = client.fd;
+                _Clients.erase(_Clients.begin() + i);
+                _Loop->RunInLoop([this, fd] {
+                    Close(fd);
+                });
+                continue;
+            }
+            i++;
+        }
+    }
+
+    void FanoutSink::Reset() {
+        std::lock_guard<std::mutex> lock(_Lock);
+        for (auto &client : _Clients) {
+            client.synced = false;
+        }
+    }
+
+    size_t FanoutSink::Clients() {
+        std::lock_guard<std::mutex> lock(_Lock);
+        return _Clients.size();
+    }
+}
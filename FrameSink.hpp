@@ -0,0 +1,88 @@
+//
+//  FrameSink.hpp
+//  Simple-Rtsp-Client
+//
+
+#ifndef FrameSink_hpp
+#define FrameSink_hpp
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include "EventLoop.hpp"
+#include "RtspPlayer.hpp"
+
+namespace RK {
+
+    // consumer of assembled video frames. Write runs on whatever thread
+    // delivers frames (the loop, or the low latency consumer).
+    class FrameSink {
+    public:
+        typedef std::shared_ptr<FrameSink> Ptr;
+        virtual ~FrameSink() {}
+        virtual void Write(const MediaFrame &frame) = 0;
+        // the stream starts over (a new session), the next frame need not
+        // follow the last one. never concurrent with Write
+        virtual void Reset() {}
+    protected:
+        // a key frame starting a file or client only decodes with its
+        // parameter sets ahead of it. remembers the stream's in-band sets from key
+        // frames and returns those this one lacks, empty for other frames
+        const std::vector<unsigned char> &MissingSets(const MediaFrame &frame);
+    private:
+        VideoCodec _Codec = VideoCodecUnknown;
+        std::vector<unsigned char> _Sets[3];    // vps (h265 only), sps, pps
+        std::vector<unsigned char> _Missing;
+    };
+
+    // appends the annex-b stream to a file, starting at a key frame with
+    // its parameter sets
+    class FileSink : public FrameSink {
+    public:
+        FileSink();
+        ~FileSink();
+        bool Open(const std::string &path);
+        void Write(const MediaFrame &frame) override;
+        void Reset() override;
+    private:
+        FILE *_File = nullptr;
+        bool _Synced = false;
+        std::string _Path;
+    };
+
+    // annex-b over tcp to any number of clients, each joining at the next
+    // key frame. clients that fall too far behind are dropped instead of
+    // stalling the stream.
+    class FanoutSink : public FrameSink {
+    public:
+        FanoutSink(EventLoop::Ptr loop);
+        ~FanoutSink();
+        bool Listen(unsigned short port);
+        void Write(const MediaFrame &frame) override;
+        void Reset() override;
+        size_t Clients();
+    protected:
+        struct Client {
+            int fd;
+            bool synced;
+            bool writable;      // waiting for the socket to drain pending
+            std::vector<unsigned char> pending;     // what the socket did not take yet
+        };
+
+        void HandleAccept();
+        void HandleClient(int fd, int events);
+        bool Flush(Client &client);
+        bool Send(Client &client, const unsigned char *data, size_t size);
+        void Close(int fd);
+    private:
+        EventLoop::Ptr _Loop;
+        int _Socket = -1;
+        unsigned short _Port = 0;
+        std::mutex _Lock;
+        std::vector<Client> _Clients;
+    };
+
+} //namespace RK
+#endif /* FrameSink_hpp */
@@ -0,0 +1,132 @@
+//
+//  IngestConfig.cpp
+//  Simple-Rtsp-Client
+//
+
+#include "IngestConfig.hpp"
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <stdlib.h>
+#include "Log.hpp"
+
+#define MODULE_TAG "IngestConfig"
+
+namespace RK {
+
+    static bool ParseInt(const std::string &value, int *out) {
+        char *end = nullptr;
+        long v = ::strtol(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0') {
+            return false;
+        }
+        *out = (int)v;
+        return true;
+    }
+
+    static bool ParseStream(std::istringstream &words, StreamConfig *stream) {
+        if (!(words >> stream->name >> stream->url)) {
+            return false;
+        }
+        if (stream->Push() && (stream->PushPath().empty() || stream->PushPath()[0] != '/')) {
+            return false;
+        }
+
+        std::string option;
+        while (words >> option) {
+            size_t eq = option.find('=');
+            if (eq == std::string::npos) {
+                return false;
+            }
+            std::string key = option.substr(0, eq);
+            std::string value = option.substr(eq + 1);
+
+            if (key == "transport") {
+                if (value != "udp" && value != "multicast") {
+                    return false;
+                }
+                stream->multicast = value == "multicast";
+            } else if (key == "latency") {
+                if (!ParseInt(value, &stream->latencyMs)) {
+                    return false;
+                }
+            } else if (key == "retransmit") {
+                if (!ParseInt(value, &stream->retransmitMs)) {
+                    return false;
+                }
+            } else if (key == "keyframe-interval") {
+                if (!ParseInt(value, &stream->keyframeIntervalMs) || stream->keyframeIntervalMs < 0) {
+                    return false;
+                }
+            } else if (key == "record" || key == "shm" || key == "fanout" || key == "keyframes") {
+                SinkConfig sink;
+                sink.type = key == "record" ? SinkRecord : key == "shm" ? SinkShm : key == "fanout" ? SinkFanout : SinkKeyframes;
+                sink.target = value;
+                int port = 0;
+                if (value.empty() || (sink.type == SinkFanout && (!ParseInt(value, &port) || port <= 0 || port > 65535))) {
+                    return false;
+                }
+                stream->sinks.push_back(sink);
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool LoadIngestConfig(const std::string &path, IngestConfig *config) {
+        std::ifstream file(path);
+        if (!file) {
+            log(MODULE_TAG, "failed to open %s", path.c_str());
+            return false;
+        }
+
+        IngestConfig parsed;
+        std::set<std::string> names;
+        std::string line;
+        for (int number = 1; std::getline(file, line); number++) {
+            line = line.substr(0, line.find('#'));
+            std::istringstream words(line);
+            std::string key;
+            if (!(words >> key)) {
+                continue;
+            }
+
+            bool ok = true;
+            if (key == "stream") {
+                StreamConfig stream;
+                ok = ParseStream(words, &stream) && names.insert(stream.name).second;
+                parsed.streams.push_back(stream);
+            } else if (key == "cpus") {
+                std::string list, cpu;
+                ok = (bool)(words >> list);
+                std::istringstream cpus(list);
+                while (ok && std::getline(cpus, cpu, ',')) {
+                    int value = 0;
+                    ok = ParseInt(cpu, &value) && value >= 0;
+                    parsed.cpus.push_back(value);
+                }
+            } else if (key == "health") {
+                ok = (bool)(words >> parsed.healthPath);
+            } else if (key == "listen") {
+                std::string value;
+                ok = (words >> value) && ParseInt(value, &parsed.listenPort) && parsed.listenPort > 0 && parsed.listenPort <= 65535;
+            } else if (key == "trace") {
+                ok = (bool)(words >> parsed.tracePath);
+            } else if (key == "health-interval") {
+                std::string value;
+                ok = (words >> value) && ParseInt(value, &parsed.healthIntervalMs) && parsed.healthIntervalMs > 0;
+            } else {
+                ok = false;
+            }
+
+            if (!ok) {
+                log(MODULE_TAG, "%s:%d: invalid line '%s'", path.c_str(), number, line.c_str());
+                return false;
+            }
+        }
+
+        *config = parsed;
+        return true;
+    }
+}
@@ -0,0 +1,73 @@
+//
+//  IngestConfig.hpp
+//  Simple-Rtsp-Client
+//
+
+#ifndef IngestConfig_hpp
+#define IngestConfig_hpp
+
+#include <string>
+#include <vector>
+
+namespace RK {
+
+    enum SinkType {
+        SinkRecord = 0,     // annex-b elementary stream file
+        SinkShm,            // FrameRing in shared memory
+        SinkFanout,         // annex-b over tcp to every connected client
+        SinkKeyframes,      // FrameRing of idr access units with their sps/pps, for thumbnailers
+    };
+
+    struct SinkConfig {
+        SinkType type;
+        std::string target; // path, shm name or listen port
+
+        bool operator==(const SinkConfig &other) const { return type == other.type && target == other.target; }
+    };
+
+    struct StreamConfig {
+        std::string name;
+        std::string url;
+        bool multicast = false;
+        int latencyMs = 0;              // RtspPlayer::SetLowLatency
+        int retransmitMs = -1;          // RtspPlayer::SetRetransmission, -1 keeps the default
+        int keyframeIntervalMs = 0;     // RtspPlayer::SetKeyframeCallback, for keyframes= sinks
+        std::vector<SinkConfig> sinks;
+
+        // "push:/path" waits for an encoder to ANNOUNCE that path on the listen port
+        bool Push() const { return url.compare(0, 5, "push:") == 0; }
+        std::string PushPath() const { return Push() ? url.substr(5) : std::string(); }
+
+        bool operator==(const StreamConfig &other) const {
+            return name == other.name && url == other.url && multicast == other.multicast &&
+                latencyMs == other.latencyMs && retransmitMs == other.retransmitMs &&
+                keyframeIntervalMs == other.keyframeIntervalMs && sinks == other.sinks;
+        }
+        bool operator!=(const StreamConfig &other) const { return !(*this == other); }
+    };
+
+    // line based, '#' starts a comment:
+    //
+    //     cpus 0,1,2,3
+    //     health /run/rtspingestd.health
+    //     health-interval 1000
+    //     listen 8554
+    //     trace /tmp/rtspingestd.trace.json
+    //     stream cam1 rtsp://10.0.0.1/main transport=multicast latency=200 record=/data/cam1.h264 shm=cam1 fanout=9001
+    //     stream cam2 push:/live/cam2 record=/data/cam2.h264
+    //     stream cam3 rtsp://10.0.0.3/main keyframes=cam3.thumbs keyframe-interval=5000
+    //
+    // sink keys may repeat. stream names must be unique.
+    struct IngestConfig {
+        std::vector<int> cpus;          // event loop cpus, every online cpu when empty
+        std::string healthPath;         // "-" for stdout, empty for none
+        int healthIntervalMs = 1000;
+        int listenPort = 0;             // rtsp port for push streams, 0 for none
+        std::string tracePath;          // SIGUSR1 dumps the frame trace here
+        std::vector<StreamConfig> streams;
+    };
+
+    bool LoadIngestConfig(const std::string &path, IngestConfig *config);
+
+} //namespace RK
+#endif /* IngestConfig_hpp */
@@ -0,0 +1,385 @@
+//
+//  IngestStream.cpp
+//  Simple-Rtsp-Client
+//
+
+#include "IngestStream.hpp"
+#include <algorithm>
+#include <stdlib.h>
+#include "Log.hpp"
+
+#define MODULE_TAG "IngestStream"
+
+#define INGEST_WATCHDOG_MS (500)
+// handshake must be through by then
+#define INGEST_CONNECT_TIMEOUT_MS (15000)
+// playing without a frame for this long counts as a failure
+#define INGEST_STALL_MS (5000)
+#define INGEST_BACKOFF_MIN_MS (1000)
+#define INGEST_BACKOFF_MAX_MS (30000)
+#define INGEST_RING_SLOTS (64)
+#define INGEST_RING_SLOT_SIZE (1024 * 1024)
+// a thumbnailer only wants the latest few
+#define INGEST_KEYFRAME_SLOTS (8)
+
+namespace RK {
+
+    IngestStream::IngestStream(const StreamConfig &config, EventLoop::Ptr loop) {
+        _Config = config;
+        _Loop = loop;
+        _BackoffMs = INGEST_BACKOFF_MIN_MS;
+        _State = IngestStopped;
+        _Frames = 0;
+        _Keyframes = 0;
+        _Bytes = 0;
+        _LastFrameMs = -1;
+        _Reconnects = 0;
+    }
+
+    IngestStream::~IngestStream() {
+        Stop();
+    }
+
+    int64_t IngestStream::NowMs() const {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+    bool IngestStream::Start() {
+        for (auto &sink : _Config.sinks) {
+            if (sink.type == SinkRecord) {
+                std::shared_ptr<FileSink> file = std::make_shared<FileSink>();
+                if (!file->Open(sink.target)) {
+                    return false;
+                }
+                _Sinks.push_back(file);
+            } else if (sink.type == SinkShm) {
+                // the player publishes into the ring itself
+                _Ring = std::make_shared<FrameRing>();
+                if (!_Ring->Create(sink.target, INGEST_RING_SLOTS, INGEST_RING_SLOT_SIZE)) {
+                    return false;
+                }
+            } else if (sink.type == SinkFanout) {
+                std::shared_ptr<FanoutSink> fanout = std::make_shared<FanoutSink>(_Loop);
+                if (!fanout->Listen((unsigned short)::atoi(sink.target.c_str()))) {
+                    return false;
+                }
+                _Fanout = fanout;
+                _Sinks.push_back(fanout);
+            } else if (sink.type == SinkKeyframes) {
+                _KeyframeRing = std::make_shared<FrameRing>();
+                if (!_KeyframeRing->Create(sink.target, INGEST_KEYFRAME_SLOTS, INGEST_RING_SLOT_SIZE)) {
+                    return false;
+                }
+            }
+        }
+
+        if (_Config.Push()) {
+            _State = IngestWaiting;
+        }
+        std::weak_ptr<IngestStream> weak = shared_from_this();
+        _Loop->RunInLoop([this, weak] {
+            if (weak.expired()) {
+                return;
+            }
+            if (_State == IngestWaiting) {
+                _StateSince = NowMs();
+            } else {
+                Connect();
+            }
+            Watchdog();
+        });
+        return true;
+    }
+
+    void IngestStream::Stop() {
+        _Loop->RunInLoopSync([this] {
+            if (_Timer) {
+                _Loop->Cancel(_Timer);
+                _Timer = 0;
+            }
+            DropPlayer();
+            _State = IngestStopped;
+        });
+        DropPush(true);
+    }
+
+    bool IngestStream::AttachPush(RtspPlayer::Ptr player) {
+        {
+            std::lock_guard<std::mutex> lock(_PushLock);
+            if (_PushPlayer || _State == IngestStopped) {
+                log(MODULE_TAG, "%s: refusing a second encoder", _Config.name.c_str());
+                return false;
+            }
+            _PushPlayer = player;
+            if (_PushSessions++) {
+                _Reconnects++;
+            }
+
+            // still before RECORD, nothing is flowing yet
+            if (_Config.retransmitMs >= 0) {
+                player->SetRetransmission(_Config.retransmitMs);
+            }
+            if (_Ring) {
+                player->SetFrameRing(_Ring);
+            }
+            SetKeyframeTap(player);
+            player->SetVideoFrameCallback([this](const MediaFrame &frame) {
+                HandleFrame(frame);
+            });
+            player->SetLowLatency(_Config.latencyMs);
+        }
+
+        std::weak_ptr<IngestStream> weak = shared_from_this();
+        _Loop->RunInLoop([this, weak] {
+            if (!weak.expired() && _State == IngestWaiting) {
+                _State = IngestPlaying;
+                _StateSince = NowMs();
+            }
+        });
+        return true;
+    }
+
+    void IngestStream::DetachPush(RtspPlayer::Ptr player) {
+        {
+            // health reads the player's stats under the same lock
+            std::lock_guard<std::mutex> lock(_PushLock);
+            if (_PushPlayer != player) {
+                return;
+            }
+            _PushPlayer.reset();
+            // joins the low latency consumer, nothing calls HandleFrame after this
+            player->SetLowLatency(0);
+            player->SetVideoFrameCallback(nullptr);
+            ResetSinks();
+        }
+
+        std::weak_ptr<IngestStream> weak = shared_from_this();
+        _Loop->RunInLoop([this, weak] {
+            if (!weak.expired() && _State == IngestPlaying) {
+                _State = IngestWaiting;
+                _StateSince = NowMs();
+            }
+        });
+    }
+
+    void IngestStream::DropPush(bool wait) {
+        RtspPlayer::Ptr player;
+        {
+            std::lock_guard<std::mutex> lock(_PushLock);
+            player = _PushPlayer;
+            if (wait) {
+                _PushPlayer.reset();
+            }
+        }
+        if (!player) {
+            return;
+        }
+
+        // the listener hears the teardown and releases the player. a loop
+        // must not block on another one, from there the teardown detaches
+        // the player later on its own loop.
+        if (!wait) {
+            player->AsyncStop(nullptr);
+            return;
+        }
+        player->Stop();
+        player->SetLowLatency(0);
+        player->SetVideoFrameCallback(nullptr);
+    }
+
+    void IngestStream::DropPlayer() {
+        if (!_Player) {
+            return;
+        }
+
+        // stale callbacks of the old player are ignored by generation
+        _Generation++;
+        _Player->Stop();
+        // joins the low latency consumer, nothing calls HandleFrame after this
+        _Player->SetLowLatency(0);
+        _Player->SetVideoFrameCallback(nullptr);
+        ResetSinks();
+        // tasks it already queued may still touch it, let them run first
+        RtspPlayer::Ptr player = _Player;
+        _Player.reset();
+        _Loop->Post([player] {});
+    }
+
+    void IngestStream::Connect() {
+        uint32_t generation = ++_Generation;
+        std::weak_ptr<IngestStream> weak = shared_from_this();
+
+        _Player = std::make_shared<RtspPlayer>(_Loop);
+        _Player->SetTransport(_Config.multicast ? RtspTransportMulticast : RtspTransportUnicast);
+        if (_Config.retransmitMs >= 0) {
+            _Player->SetRetransmission(_Config.retransmitMs);
+        }
+        if (_Ring) {
+            _Player->SetFrameRing(_Ring);
+        }
+        SetKeyframeTap(_Player);
+        _Player->SetVideoFrameCallback([this](const MediaFrame &frame) {
+            HandleFrame(frame);
+        });
+        // after the callback, the queue hands frames to it
+        _Player->SetLowLatency(_Config.latencyMs);
+
+        _State = IngestConnecting;
+        _StateSince = NowMs();
+        _Player->Play(_Config.url, [this, weak, generation](const RtspResult &result) {
+            if (weak.expired() || generation != _Generation) {
+                return;
+            }
+            if (!result.Succeeded()) {
+                char reason[256];
+                ::snprintf(reason, sizeof(reason), "%s failed %d %s", result.method == RTSPCONNECT ? "connect" : "handshake",
+                    result.status, result.reason.c_str());
+                std::string error = reason;
+                // not from inside the player's own callback
+                _Loop->Post([this, weak, generation, error] {
+                    if (!weak.expired() && generation == _Generation) {
+                        Retry(error);
+                    }
+                });
+                return;
+            }
+            _State = IngestPlaying;
+            _StateSince = NowMs();
+        });
+    }
+
+    void IngestStream::Retry(const std::string &reason) {
+        log(MODULE_TAG, "%s: %s, retrying in %d ms", _Config.name.c_str(), reason.c_str(), _BackoffMs);
+        {
+            std::lock_guard<std::mutex> lock(_HealthLock);
+            _LastError = reason;
+        }
+
+        DropPlayer();
+        _State = IngestRetrying;
+        _RetryAt = NowMs() + _BackoffMs;
+        _BackoffMs = std::min(_BackoffMs * 2, INGEST_BACKOFF_MAX_MS);
+    }
+
+    void IngestStream::Watchdog() {
+        int64_t now = NowMs();
+        int64_t last = _LastFrameMs;
+
+        switch (_State) {
+            case IngestConnecting:
+                if (now - _StateSince > INGEST_CONNECT_TIMEOUT_MS) {
+                    Retry("handshake timeout");
+                }
+                break;
+            case IngestPlaying:
+                if (now - std::max(last, _StateSince) > INGEST_STALL_MS && _Config.Push()) {
+                    // the encoder may come back, wait for it
+                    log(MODULE_TAG, "%s: no frames, dropping the encoder", _Config.name.c_str());
+                    {
+                        std::lock_guard<std::mutex> lock(_HealthLock);
+                        _LastError = "no frames";
+                    }
+                    _State = IngestWaiting;
+                    _StateSince = now;
+                    DropPush(false);
+                } else if (now - std::max(last, _StateSince) > INGEST_STALL_MS) {
+                    Retry("no frames");
+                } else if (last >= _StateSince) {
+                    _BackoffMs = INGEST_BACKOFF_MIN_MS;
+                }
+                break;
+            case IngestRetrying:
+                if (now >= _RetryAt) {
+                    _Reconnects++;
+                    Connect();
+                }
+                break;
+            case IngestWaiting:
+                break;
+            default:
+                return;
+        }
+
+        std::weak_ptr<IngestStream> weak = shared_from_this();
+        _Timer = _Loop->RunAfter(INGEST_WATCHDOG_MS, [this, weak] {
+            if (!weak.expired()) {
+                _Timer = 0;
+                Watchdog();
+            }
+        });
+    }
+
+    void IngestStream::HandleFrame(const MediaFrame &frame) {
+        _Frames++;
+        _Bytes += frame.size;
+        if (frame.keyframe) {
+            _Keyframes++;
+        }
+        _LastFrameMs = NowMs();
+
+        for (auto &sink : _Sinks) {
+            sink->Write(frame);
+        }
+    }
+
+    void IngestStream::ResetSinks() {
+        // the next session starts wherever the camera is, files and clients
+        // wait for its first key frame
+        for (auto &sink : _Sinks) {
+            sink->Reset();
+        }
+    }
+
+    void IngestStream::SetKeyframeTap(RtspPlayer::Ptr player) {
+        if (!_KeyframeRing) {
+            return;
+        }
+        // holds the ring, not the stream, nothing to undo when the player goes
+        FrameRing::Ptr ring = _KeyframeRing;
+        player->SetKeyframeCallback(_Config.keyframeIntervalMs, [ring](const MediaFrame &frame) {
+            ring->Publish(frame.data, frame.size, frame.timestamp, frame.pts, frame.wallclock, FrameRingKeyFrame);
+        });
+    }
+
+    IngestHealth IngestStream::GetHealth() {
+        IngestHealth health;
+        int64_t now = NowMs();
+        int64_t last = _LastFrameMs;
+
+        health.name = _Config.name;
+        health.state = _State;
+        health.frames = _Frames;
+        health.keyframes = _Keyframes;
+        health.bytes = _Bytes;
+        health.lastFrameAgeMs = last < 0 ? -1 : now - last;
+        health.reconnects = _Reconnects;
+        health.fanoutClients = _Fanout ? _Fanout->Clients() : 0;
+        health.jitter = JitterStats();
+        health.latency = LatencyStats();
+        health.stream = StreamStats();
+
+        // the player is swapped on the loop, read its counters there
+        _Loop->RunInLoopSync([this, &health] {
+            if (_Player) {
+                health.jitter = _Player->GetJitterStats();
+                health.latency = _Player->GetLatencyStats();
+                health.stream = _Player->GetStreamStats();
+            }
+        });
+        {
+            std::lock_guard<std::mutex> lock(_PushLock);
+            if (_PushPlayer) {
+                health.jitter = _PushPlayer->GetJitterStats();
+                health.latency = _PushPlayer->GetLatencyStats();
+                health.stream = _PushPlayer->GetStreamStats();
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(_HealthLock);
+        health.lastError = _LastError;
+        health.fps = _SampleMs && now > _SampleMs ? (health.frames - _SampleFrames) * 1000.0 / (now - _SampleMs) : 0;
+        _SampleFrames = health.frames;
+        _SampleMs = now;
+        return health;
+    }
+}
@@ -0,0 +1,119 @@
+//
+//  IngestStream.hpp
+//  Simple-Rtsp-Client
+//
+
+#ifndef IngestStream_hpp
+#define IngestStream_hpp
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "EventLoop.hpp"
+#include "FrameRing.hpp"
+#include "FrameSink.hpp"
+#include "IngestConfig.hpp"
+#include "RtspPlayer.hpp"
+
+namespace RK {
+
+    enum IngestState {
+        IngestConnecting = 0,
+        IngestPlaying,
+        IngestRetrying,     // waiting out the backoff after a failure or stall
+        IngestStopped,
+        IngestWaiting,      // push stream without an encoder
+    };
+
+    struct IngestHealth {
+        std::string name;
+        IngestState state;
+        uint64_t frames;
+        uint64_t keyframes;
+        uint64_t bytes;
+        double fps;                 // since the previous health sample
+        int64_t lastFrameAgeMs;     // -1 before the first frame
+        uint32_t reconnects;
+        size_t fanoutClients;
+        JitterStats jitter;
+        LatencyStats latency;
+        StreamStats stream;
+        std::string lastError;
+    };
+
+    // one supervised camera: a player on a shared loop feeding the
+    // configured sinks, replaced with a fresh one whenever the session
+    // fails or stops delivering frames. the sinks outlive the players so
+    // recordings, rings and fan-out clients carry on across reconnects.
+    // push streams never connect, they feed from whichever player the
+    // listener attaches.
+    class IngestStream : public std::enable_shared_from_this<IngestStream> {
+    public:
+        typedef std::shared_ptr<IngestStream> Ptr;
+        IngestStream(const StreamConfig &config, EventLoop::Ptr loop);
+        ~IngestStream();
+
+        // opens the sinks and starts connecting, false when a sink failed
+        bool Start();
+        // tears the session down, blocks until the loop let go of it
+        void Stop();
+
+        // from the pushing player's loop, false when an encoder already pushes
+        bool AttachPush(RtspPlayer::Ptr player);
+        void DetachPush(RtspPlayer::Ptr player);
+
+        IngestHealth GetHealth();
+        const StreamConfig &Config() const { return _Config; }
+    protected:
+        typedef std::chrono::steady_clock Clock;
+
+        void Connect();
+        void Retry(const std::string &reason);
+        void Watchdog();
+        void DropPlayer();
+        // blocks until the encoder is gone when wait, off loop threads only
+        void DropPush(bool wait);
+        void HandleFrame(const MediaFrame &frame);
+        void ResetSinks();
+        void SetKeyframeTap(RtspPlayer::Ptr player);
+        int64_t NowMs() const;
+    private:
+        StreamConfig _Config;
+        EventLoop::Ptr _Loop;
+
+        // loop thread only
+        RtspPlayer::Ptr _Player;
+        uint32_t _Generation = 0;
+        uint64_t _Timer = 0;
+        int64_t _StateSince = 0;
+        int64_t _RetryAt = 0;
+        int _BackoffMs;
+
+        FrameRing::Ptr _Ring;
+        FrameRing::Ptr _KeyframeRing;
+        std::shared_ptr<FanoutSink> _Fanout;
+        std::vector<FrameSink::Ptr> _Sinks;
+
+        // lives on some other loop of the group
+        std::mutex _PushLock;
+        RtspPlayer::Ptr _PushPlayer;
+        uint32_t _PushSessions = 0;
+
+        std::atomic<IngestState> _State;
+        std::atomic<uint64_t> _Frames;
+        std::atomic<uint64_t> _Keyframes;
+        std::atomic<uint64_t> _Bytes;
+        std::atomic<int64_t> _LastFrameMs;
+        std::atomic<uint32_t> _Reconnects;
+
+        std::mutex _HealthLock;
+        std::string _LastError;
+        uint64_t _SampleFrames = 0;
+        int64_t _SampleMs = 0;
+    };
+
+} //namespace RK
+#endif /* IngestStream_hpp */
@@ -0,0 +1,197 @@
+//
+//  JitterBuffer.cpp
+//  Simple-Rtsp-Client
+//
+
+#include "JitterBuffer.hpp"
+
+// default reorder window in packets, a jump further than this flushes the buffer
+#define JITTER_SLOTS (1024)
+#define JITTER_MAX_SLOTS (16384)
+// while a hole is open
+#define JITTER_TICK_MS (10)
+// nack again if the retransmission did not show up by then
+#define JITTER_NACK_RETRY_MS (40)
+
+namespace RK {
+
+    // seq % size only stays unique across the 16 bit wrap for powers of two,
+    // and the window must stay below half the sequence space
+    static size_t SlotCount(size_t slots) {
+        size_t count = 16;
+        while (count < slots && count < JITTER_MAX_SLOTS) {
+            count <<= 1;
+        }
+        return slots ? count : JITTER_SLOTS;
+    }
+
+    JitterBuffer::JitterBuffer(EventLoop *loop, int budgetMs, size_t slots, Output output, Nack nack) : _Slots(SlotCount(slots)) {
+        _Loop = loop;
+        _Budget = std::chrono::milliseconds(budgetMs);
+        _Output = output;
+        _Nack = nack;
+        _Received = 0;
+        _Recovered = 0;
+        _Lost = 0;
+        _Nacked = 0;
+    }
+
+    JitterBuffer::~JitterBuffer() {
+        if (_Timer) {
+            _Loop->Cancel(_Timer);
+        }
+    }
+
+    size_t JitterBuffer::MemoryBytes() const {
+        size_t bytes = _Slots.capacity() * sizeof(Slot);
+        for (auto &slot : _Slots) {
+            bytes += slot.data.capacity();
+        }
+        return bytes;
+    }
+
+    void JitterBuffer::Reset() {
+        for (auto &slot : _Slots) {
+            slot.used = false;
+            slot.missing = false;
+        }
+        _Started = false;
+        if (_Timer) {
+            _Loop->Cancel(_Timer);
+            _Timer = 0;
+        }
+    }
+
+    void JitterBuffer::Flush() {
+        while (_Started && _Expected != (uint16_t)(_Highest + 1)) {
+            Slot &slot = GetSlot(_Expected);
+            if (slot.missing && slot.seq == _Expected) {
+                slot.missing = false;
+                _Lost++;
+            }
+            _Expected++;
+            Drain();
+        }
+        Reset();
+    }
+
+    void JitterBuffer::Insert(const char *buf, ssize_t bufsize) {
+        if (bufsize < 12) {
+            return;
+        }
+
+        const unsigned char *packet = (const unsigned char *)buf;
+        uint16_t seq = packet[2] << 8 | packet[3];
+        _Received++;
+
+        if (!_Started) {
+            _Started = true;
+            _Expected = seq;
+            _Highest = seq - 1;
+        }
+
+        int16_t ahead = (int16_t)(seq - _Expected);
+        if (ahead >= (int)_Slots.size() || ahead < -(int)_Slots.size()) {
+            // sender restarted, seeked or a very long outage, either way
+            // the sequence moved further than the window, start over here
+            Flush();
+            _Started = true;
+            _Expected = seq;
+            _Highest = seq - 1;
+        } else if (ahead < 0) {
+            // already delivered or given up on
+            return;
+        }
+
+        Slot &slot = GetSlot(seq);
+        if (slot.used && slot.seq == seq) {
+            return;
+        }
+        if (slot.missing && slot.seq == seq) {
+            _Recovered++;
+        }
+
+        if ((int16_t)(seq - _Highest) > 0) {
+            // everything between the old head and this one is a new hole
+            Clock::time_point now = Clock::now();
+            std::vector<uint16_t> holes;
+            for (uint16_t s = _Highest + 1; s != seq; s++) {
+                Slot &hole = GetSlot(s);
+                hole.used = false;
+                hole.missing = true;
+                hole.seq = s;
+                hole.since = now;
+                hole.lastNack = now;
+                holes.push_back(s);
+            }
+            _Highest = seq;
+            if (!holes.empty() && _Nack) {
+                _Nacked += holes.size();
+                _Nack(holes);
+            }
+        }
+
+        slot.used = true;
+        slot.missing = false;
+        slot.seq = seq;
+        slot.data.assign(packet, packet + bufsize);
+
+        Drain();
+        Schedule();
+    }
+
+    void JitterBuffer::Drain() {
+        while (true) {
+            Slot &slot = GetSlot(_Expected);
+            if (!slot.used || slot.seq != _Expected) {
+                break;
+            }
+
+            slot.used = false;
+            _Expected++;
+            _Output((const char *)slot.data.data(), (ssize_t)slot.data.size());
+        }
+    }
+
+    void JitterBuffer::Tick() {
+        Clock::time_point now = Clock::now();
+
+        // out of budget, let the depacketizer see the hole
+        while (_Expected != (uint16_t)(_Highest + 1)) {
+            Slot &slot = GetSlot(_Expected);
+            if (!slot.missing || slot.seq != _Expected || now - slot.since < _Budget) {
+                break;
+            }
+            slot.missing = false;
+            _Lost++;
+            _Expected++;
+            Drain();
+        }
+
+        std::vector<uint16_t> holes;
+        for (uint16_t s = _Expected; s != (uint16_t)(_Highest + 1); s++) {
+            Slot &slot = GetSlot(s);
+            if (slot.missing && slot.seq == s && now - slot.lastNack >= std::chrono::milliseconds(JITTER_NACK_RETRY_MS) &&
+                now - slot.since + std::chrono::milliseconds(JITTER_NACK_RETRY_MS) < _Budget) {
+                slot.lastNack = now;
+                holes.push_back(s);
+            }
+        }
+        if (!holes.empty() && _Nack) {
+            _Nacked += holes.size();
+            _Nack(holes);
+        }
+    }
+
+    void JitterBuffer::Schedule() {
+        if (_Timer || _Budget < Clock::duration::zero() || _Expected == (uint16_t)(_Highest + 1)) {
+            return;
+        }
+
+        _Timer = _Loop->RunAfter(JITTER_TICK_MS, [this] {
+            _Timer = 0;
+            Tick();
+            Schedule();
+        });
+    }
+}
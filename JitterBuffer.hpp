@@ -0,0 +1,81 @@
+//
+//  JitterBuffer.hpp
+//  Simple-Rtsp-Client
+//
+
+#ifndef JitterBuffer_hpp
+#define JitterBuffer_hpp
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <vector>
+#include <stdint.h>
+#include <sys/types.h>
+#include "EventLoop.hpp"
+
+namespace RK {
+
+    // puts rtp packets back in sequence order. in order packets pass straight
+    // through; behind a gap packets are held while the missing ones are
+    // nacked, and a hole still open after the budget is skipped so the
+    // depacketizer sees the gap. loop thread only, except GetStats.
+    class JitterBuffer {
+    public:
+        typedef std::function<void(const char *buf, ssize_t bufsize)> Output;
+        typedef std::function<void(const std::vector<uint16_t> &seqs)> Nack;
+
+        // a negative budget never times holes out, they stay open until the
+        // window overflows or Flush, for replays where wall time means nothing.
+        // slots is the reorder window in packets, 0 for the default
+        JitterBuffer(EventLoop *loop, int budgetMs, size_t slots, Output output, Nack nack);
+        ~JitterBuffer();
+
+        void Insert(const char *buf, ssize_t bufsize);
+        // outputs everything held, open holes count as lost
+        void Flush();
+        void Reset();
+
+        uint64_t Received() const { return _Received; }
+        uint64_t Recovered() const { return _Recovered; }
+        uint64_t Lost() const { return _Lost; }
+        uint64_t Nacked() const { return _Nacked; }
+        // slot buffers, at most slots * the largest packet once warmed up
+        size_t MemoryBytes() const;
+    protected:
+        typedef std::chrono::steady_clock Clock;
+
+        struct Slot {
+            bool used = false;
+            bool missing = false;
+            bool nacked = false;
+            uint16_t seq = 0;
+            Clock::time_point since;     // missing since
+            Clock::time_point lastNack;
+            std::vector<unsigned char> data;
+        };
+
+        void Drain();
+        void Tick();
+        void Schedule();
+        Slot &GetSlot(uint16_t seq) { return _Slots[seq % _Slots.size()]; }
+    private:
+        EventLoop *_Loop;
+        Clock::duration _Budget;
+        Output _Output;
+        Nack _Nack;
+
+        std::vector<Slot> _Slots;
+        bool _Started = false;
+        uint16_t _Expected = 0;     // next sequence to output
+        uint16_t _Highest = 0;      // highest sequence seen
+        uint64_t _Timer = 0;
+
+        std::atomic<uint64_t> _Received;
+        std::atomic<uint64_t> _Recovered;
+        std::atomic<uint64_t> _Lost;
+        std::atomic<uint64_t> _Nacked;
+    };
+
+} //namespace RK
+#endif /* JitterBuffer_hpp */
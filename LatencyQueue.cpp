@@ -0,0 +1,165 @@
+//
+//  LatencyQueue.cpp
+//  Simple-Rtsp-Client
+//
+
+#include "LatencyQueue.hpp"
+#include "CpuAffinity.hpp"
+#include "Log.hpp"
+
+#define MODULE_TAG "LatencyQueue"
+
+// hard caps on top of the time budget, bound memory if the clock stalls
+#define LATENCY_QUEUE_MAX_FRAMES (256)
+#define LATENCY_QUEUE_MAX_BYTES (8 * 1024 * 1024)
+#define LATENCY_QUEUE_STACK_SIZE (256 * 1024)
+
+namespace RK {
+
+    LatencyQueue::LatencyQueue(int maxLatencyMs, Consumer consumer, int cpu, size_t maxBytes, size_t stackSize) {
+        _Budget = std::chrono::milliseconds(maxLatencyMs);
+        _MaxBytes = maxBytes ? maxBytes : LATENCY_QUEUE_MAX_BYTES;
+        _Consumer = consumer;
+        _Delivered = 0;
+        _DroppedNonRef = 0;
+        _DroppedResync = 0;
+        _Started = StartThread(&_Thread, stackSize ? stackSize : LATENCY_QUEUE_STACK_SIZE, [this, cpu] {
+            Run(cpu);
+        });
+    }
+
+    LatencyQueue::~LatencyQueue() {
+        {
+            std::lock_guard<std::mutex> lock(_Lock);
+            _Terminated = true;
+        }
+        _Cond.notify_one();
+        if (_Started) {
+            ::pthread_join(_Thread, NULL);
+        }
+    }
+
+    void LatencyQueue::Push(const MediaFrame &frame, bool reference, bool damaged, Clock::time_point arrival) {
+        std::unique_lock<std::mutex> lock(_Lock);
+        if (frame.keyframe && !damaged) {
+            _WaitKey = false;
+        }
+        if (damaged && (reference || frame.keyframe)) {
+            // a broken reference frame smears everything that predicts from
+            // it, up to the next clean idr. what is queued before it is fine
+            _WaitKey = true;
+        }
+
+        if (damaged || _WaitKey) {
+            if (_WaitKey) {
+                _DroppedResync++;
+            } else {
+                _DroppedNonRef++;
+            }
+            return;
+        }
+
+        Entry entry;
+        entry.data.assign(frame.data, frame.data + frame.size);
+        entry.frame = frame;
+        entry.reference = reference;
+        entry.arrival = arrival;
+        _Bytes += entry.data.size();
+        _Queue.push_back(std::move(entry));
+
+        Trim(Clock::now());
+        lock.unlock();
+        _Cond.notify_one();
+    }
+
+    LatencyStats LatencyQueue::GetStats() const {
+        LatencyStats stats;
+        stats.delivered = _Delivered;
+        stats.droppedNonRef = _DroppedNonRef;
+        stats.droppedResync = _DroppedResync;
+        return stats;
+    }
+
+    size_t LatencyQueue::MemoryBytes() {
+        std::lock_guard<std::mutex> lock(_Lock);
+        return _Bytes + _Queue.size() * sizeof(Entry);
+    }
+
+    void LatencyQueue::Resync() {
+        // keep the newest queued idr and what follows it, if there is one
+        size_t keep = _Queue.size();
+        for (size_t i = _Queue.size(); i > 0; i--) {
+            if (_Queue[i - 1].frame.keyframe) {
+                keep = i - 1;
+                break;
+            }
+        }
+
+        _DroppedResync += keep;
+        for (size_t i = 0; i < keep; i++) {
+            _Bytes -= _Queue[i].data.size();
+        }
+        _Queue.erase(_Queue.begin(), _Queue.begin() + keep);
+        if (_Queue.empty()) {
+            _WaitKey = true;
+        }
+    }
+
+    bool LatencyQueue::Behind(Clock::time_point now) const {
+        return !_Queue.empty() && (now - _Queue.front().arrival > _Budget || _Queue.size() > LATENCY_QUEUE_MAX_FRAMES || _Bytes > _MaxBytes);
+    }
+
+    void LatencyQueue::Trim(Clock::time_point now) {
+        if (!Behind(now)) {
+            return;
+        }
+
+        // nothing references these, dropping them costs no picture damage
+        size_t before = _Queue.size();
+        for (auto it = _Queue.begin(); it != _Queue.end(); ) {
+            if (!it->reference && !it->frame.keyframe) {
+                _Bytes -= it->data.size();
+                it = _Queue.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        _DroppedNonRef += before - _Queue.size();
+
+        if (Behind(now)) {
+            log(MODULE_TAG, "consumer %lld ms behind, skipping to next idr",
+                (long long)std::chrono::duration_cast<std::chrono::milliseconds>(now - _Queue.front().arrival).count());
+            Resync();
+        }
+    }
+
+    void LatencyQueue::Run(int cpu) {
+        // next to the loop thread that fills the queue, not on its core
+        if (cpu >= 0 && PinCurrentThread(CpusOfNode(NodeOfCpu(cpu)))) {
+            PreferNode(NodeOfCpu(cpu));
+        }
+
+        while (true) {
+            std::unique_lock<std::mutex> lock(_Lock);
+            _Cond.wait(lock, [this] { return _Terminated || !_Queue.empty(); });
+            if (_Terminated) {
+                break;
+            }
+
+            // the consumer may have been busy long enough to age the queue
+            Trim(Clock::now());
+            if (_Queue.empty()) {
+                continue;
+            }
+
+            Entry entry = std::move(_Queue.front());
+            _Queue.pop_front();
+            _Bytes -= entry.data.size();
+            lock.unlock();
+
+            entry.frame.data = entry.data.data();
+            _Consumer(entry.frame);
+            _Delivered++;
+        }
+    }
+}
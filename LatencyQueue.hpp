@@ -0,0 +1,77 @@
+//
+//  LatencyQueue.hpp
+//  Simple-Rtsp-Client
+//
+
+#ifndef LatencyQueue_hpp
+#define LatencyQueue_hpp
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <pthread.h>
+#include <vector>
+#include "RtspPlayer.hpp"
+
+namespace RK {
+
+    // hands video frames to a slow consumer on its own thread so the event
+    // loop keeps draining the sockets. when the oldest queued frame gets
+    // older than the budget, non-reference frames go first; if that is not
+    // enough, or a reference frame arrived damaged, everything up to the
+    // next idr is skipped.
+    class LatencyQueue {
+    public:
+        typedef std::shared_ptr<LatencyQueue> Ptr;
+        typedef std::chrono::steady_clock Clock;
+        typedef std::function<void(const MediaFrame &frame)> Consumer;
+
+        // with cpu >= 0 the consumer thread stays on that cpu's numa node.
+        // maxBytes caps the queued frame copies like the latency budget does,
+        // both it and stackSize fall back to defaults when 0
+        LatencyQueue(int maxLatencyMs, Consumer consumer, int cpu = -1, size_t maxBytes = 0, size_t stackSize = 0);
+        ~LatencyQueue();
+
+        // copies the frame, arrival is when its first packet came in
+        void Push(const MediaFrame &frame, bool reference, bool damaged, Clock::time_point arrival);
+        LatencyStats GetStats() const;
+        // bytes held by queued frames
+        size_t MemoryBytes();
+    protected:
+        struct Entry {
+            MediaFrame frame;
+            std::vector<unsigned char> data;
+            bool reference;
+            Clock::time_point arrival;
+        };
+
+        void Run(int cpu);
+        bool Behind(Clock::time_point now) const;
+        void Trim(Clock::time_point now);
+        void Resync();
+    private:
+        Clock::duration _Budget;
+        size_t _MaxBytes;
+        Consumer _Consumer;
+
+        std::mutex _Lock;
+        std::condition_variable _Cond;
+        std::deque<Entry> _Queue;
+        size_t _Bytes = 0;
+        bool _WaitKey = false;
+        bool _Terminated = false;
+        bool _Started = false;
+        pthread_t _Thread;
+
+        std::atomic<uint64_t> _Delivered;
+        std::atomic<uint64_t> _DroppedNonRef;
+        std::atomic<uint64_t> _DroppedResync;
+    };
+
+} //namespace RK
+#endif /* LatencyQueue_hpp */
@@ -0,0 +1,19 @@
+//
+//  Log.hpp
+//  Simple-Rtsp-Client
+//
+
+#ifndef Log_hpp
+#define Log_hpp
+
+#include <stdio.h>
+
+// include this header last, the macro shadows log() from <math.h>
+#define log(tag,fmt,...)\
+do {\
+    printf("%s:", tag);\
+    printf(fmt, ##__VA_ARGS__);\
+    printf("\n");\
+} while(0)
+
+#endif /* Log_hpp */
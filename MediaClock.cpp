@@ -0,0 +1,67 @@
+//
+//  MediaClock.cpp
+//  Simple-Rtsp-Client
+//
+
+#include "MediaClock.hpp"
+
+// seconds from 1900 (ntp) to 1970 (unix)
+#define NTP_UNIX_OFFSET (2208988800ULL)
+
+namespace RK {
+
+    void MediaClock::SetClockRate(int rate) {
+        if (rate > 0) {
+            _ClockRate = rate;
+        }
+    }
+
+    void MediaClock::Reset() {
+        _Started = false;
+        _HasFirst = false;
+        _Synced = false;
+    }
+
+    int64_t MediaClock::ToMicroseconds(int64_t ticks) const {
+        // split to keep ticks * 1000000 from overflowing on long sessions
+        return ticks / _ClockRate * 1000000 + ticks % _ClockRate * 1000000 / _ClockRate;
+    }
+
+    int64_t MediaClock::Extend(uint32_t timestamp) {
+        if (!_Started) {
+            _Started = true;
+            // start in the middle of the range so stepping back never goes negative
+            _Last = ((int64_t)1 << 32) + timestamp;
+            return _Last;
+        }
+
+        _Last += (int32_t)(timestamp - (uint32_t)_Last);
+        return _Last;
+    }
+
+    int64_t MediaClock::Pts(int64_t extended) {
+        if (!_HasFirst) {
+            _HasFirst = true;
+            _First = extended;
+        }
+        return ToMicroseconds(extended - _First);
+    }
+
+    int64_t MediaClock::WallClock(int64_t extended) const {
+        if (!_Synced) {
+            return 0;
+        }
+        return _SrWallClock + ToMicroseconds(extended - _SrTimestamp);
+    }
+
+    void MediaClock::OnSenderReport(uint64_t ntp, uint32_t timestamp) {
+        uint64_t seconds = ntp >> 32;
+        if (seconds < NTP_UNIX_OFFSET) {
+            return;
+        }
+
+        _SrTimestamp = Extend(timestamp);
+        _SrWallClock = (int64_t)(seconds - NTP_UNIX_OFFSET) * 1000000 + (int64_t)(((ntp & 0xffffffff) * 1000000) >> 32);
+        _Synced = true;
+    }
+}
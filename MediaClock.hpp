@@ -0,0 +1,50 @@
+//
+//  MediaClock.hpp
+//  Simple-Rtsp-Client
+//
+
+#ifndef MediaClock_hpp
+#define MediaClock_hpp
+
+#include <stdint.h>
+
+namespace RK {
+
+    // rtp clock of one track: extends the 32 bit timestamps across wraps,
+    // turns them into microseconds and, once a rtcp sender report arrived,
+    // into the sender's wall clock. not thread safe, owned by the thread
+    // that receives the track.
+    class MediaClock {
+    public:
+        void SetClockRate(int rate);
+        int ClockRate() const { return _ClockRate; }
+        void Reset();
+
+        // extended timestamp of an rtp packet, a step back (b-frames, reordering)
+        // is treated as such and not as a wrap
+        int64_t Extend(uint32_t timestamp);
+        // microseconds since the first frame of the track
+        int64_t Pts(int64_t extended);
+        // microseconds since the unix epoch, 0 until the first sender report
+        int64_t WallClock(int64_t extended) const;
+
+        // ntp is the 64 bit sender report timestamp
+        void OnSenderReport(uint64_t ntp, uint32_t timestamp);
+        bool Synced() const { return _Synced; }
+    private:
+        int64_t ToMicroseconds(int64_t ticks) const;
+
+        int _ClockRate = 90000;
+
+        bool _Started = false;
+        int64_t _Last = 0;
+        bool _HasFirst = false;
+        int64_t _First = 0;
+
+        bool _Synced = false;
+        int64_t _SrTimestamp = 0;
+        int64_t _SrWallClock = 0;
+    };
+
+} //namespace RK
+#endif /* MediaClock_hpp */
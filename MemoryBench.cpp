@@ -0,0 +1,112 @@
+//
+//  MemoryBench.cpp
+//  Simple-Rtsp-Client
+//
+
+// steady state memory per session: replays one capture into many sessions
+// at recorded speed and compares accounted and resident bytes per stream
+// with a limit.
+//
+//     MemoryBench capture.pcap [streams] [seconds] [limit bytes per stream]
+//
+// exits 1 when either figure is over the limit.
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "EventLoopGroup.hpp"
+#include "RtspPlayer.hpp"
+
+// 1000 streams in 4 GB
+#define BENCH_DEFAULT_LIMIT (4 * 1024 * 1024)
+#define BENCH_LATENCY_MS (200)
+
+using namespace RK;
+
+static size_t ResidentBytes() {
+    long pages = 0, resident = 0;
+    FILE *fp = ::fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (::fscanf(fp, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        ::fclose(fp);
+    }
+    return (size_t)resident * ::sysconf(_SC_PAGESIZE);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("usage: %s <capture> [streams] [seconds] [limit bytes per stream]\n", argv[0]);
+        return -1;
+    }
+    int streams = argc > 2 ? ::atoi(argv[2]) : 100;
+    int seconds = argc > 3 ? ::atoi(argv[3]) : 5;
+    size_t limit = argc > 4 ? ::strtoul(argv[4], NULL, 10) : BENCH_DEFAULT_LIMIT;
+    if (streams <= 0 || seconds <= 0) {
+        printf("streams and seconds must be positive\n");
+        return -1;
+    }
+
+    EventLoopGroup::Ptr group = EventLoopGroup::Create();
+    if (!group) {
+        return -1;
+    }
+    size_t before = ResidentBytes();
+
+    std::atomic<uint64_t> frames(0);
+    std::atomic<int> finished(0);
+    std::vector<RtspPlayer::Ptr> players;
+    for (int i = 0; i < streams; i++) {
+        RtspPlayer::Ptr player = std::make_shared<RtspPlayer>(group->Next());
+        player->SetVideoFrameCallback([&frames](const MediaFrame &) {
+            frames++;
+        });
+        player->SetLowLatency(BENCH_LATENCY_MS);
+        if (!player->PlayCapture(argv[1], 1.0, [&finished] { finished++; })) {
+            printf("failed to replay %s\n", argv[1]);
+            return -1;
+        }
+        players.push_back(player);
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    size_t after = ResidentBytes();
+    if (finished) {
+        printf("warning: %d replays ended early, use a longer capture\n", finished.load());
+    }
+
+    MemoryStats sum = MemoryStats();
+    size_t peak = 0;
+    for (auto &player : players) {
+        MemoryStats stats = player->GetMemoryStats();
+        sum.frameBuffer += stats.frameBuffer;
+        sum.jitter += stats.jitter;
+        sum.queue += stats.queue;
+        sum.rtsp += stats.rtsp;
+        sum.total += stats.total;
+        peak = std::max(peak, stats.total);
+    }
+
+    size_t resident = after > before ? (after - before) / streams : 0;
+    printf("%d streams, %d s, %llu frames\n", streams, seconds, (unsigned long long)frames.load());
+    printf("accounted per stream: frame %zu jitter %zu queue %zu rtsp %zu total %zu (max %zu)\n",
+        sum.frameBuffer / streams, sum.jitter / streams, sum.queue / streams, sum.rtsp / streams, sum.total / streams, peak);
+    printf("resident per stream: %zu, limit %zu\n", resident, limit);
+
+    for (auto &player : players) {
+        player->Stop();
+    }
+    players.clear();
+
+    if (peak > limit || resident > limit) {
+        printf("FAIL: over the per stream limit\n");
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,216 @@
+//
+//  MulticastGroup.cpp
+//  Simple-Rtsp-Client
+//
+
+#include "MulticastGroup.hpp"
+#include <map>
+#include <tuple>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "Log.hpp"
+
+#define MODULE_TAG "MulticastGroup"
+
+#define MULTICAST_RCVBUF_SIZE (2 * 1024 * 1024)
+
+namespace RK {
+
+    typedef std::tuple<std::string, unsigned short, std::string> GroupKey;
+
+    static std::mutex s_GroupsLock;
+    static std::map<GroupKey, std::weak_ptr<MulticastGroup>> s_Groups;
+
+    MulticastGroup::Ptr MulticastGroup::Join(const std::string &group, unsigned short port, const std::string &source) {
+        std::lock_guard<std::mutex> lock(s_GroupsLock);
+        GroupKey key(group, port, source);
+
+        for (auto it = s_Groups.begin(); it != s_Groups.end(); ) {
+            if (it->second.expired()) {
+                it = s_Groups.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        auto it = s_Groups.find(key);
+        if (it != s_Groups.end()) {
+            return it->second.lock();
+        }
+
+        Ptr joined(new MulticastGroup(group, port, source));
+        if (!joined->Init()) {
+            return nullptr;
+        }
+
+        s_Groups[key] = joined;
+        return joined;
+    }
+
+    MulticastGroup::MulticastGroup(const std::string &group, unsigned short port, const std::string &source)
+        : _Group(group), _Source(source), _Port(port) {
+    }
+
+    MulticastGroup::~MulticastGroup() {
+        // closing the sockets drops the memberships
+        if (_RtpSocket >= 0) {
+            ::close(_RtpSocket);
+        }
+        if (_RtcpSocket >= 0) {
+            ::close(_RtcpSocket);
+        }
+    }
+
+    int MulticastGroup::OpenSocket(unsigned short port) {
+        int sock = ::socket(AF_INET, SOCK_DGRAM, 0);
+        if (sock < 0) {
+            log(MODULE_TAG, "multicast socket init failed");
+            return -1;
+        }
+
+        int ul = true;
+        if (::ioctl(sock, FIONBIO, &ul) < 0) {
+            log(MODULE_TAG, "failed to set multicast socket non block");
+            ::close(sock);
+            return -1;
+        }
+
+        // other processes on this host may watch the same group
+        int reuse = 1;
+        ::setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        int rcvbuf = MULTICAST_RCVBUF_SIZE;
+        ::setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+        struct sockaddr_in addr;
+        ::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = inet_addr(_Group.c_str());
+        addr.sin_port = htons(port);
+        if (::bind(sock, (const struct sockaddr *)&addr, (socklen_t)sizeof(addr)) < 0) {
+            log(MODULE_TAG, "failed to bind %s:%d error %d %s", _Group.c_str(), port, errno, strerror(errno));
+            ::close(sock);
+            return -1;
+        }
+
+        int r = 0;
+        if (!_Source.empty()) {
+            struct ip_mreq_source mreq;
+            ::memset(&mreq, 0, sizeof(mreq));
+            mreq.imr_multiaddr.s_addr = inet_addr(_Group.c_str());
+            mreq.imr_sourceaddr.s_addr = inet_addr(_Source.c_str());
+            mreq.imr_interface.s_addr = INADDR_ANY;
+            r = ::setsockopt(sock, IPPROTO_IP, IP_ADD_SOURCE_MEMBERSHIP, &mreq, sizeof(mreq));
+        } else {
+            struct ip_mreq mreq;
+            ::memset(&mreq, 0, sizeof(mreq));
+            mreq.imr_multiaddr.s_addr = inet_addr(_Group.c_str());
+            mreq.imr_interface.s_addr = INADDR_ANY;
+            r = ::setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+        }
+
+        if (r < 0) {
+            log(MODULE_TAG, "failed to join %s source %s error %d %s", _Group.c_str(), _Source.c_str(), errno, strerror(errno));
+            ::close(sock);
+            return -1;
+        }
+
+        return sock;
+    }
+
+    bool MulticastGroup::Init() {
+        if (!IN_MULTICAST(ntohl(inet_addr(_Group.c_str())))) {
+            log(MODULE_TAG, "%s is not a multicast address", _Group.c_str());
+            return false;
+        }
+
+        _RtpSocket = OpenSocket(_Port);
+        _RtcpSocket = OpenSocket(_Port + 1);
+        if (_RtpSocket < 0 || _RtcpSocket < 0) {
+            return false;
+        }
+
+        log(MODULE_TAG, "joined %s:%d source %s", _Group.c_str(), _Port, _Source.empty() ? "any" : _Source.c_str());
+        return true;
+    }
+
+    void MulticastGroup::Subscribe(const void *owner, EventLoop *loop, Receiver rtp, Receiver rtcp) {
+        std::lock_guard<std::mutex> lock(_Lock);
+        std::shared_ptr<Subscriber> subscriber = std::make_shared<Subscriber>();
+        subscriber->owner = owner;
+        subscriber->loop = loop;
+        subscriber->rtp = rtp;
+        subscriber->rtcp = rtcp;
+        subscriber->active = true;
+        _Subscribers.push_back(subscriber);
+
+        // one watch per loop, an fd can only be added to an epoll set once
+        if (_Loops[loop]++ == 0) {
+            loop->AddFd(_RtpSocket, EventRead, [this](int) {
+                Read(_RtpSocket, false);
+            });
+            loop->AddFd(_RtcpSocket, EventRead, [this](int) {
+                Read(_RtcpSocket, true);
+            });
+        }
+    }
+
+    void MulticastGroup::Unsubscribe(const void *owner) {
+        // packets posted before this are still queued on the loop, the
+        // flag turns them away; no callback runs after this returns
+        std::lock_guard<std::mutex> lock(_Lock);
+        for (auto it = _Subscribers.begin(); it != _Subscribers.end(); ) {
+            if ((*it)->owner != owner) {
+                ++it;
+                continue;
+            }
+
+            EventLoop *loop = (*it)->loop;
+            if (--_Loops[loop] == 0) {
+                loop->RemoveFd(_RtpSocket);
+                loop->RemoveFd(_RtcpSocket);
+                _Loops.erase(loop);
+            }
+            (*it)->active = false;
+            it = _Subscribers.erase(it);
+        }
+    }
+
+    void MulticastGroup::Read(int sock, bool rtcp) {
+        char recvbuf[2048];
+
+        // every loop with subscribers watches the same socket, the read
+        // lock serializes the readers so each subscriber sees the packets
+        // in order. receivers run on their own loop and may unsubscribe,
+        // nothing calls out while _Lock is held
+        std::lock_guard<std::mutex> reading(_ReadLock);
+        std::vector<std::shared_ptr<Subscriber>> subscribers;
+        {
+            std::lock_guard<std::mutex> lock(_Lock);
+            subscribers = _Subscribers;
+        }
+
+        while (true) {
+            ssize_t recvbytes = ::recv(sock, recvbuf, sizeof(recvbuf), 0);
+            if (recvbytes <= 0) {
+                break;
+            }
+
+            std::shared_ptr<std::string> packet = std::make_shared<std::string>(recvbuf, recvbytes);
+            for (auto &subscriber : subscribers) {
+                if (!(rtcp ? subscriber->rtcp : subscriber->rtp)) {
+                    continue;
+                }
+                subscriber->loop->Post([subscriber, packet, rtcp] {
+                    if (subscriber->active) {
+                        (rtcp ? subscriber->rtcp : subscriber->rtp)(packet->data(), packet->size());
+                    }
+                });
+            }
+        }
+    }
+}
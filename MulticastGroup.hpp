@@ -0,0 +1,70 @@
+//
+//  MulticastGroup.hpp
+//  Simple-Rtsp-Client
+//
+
+#ifndef MulticastGroup_hpp
+#define MulticastGroup_hpp
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "EventLoop.hpp"
+
+namespace RK {
+
+    // rtp/rtcp socket pair joined to one multicast group. sessions in this
+    // process watching the same group share one instance (and one kernel
+    // membership); every received packet is handed to all subscribers.
+    // the sockets are watched once per event loop that has subscribers,
+    // whichever loop reads posts a copy to each subscriber's own loop.
+    class MulticastGroup {
+    public:
+        typedef std::shared_ptr<MulticastGroup> Ptr;
+        typedef std::function<void(const char *buf, ssize_t bufsize)> Receiver;
+
+        // source may be empty for any-source multicast
+        static Ptr Join(const std::string &group, unsigned short port, const std::string &source);
+        ~MulticastGroup();
+
+        // both must be called on the loop thread, packets already posted
+        // to an owner that unsubscribed are dropped on its loop
+        void Subscribe(const void *owner, EventLoop *loop, Receiver rtp, Receiver rtcp);
+        void Unsubscribe(const void *owner);
+
+        int RtpSocket() const { return _RtpSocket; }
+        int RtcpSocket() const { return _RtcpSocket; }
+    protected:
+        MulticastGroup(const std::string &group, unsigned short port, const std::string &source);
+        bool Init();
+        int OpenSocket(unsigned short port);
+        // drain the socket and post to the subscribers, safe to call from any subscriber thread
+        void Read(int sock, bool rtcp);
+    private:
+        struct Subscriber {
+            const void *owner;
+            EventLoop *loop;
+            Receiver rtp;
+            Receiver rtcp;
+            std::atomic<bool> active;   // cleared by Unsubscribe, read on loop
+        };
+
+        std::string _Group;
+        std::string _Source;
+        unsigned short _Port;
+        int _RtpSocket = -1;
+        int _RtcpSocket = -1;
+
+        std::mutex _Lock;
+        std::mutex _ReadLock;       // one reader at a time keeps the posts in order
+        std::vector<std::shared_ptr<Subscriber>> _Subscribers;
+        std::map<EventLoop *, int> _Loops;
+    };
+
+} //namespace RK
+#endif /* MulticastGroup_hpp */
@@ -0,0 +1,540 @@
+//
+//  NalParser.cpp
+//  Simple-Rtsp-Client
+//
+
+#include "NalParser.hpp"
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NAL_PARSER_X86 (1)
+#endif
+
+#define H264_NAL_SPS (7)
+#define H265_NAL_SPS (33)
+
+namespace RK {
+
+    // scanners look for 00 00 X with lo <= X <= hi, which covers start codes
+    // (X == 1) and emulation prevention bytes (X == 3)
+    typedef const unsigned char *(*TripletScanner)(const unsigned char *p, const unsigned char *end, unsigned char lo, unsigned char hi);
+
+    static const unsigned char *FindTripletScalar(const unsigned char *p, const unsigned char *end, unsigned char lo, unsigned char hi) {
+        while (p + 2 < end) {
+            // p[2] > hi rules out a match starting at p, p + 1 and p + 2
+            if (p[2] > hi) {
+                p += 3;
+            } else if (p[0] == 0 && p[1] == 0 && p[2] >= lo) {
+                return p;
+            } else {
+                p++;
+            }
+        }
+        return end;
+    }
+
+#ifdef NAL_PARSER_X86
+    __attribute__((target("sse2")))
+    static const unsigned char *FindTripletSSE2(const unsigned char *p, const unsigned char *end, unsigned char lo, unsigned char hi) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i vlo = _mm_set1_epi8((char)lo);
+        const __m128i vhi = _mm_set1_epi8((char)hi);
+
+        while (p + 18 <= end) {
+            __m128i a = _mm_loadu_si128((const __m128i *)p);
+            __m128i b = _mm_loadu_si128((const __m128i *)(p + 1));
+            __m128i c = _mm_loadu_si128((const __m128i *)(p + 2));
+
+            __m128i zeros = _mm_cmpeq_epi8(_mm_or_si128(a, b), zero);
+            __m128i inrange = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(c, vlo), c), _mm_cmpeq_epi8(_mm_min_epu8(c, vhi), c));
+            int mask = _mm_movemask_epi8(_mm_and_si128(zeros, inrange));
+            if (mask) {
+                return p + __builtin_ctz(mask);
+            }
+            p += 16;
+        }
+        return FindTripletScalar(p, end, lo, hi);
+    }
+
+    __attribute__((target("avx2")))
+    static const unsigned char *FindTripletAVX2(const unsigned char *p, const unsigned char *end, unsigned char lo, unsigned char hi) {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i vlo = _mm256_set1_epi8((char)lo);
+        const __m256i vhi = _mm256_set1_epi8((char)hi);
+
+        while (p + 34 <= end) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)p);
+            __m256i b = _mm256_loadu_si256((const __m256i *)(p + 1));
+            __m256i c = _mm256_loadu_si256((const __m256i *)(p + 2));
+
+            __m256i zeros = _mm256_cmpeq_epi8(_mm256_or_si256(a, b), zero);
+            __m256i inrange = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(c, vlo), c), _mm256_cmpeq_epi8(_mm256_min_epu8(c, vhi), c));
+            unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_and_si256(zeros, inrange));
+            if (mask) {
+                return p + __builtin_ctz(mask);
+            }
+            p += 32;
+        }
+        return FindTripletSSE2(p, end, lo, hi);
+    }
+#endif
+
+    static TripletScanner SelectScanner() {
+#ifdef NAL_PARSER_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return FindTripletAVX2;
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return FindTripletSSE2;
+        }
+#endif
+        return FindTripletScalar;
+    }
+
+    static const unsigned char *FindTriplet(const unsigned char *p, const unsigned char *end, unsigned char lo, unsigned char hi) {
+        static const TripletScanner scanner = SelectScanner();
+        return scanner(p, end, lo, hi);
+    }
+
+    const unsigned char *FindStartCode(const unsigned char *p, const unsigned char *end) {
+        return FindTriplet(p, end, 1, 1);
+    }
+
+    static const unsigned char *FindStartCodeScalar(const unsigned char *p, const unsigned char *end) {
+        return FindTripletScalar(p, end, 1, 1);
+    }
+
+#ifdef NAL_PARSER_X86
+    static const unsigned char *FindStartCodeSSE2(const unsigned char *p, const unsigned char *end) {
+        return FindTripletSSE2(p, end, 1, 1);
+    }
+
+    static const unsigned char *FindStartCodeAVX2(const unsigned char *p, const unsigned char *end) {
+        return FindTripletAVX2(p, end, 1, 1);
+    }
+#endif
+
+    std::vector<StartCodeScanner> StartCodeScanners() {
+        std::vector<StartCodeScanner> scanners(1, FindStartCodeScalar);
+#ifdef NAL_PARSER_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse2")) {
+            scanners.push_back(FindStartCodeSSE2);
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            scanners.push_back(FindStartCodeAVX2);
+        }
+#endif
+        return scanners;
+    }
+
+    void ForEachNalu(const unsigned char *data, size_t size, const std::function<void(const unsigned char *nalu, size_t size)> &callback) {
+        const unsigned char *end = data + size;
+        const unsigned char *p = FindStartCode(data, end);
+
+        while (p < end) {
+            p += 3;
+            const unsigned char *next = FindStartCode(p, end);
+
+            // the leading zero of a 4 byte start code belongs to the next one
+            const unsigned char *last = next;
+            while (next < end && last > p && last[-1] == 0) {
+                last--;
+            }
+            if (last > p) {
+                callback(p, last - p);
+            }
+            p = next;
+        }
+    }
+
+    size_t RemoveEmulationPrevention(const unsigned char *src, size_t size, unsigned char *dst) {
+        const unsigned char *p = src;
+        const unsigned char *end = src + size;
+        size_t out = 0;
+
+        while (true) {
+            const unsigned char *epb = FindTriplet(p, end, 3, 3);
+            size_t n = (epb == end ? end : epb + 2) - p;
+            // memmove, dst may be src for in place removal
+            ::memmove(dst + out, p, n);
+            out += n;
+            if (epb == end) {
+                break;
+            }
+            p = epb + 3;
+        }
+
+        return out;
+    }
+
+    // exp-golomb reader over rbsp, reads past the end return 0 and flag an error
+    class BitReader {
+    public:
+        BitReader(const unsigned char *data, size_t size) : _Data(data), _Bits(size * 8) {}
+
+        uint32_t ReadBit() {
+            if (_Pos >= _Bits) {
+                _Error = true;
+                return 0;
+            }
+            uint32_t bit = (_Data[_Pos >> 3] >> (7 - (_Pos & 7))) & 1;
+            _Pos++;
+            return bit;
+        }
+
+        uint32_t ReadBits(int n) {
+            uint32_t v = 0;
+            while (n-- > 0) {
+                v = v << 1 | ReadBit();
+            }
+            return v;
+        }
+
+        void SkipBits(size_t n) {
+            _Pos += n;
+            if (_Pos > _Bits) {
+                _Error = true;
+            }
+        }
+
+        uint32_t ReadUE() {
+            int zeros = 0;
+            while (!ReadBit()) {
+                if (_Error || ++zeros > 31) {
+                    _Error = true;
+                    return 0;
+                }
+            }
+            return ((1u << zeros) - 1) + ReadBits(zeros);
+        }
+
+        int32_t ReadSE() {
+            uint32_t v = ReadUE();
+            return (v & 1) ? (int32_t)((v + 1) / 2) : -(int32_t)(v / 2);
+        }
+
+        bool Error() const { return _Error; }
+    private:
+        const unsigned char *_Data;
+        size_t _Bits;
+        size_t _Pos = 0;
+        bool _Error = false;
+    };
+
+    static void SkipScalingList(BitReader &br, int size) {
+        int last = 8;
+        int next = 8;
+        for (int j = 0; j < size; j++) {
+            if (next != 0) {
+                next = (last + br.ReadSE() + 256) % 256;
+            }
+            last = next == 0 ? last : next;
+        }
+    }
+
+    bool ParseH264Sps(const unsigned char *nalu, size_t size, VideoParams *params) {
+        if (size < 4 || (nalu[0] & 0x1f) != H264_NAL_SPS) {
+            return false;
+        }
+
+        std::vector<unsigned char> rbsp(size);
+        BitReader br(rbsp.data(), RemoveEmulationPrevention(nalu + 1, size - 1, rbsp.data()));
+        VideoParams sps;
+        ::memset(&sps, 0, sizeof(sps));
+        sps.codec = VideoCodecH264;
+        sps.chromaFormat = 1;
+        sps.bitDepth = 8;
+
+        sps.profile = br.ReadBits(8);
+        br.ReadBits(8); // constraint flags
+        sps.level = br.ReadBits(8);
+        br.ReadUE(); // seq_parameter_set_id
+
+        int profile = sps.profile;
+        if (profile == 100 || profile == 110 || profile == 122 || profile == 244 || profile == 44 ||
+            profile == 83 || profile == 86 || profile == 118 || profile == 128 || profile == 138 ||
+            profile == 139 || profile == 134 || profile == 135) {
+            sps.chromaFormat = br.ReadUE();
+            if (sps.chromaFormat == 3) {
+                br.ReadBits(1); // separate_colour_plane_flag
+            }
+            sps.bitDepth = br.ReadUE() + 8;
+            br.ReadUE(); // bit_depth_chroma_minus8
+            br.ReadBits(1); // qpprime_y_zero_transform_bypass_flag
+            if (br.ReadBits(1)) {
+                for (int i = 0; i < (sps.chromaFormat != 3 ? 8 : 12); i++) {
+                    if (br.ReadBits(1)) {
+                        SkipScalingList(br, i < 6 ? 16 : 64);
+                    }
+                }
+            }
+        }
+
+        br.ReadUE(); // log2_max_frame_num_minus4
+        uint32_t pocType = br.ReadUE();
+        if (pocType == 0) {
+            br.ReadUE(); // log2_max_pic_order_cnt_lsb_minus4
+        } else if (pocType == 1) {
+            br.ReadBits(1);
+            br.ReadSE();
+            br.ReadSE();
+            uint32_t cycle = br.ReadUE();
+            for (uint32_t i = 0; i < cycle && !br.Error(); i++) {
+                br.ReadSE();
+            }
+        }
+
+        br.ReadUE(); // max_num_ref_frames
+        br.ReadBits(1); // gaps_in_frame_num_value_allowed_flag
+        uint32_t widthMbs = br.ReadUE() + 1;
+        uint32_t heightMapUnits = br.ReadUE() + 1;
+        uint32_t frameMbsOnly = br.ReadBits(1);
+        if (!frameMbsOnly) {
+            br.ReadBits(1); // mb_adaptive_frame_field_flag
+        }
+        br.ReadBits(1); // direct_8x8_inference_flag
+
+        uint32_t cropLeft = 0, cropRight = 0, cropTop = 0, cropBottom = 0;
+        if (br.ReadBits(1)) {
+            cropLeft = br.ReadUE();
+            cropRight = br.ReadUE();
+            cropTop = br.ReadUE();
+            cropBottom = br.ReadUE();
+        }
+
+        int cropUnitX = sps.chromaFormat == 0 || sps.chromaFormat == 3 ? 1 : 2;
+        int cropUnitY = (sps.chromaFormat == 1 ? 2 : 1) * (2 - frameMbsOnly);
+        sps.width = (int)(widthMbs * 16 - cropUnitX * (cropLeft + cropRight));
+        sps.height = (int)((2 - frameMbsOnly) * heightMapUnits * 16 - cropUnitY * (cropTop + cropBottom));
+        if (br.Error() || sps.width <= 0 || sps.height <= 0) {
+            return false;
+        }
+
+        // a truncated vui only costs us the framerate
+        if (br.ReadBits(1)) { // vui_parameters_present_flag
+            if (br.ReadBits(1) && br.ReadBits(8) == 255) { // aspect_ratio_idc Extended_SAR
+                br.SkipBits(32);
+            }
+            if (br.ReadBits(1)) { // overscan_info_present_flag
+                br.ReadBits(1);
+            }
+            if (br.ReadBits(1)) { // video_signal_type_present_flag
+                br.ReadBits(4);
+                if (br.ReadBits(1)) {
+                    br.SkipBits(24);
+                }
+            }
+            if (br.ReadBits(1)) { // chroma_loc_info_present_flag
+                br.ReadUE();
+                br.ReadUE();
+            }
+            if (br.ReadBits(1)) { // timing_info_present_flag
+                uint32_t unitsInTick = br.ReadBits(32);
+                uint32_t timeScale = br.ReadBits(32);
+                if (unitsInTick && !br.Error()) {
+                    sps.framerate = (double)timeScale / (2.0 * unitsInTick);
+                }
+            }
+        }
+
+        *params = sps;
+        return true;
+    }
+
+    static void ParseProfileTierLevel(BitReader &br, int maxSubLayersMinus1, VideoParams *params) {
+        br.ReadBits(2); // general_profile_space
+        params->tier = br.ReadBits(1);
+        params->profile = br.ReadBits(5);
+        br.SkipBits(32); // general_profile_compatibility_flag
+        br.SkipBits(48); // source flags and reserved bits
+        params->level = br.ReadBits(8);
+
+        int profilePresent[8] = {0};
+        int levelPresent[8] = {0};
+        for (int i = 0; i < maxSubLayersMinus1; i++) {
+            profilePresent[i] = br.ReadBits(1);
+            levelPresent[i] = br.ReadBits(1);
+        }
+        if (maxSubLayersMinus1 > 0) {
+            for (int i = maxSubLayersMinus1; i < 8; i++) {
+                br.ReadBits(2);
+            }
+        }
+        for (int i = 0; i < maxSubLayersMinus1; i++) {
+            if (profilePresent[i]) {
+                br.SkipBits(88);
+            }
+            if (levelPresent[i]) {
+                br.SkipBits(8);
+            }
+        }
+    }
+
+    static void SkipH265ScalingListData(BitReader &br) {
+        for (int sizeId = 0; sizeId < 4; sizeId++) {
+            for (int matrixId = 0; matrixId < 6; matrixId += sizeId == 3 ? 3 : 1) {
+                if (!br.ReadBits(1)) { // scaling_list_pred_mode_flag
+                    br.ReadUE(); // scaling_list_pred_matrix_id_delta
+                    continue;
+                }
+                int coefs = sizeId == 0 ? 16 : 64;
+                if (sizeId > 1) {
+                    br.ReadSE(); // scaling_list_dc_coef_minus8
+                }
+                for (int i = 0; i < coefs; i++) {
+                    br.ReadSE();
+                }
+            }
+        }
+    }
+
+    // sps fields after the bit depths, everything up to the vui timing
+    static double ParseH265Framerate(BitReader &br, int maxSubLayersMinus1) {
+        int pocLsbBits = br.ReadUE() + 4;
+        for (int i = br.ReadBits(1) ? 0 : maxSubLayersMinus1; i <= maxSubLayersMinus1; i++) {
+            br.ReadUE(); // sps_max_dec_pic_buffering_minus1
+            br.ReadUE(); // sps_max_num_reorder_pics
+            br.ReadUE(); // sps_max_latency_increase_plus1
+        }
+        for (int i = 0; i < 6; i++) {
+            br.ReadUE(); // coding and transform block sizes, hierarchy depths
+        }
+        if (br.ReadBits(1) && br.ReadBits(1)) { // scaling_list_enabled_flag, sps_scaling_list_data_present_flag
+            SkipH265ScalingListData(br);
+        }
+        br.ReadBits(1); // amp_enabled_flag
+        br.ReadBits(1); // sample_adaptive_offset_enabled_flag
+        if (br.ReadBits(1)) { // pcm_enabled_flag
+            br.ReadBits(8); // pcm sample bit depths
+            br.ReadUE();
+            br.ReadUE();
+            br.ReadBits(1); // pcm_loop_filter_disabled_flag
+        }
+
+        uint32_t rpsCount = br.ReadUE();
+        if (rpsCount > 64) {
+            return 0;
+        }
+        // an inter predicted set lists a flag per entry of the set before it
+        uint32_t deltaPocs = 0;
+        for (uint32_t i = 0; i < rpsCount && !br.Error(); i++) {
+            if (i != 0 && br.ReadBits(1)) { // inter_ref_pic_set_prediction_flag
+                br.ReadBits(1); // delta_rps_sign
+                br.ReadUE(); // abs_delta_rps_minus1
+                uint32_t count = 0;
+                for (uint32_t j = 0; j <= deltaPocs; j++) {
+                    if (br.ReadBits(1) || br.ReadBits(1)) { // used_by_curr_pic_flag, use_delta_flag
+                        count++;
+                    }
+                }
+                deltaPocs = count;
+            } else {
+                uint32_t negative = br.ReadUE();
+                uint32_t positive = br.ReadUE();
+                if (negative > 16 || positive > 16) {
+                    return 0;
+                }
+                for (uint32_t j = 0; j < negative + positive; j++) {
+                    br.ReadUE(); // delta_poc_minus1
+                    br.ReadBits(1); // used_by_curr_pic_flag
+                }
+                deltaPocs = negative + positive;
+            }
+        }
+        if (br.ReadBits(1)) { // long_term_ref_pics_present_flag
+            uint32_t longTerm = br.ReadUE();
+            if (longTerm > 32) {
+                return 0;
+            }
+            for (uint32_t i = 0; i < longTerm; i++) {
+                br.ReadBits(pocLsbBits);
+                br.ReadBits(1); // used_by_curr_pic_lt_sps_flag
+            }
+        }
+        br.ReadBits(1); // sps_temporal_mvp_enabled_flag
+        br.ReadBits(1); // strong_intra_smoothing_enabled_flag
+
+        if (br.ReadBits(1)) { // vui_parameters_present_flag
+            if (br.ReadBits(1) && br.ReadBits(8) == 255) { // aspect_ratio_idc Extended_SAR
+                br.SkipBits(32);
+            }
+            if (br.ReadBits(1)) { // overscan_info_present_flag
+                br.ReadBits(1);
+            }
+            if (br.ReadBits(1)) { // video_signal_type_present_flag
+                br.ReadBits(4);
+                if (br.ReadBits(1)) {
+                    br.SkipBits(24);
+                }
+            }
+            if (br.ReadBits(1)) { // chroma_loc_info_present_flag
+                br.ReadUE();
+                br.ReadUE();
+            }
+            br.ReadBits(3); // neutral_chroma_indication, field_seq, frame_field_info_present
+            if (br.ReadBits(1)) { // default_display_window_flag
+                for (int i = 0; i < 4; i++) {
+                    br.ReadUE();
+                }
+            }
+            if (br.ReadBits(1)) { // vui_timing_info_present_flag
+                uint32_t unitsInTick = br.ReadBits(32);
+                uint32_t timeScale = br.ReadBits(32);
+                // unlike h264 a tick is a whole picture
+                if (unitsInTick && !br.Error()) {
+                    return (double)timeScale / unitsInTick;
+                }
+            }
+        }
+        return 0;
+    }
+
+    bool ParseH265Sps(const unsigned char *nalu, size_t size, VideoParams *params) {
+        if (size < 4 || ((nalu[0] >> 1) & 0x3f) != H265_NAL_SPS) {
+            return false;
+        }
+
+        std::vector<unsigned char> rbsp(size);
+        BitReader br(rbsp.data(), RemoveEmulationPrevention(nalu + 2, size - 2, rbsp.data()));
+        VideoParams sps;
+        ::memset(&sps, 0, sizeof(sps));
+        sps.codec = VideoCodecH265;
+
+        br.ReadBits(4); // sps_video_parameter_set_id
+        int maxSubLayersMinus1 = br.ReadBits(3);
+        br.ReadBits(1); // sps_temporal_id_nesting_flag
+        ParseProfileTierLevel(br, maxSubLayersMinus1, &sps);
+
+        br.ReadUE(); // sps_seq_parameter_set_id
+        sps.chromaFormat = br.ReadUE();
+        if (sps.chromaFormat == 3) {
+            br.ReadBits(1); // separate_colour_plane_flag
+        }
+        sps.width = br.ReadUE();
+        sps.height = br.ReadUE();
+        if (br.ReadBits(1)) { // conformance_window_flag
+            int subWidth = sps.chromaFormat == 1 || sps.chromaFormat == 2 ? 2 : 1;
+            int subHeight = sps.chromaFormat == 1 ? 2 : 1;
+            uint32_t left = br.ReadUE();
+            uint32_t right = br.ReadUE();
+            uint32_t top = br.ReadUE();
+            uint32_t bottom = br.ReadUE();
+            sps.width -= subWidth * (left + right);
+            sps.height -= subHeight * (top + bottom);
+        }
+        sps.bitDepth = br.ReadUE() + 8;
+        br.ReadUE(); // bit_depth_chroma_minus8
+
+        if (br.Error() || sps.width <= 0 || sps.height <= 0) {
+            return false;
+        }
+
+        // a truncated vui only costs us the framerate
+        sps.framerate = ParseH265Framerate(br, maxSubLayersMinus1);
+
+        *params = sps;
+        return true;
+    }
+}
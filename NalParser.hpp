@@ -0,0 +1,60 @@
+//
+//  NalParser.hpp
+//  Simple-Rtsp-Client
+//
+
+#ifndef NalParser_hpp
+#define NalParser_hpp
+
+#include <functional>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace RK {
+
+    enum VideoCodec {
+        VideoCodecUnknown = 0,
+        VideoCodecH264,
+        VideoCodecH265,
+    };
+
+    // what a decoder needs to size its surfaces, from the sps
+    struct VideoParams {
+        VideoCodec codec;
+        int profile;
+        int level;          // level_idc, e.g. 31 for h264 3.1, 93 for h265 3.1
+        int tier;           // h265 only
+        int width;          // after cropping
+        int height;
+        int chromaFormat;   // 0 mono, 1 4:2:0, 2 4:2:2, 3 4:4:4
+        int bitDepth;
+        double framerate;   // vui timing, 0 when absent
+    };
+
+    // nal unit type from the header, 5 bits for h264, 6 for h265
+    inline uint8_t NaluType(VideoCodec codec, const unsigned char *nalu) {
+        return codec == VideoCodecH265 ? (nalu[0] >> 1) & 0x3f : nalu[0] & 0x1f;
+    }
+
+    // first 00 00 01 in [p, end), end when there is none. sse2/avx2 when the
+    // cpu has them, scalar otherwise.
+    const unsigned char *FindStartCode(const unsigned char *p, const unsigned char *end);
+
+    // every scanner variant this cpu can run, scalar first, so the simd
+    // ones can be held against it
+    typedef const unsigned char *(*StartCodeScanner)(const unsigned char *p, const unsigned char *end);
+    std::vector<StartCodeScanner> StartCodeScanners();
+
+    // calls back with every nal unit (start code stripped) of an annex-b buffer
+    void ForEachNalu(const unsigned char *data, size_t size, const std::function<void(const unsigned char *nalu, size_t size)> &callback);
+
+    // strips emulation prevention bytes, dst must hold size bytes and may be src
+    size_t RemoveEmulationPrevention(const unsigned char *src, size_t size, unsigned char *dst);
+
+    // nal units without start code, emulation prevention still in place
+    bool ParseH264Sps(const unsigned char *nalu, size_t size, VideoParams *params);
+    bool ParseH265Sps(const unsigned char *nalu, size_t size, VideoParams *params);
+
+} //namespace RK
+#endif /* NalParser_hpp */
@@ -0,0 +1,92 @@
+//
+//  RtspAwait.hpp
+//  Simple-Rtsp-Client
+//
+
+#ifndef RtspAwait_hpp
+#define RtspAwait_hpp
+
+// c++20 coroutine front end for the RtspPlayer async calls. the library
+// itself stays c++11, this header is only active for c++20 callers:
+//
+//     RtspSession session(player);
+//     RtspResult r = co_await session.Describe();
+//
+// a coroutine resumes on the player's event loop thread, so no thread is
+// parked per request.
+
+#include "RtspPlayer.hpp"
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <atomic>
+#include <coroutine>
+
+namespace RK {
+
+    class RtspAwaitable {
+    public:
+        typedef std::function<void(RtspCallback callback)> Starter;
+
+        explicit RtspAwaitable(Starter starter) : _Starter(std::move(starter)) {}
+
+        bool await_ready() const noexcept { return false; }
+
+        // the callback may run before the starter returns, inline or on the
+        // loop thread. whichever side finishes second goes on: the callback
+        // resumes, or await_suspend returns false and never suspends
+        bool await_suspend(std::coroutine_handle<> handle) {
+            Starter starter = std::move(_Starter);
+            starter([this, handle](const RtspResult &result) {
+                _Result = result;
+                if (_Done.exchange(true, std::memory_order_acq_rel)) {
+                    handle.resume();
+                }
+            });
+            return !_Done.exchange(true, std::memory_order_acq_rel);
+        }
+
+        RtspResult await_resume() { return std::move(_Result); }
+    private:
+        Starter _Starter;
+        RtspResult _Result;
+        std::atomic<bool> _Done{false};
+    };
+
+    class RtspSession {
+    public:
+        explicit RtspSession(RtspPlayer::Ptr player) : _Player(std::move(player)) {}
+
+        RtspAwaitable Connect(std::string url) {
+            return RtspAwaitable([player = _Player, url](RtspCallback callback) { player->AsyncConnect(url, callback); });
+        }
+        RtspAwaitable Describe() {
+            return RtspAwaitable([player = _Player](RtspCallback callback) { player->AsyncDescribe(callback); });
+        }
+        RtspAwaitable Setup() {
+            return RtspAwaitable([player = _Player](RtspCallback callback) { player->AsyncSetup(callback); });
+        }
+        RtspAwaitable Play() {
+            return RtspAwaitable([player = _Player](RtspCallback callback) { player->AsyncPlay(callback); });
+        }
+        RtspAwaitable Pause() {
+            return RtspAwaitable([player = _Player](RtspCallback callback) { player->AsyncPause(callback); });
+        }
+        RtspAwaitable Seek(double npt) {
+            return RtspAwaitable([player = _Player, npt](RtspCallback callback) { player->AsyncSeek(npt, callback); });
+        }
+        RtspAwaitable Teardown() {
+            return RtspAwaitable([player = _Player](RtspCallback callback) { player->AsyncTeardown(callback); });
+        }
+        RtspAwaitable GetParameter(std::string parameters) {
+            return RtspAwaitable([player = _Player, parameters](RtspCallback callback) { player->AsyncGetParameter(parameters, callback); });
+        }
+        RtspAwaitable SetParameter(std::string parameters) {
+            return RtspAwaitable([player = _Player, parameters](RtspCallback callback) { player->AsyncSetParameter(parameters, callback); });
+        }
+    private:
+        RtspPlayer::Ptr _Player;
+    };
+
+} //namespace RK
+#endif
+#endif /* RtspAwait_hpp */
@@ -0,0 +1,316 @@
+//
+//  RtspIngestd.cpp
+//  Simple-Rtsp-Client
+//
+
+// ingest daemon: every stream of the config file on one shared set of
+// pinned event loops.
+//
+//     RtspIngestd -c streams.conf
+//
+// SIGHUP reloads the file, streams whose line did not change keep running.
+// SIGINT/SIGTERM tear everything down. with "listen" set, encoders push
+// into the "push:" streams over rtsp ANNOUNCE/RECORD. SIGUSR1 dumps the
+// frame trace of a -DRTSP_TRACE=ON build to the "trace" path.
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <signal.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "EventLoopGroup.hpp"
+#include "IngestConfig.hpp"
+#include "IngestStream.hpp"
+#include "RtspListener.hpp"
+#include "Trace.hpp"
+#include "Log.hpp"
+
+#define MODULE_TAG "RtspIngestd"
+
+namespace RK {
+
+    static const char *StateName(IngestState state) {
+        switch (state) {
+            case IngestConnecting:
+                return "connecting";
+            case IngestPlaying:
+                return "playing";
+            case IngestRetrying:
+                return "retrying";
+            case IngestWaiting:
+                return "waiting";
+            default:
+                return "stopped";
+        }
+    }
+
+    static std::string JsonString(const std::string &value) {
+        std::string out = "\"";
+        for (char c : value) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+            }
+            if ((unsigned char)c >= 0x20) {
+                out += c;
+            }
+        }
+        return out + "\"";
+    }
+
+    // rtsp://host:port/live/cam2/ -> /live/cam2
+    static std::string UrlPath(const std::string &url) {
+        size_t scheme = url.find("://");
+        size_t slash = url.find('/', scheme == std::string::npos ? 0 : scheme + 3);
+        std::string path = slash == std::string::npos ? "/" : url.substr(slash);
+        path = path.substr(0, path.find('?'));
+        while (path.size() > 1 && path.back() == '/') {
+            path.pop_back();
+        }
+        return path;
+    }
+
+    class IngestDaemon {
+    public:
+        bool Init(const IngestConfig &config) {
+            _Group = EventLoopGroup::Create(config.cpus);
+            if (!_Group) {
+                log(MODULE_TAG, "no event loop could be started");
+                return false;
+            }
+            _Config.cpus = config.cpus;
+            _Config.listenPort = config.listenPort;
+            Apply(config);
+
+            if (config.listenPort > 0) {
+                _Listener = std::make_shared<RtspListener>(_Group, [this](const std::string &url, RtspPlayer::Ptr player) {
+                    IngestStream::Ptr stream = FindPush(url);
+                    if (!stream) {
+                        log(MODULE_TAG, "no push stream for %s", url.c_str());
+                        return false;
+                    }
+                    return stream->AttachPush(player);
+                }, [this](const std::string &url, RtspPlayer::Ptr player) {
+                    IngestStream::Ptr stream = FindPush(url);
+                    if (stream) {
+                        stream->DetachPush(player);
+                    }
+                });
+                if (!_Listener->Listen((unsigned short)config.listenPort)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // from the listener's loops
+        IngestStream::Ptr FindPush(const std::string &url) {
+            std::string path = UrlPath(url);
+            std::lock_guard<std::mutex> lock(_Lock);
+            for (auto &it : _Streams) {
+                if (it.second->Config().Push() && UrlPath(it.second->Config().PushPath()) == path) {
+                    return it.second;
+                }
+            }
+            return nullptr;
+        }
+
+        // stops what is gone or changed, starts what is new or changed
+        void Apply(const IngestConfig &config) {
+            if (config.cpus != _Config.cpus) {
+                log(MODULE_TAG, "cpus change needs a restart, keeping the running loops");
+            }
+            if (config.listenPort != _Config.listenPort) {
+                log(MODULE_TAG, "listen change needs a restart, keeping port %d", _Config.listenPort);
+            }
+
+            // only this thread changes _Streams, the lock is for the listener's
+            // lookups. stopping a push stream waits on the listener's callbacks,
+            // so it never happens under the lock.
+            std::map<std::string, IngestStream::Ptr> streams, stopped;
+            for (auto &stream : config.streams) {
+                auto it = _Streams.find(stream.name);
+                if (it != _Streams.end() && it->second->Config() == stream) {
+                    streams[stream.name] = it->second;
+                } else if (it != _Streams.end()) {
+                    log(MODULE_TAG, "%s changed, restarting", stream.name.c_str());
+                    stopped[stream.name] = it->second;
+                }
+            }
+            for (auto &it : _Streams) {
+                if (!streams.count(it.first) && !stopped.count(it.first)) {
+                    log(MODULE_TAG, "%s removed", it.first.c_str());
+                    stopped[it.first] = it.second;
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(_Lock);
+                _Streams = streams;
+            }
+            // release sinks (ports, files) before the new ones open them
+            for (auto &it : stopped) {
+                it.second->Stop();
+            }
+
+            for (auto &stream : config.streams) {
+                if (streams.count(stream.name)) {
+                    continue;
+                }
+                IngestStream::Ptr ingest = std::make_shared<IngestStream>(stream, _Group->Next());
+                if (!ingest->Start()) {
+                    log(MODULE_TAG, "%s failed to start", stream.name.c_str());
+                    continue;
+                }
+                std::lock_guard<std::mutex> lock(_Lock);
+                _Streams[stream.name] = ingest;
+            }
+
+            std::vector<int> cpus = _Config.cpus;
+            int listenPort = _Config.listenPort;
+            _Config = config;
+            _Config.cpus = cpus;
+            _Config.listenPort = listenPort;
+            log(MODULE_TAG, "%zu streams on %zu loops", _Streams.size(), _Group->Size());
+        }
+
+        void WriteHealth() {
+            if (_Config.healthPath.empty()) {
+                return;
+            }
+
+            std::string json = "{\"time\":" + std::to_string((long long)::time(NULL)) + ",\"streams\":[";
+            for (auto &it : _Streams) {
+                IngestHealth health = it.second->GetHealth();
+                char line[2048];
+                ::snprintf(line, sizeof(line),
+                    "%s\n{\"name\":%s,\"state\":\"%s\",\"frames\":%llu,\"keyframes\":%llu,\"bytes\":%llu,\"fps\":%.1f,"
+                    "\"lastFrameAgeMs\":%lld,\"reconnects\":%u,\"fanoutClients\":%zu,\"received\":%llu,\"recovered\":%llu,"
+                    "\"lost\":%llu,\"droppedNonRef\":%llu,\"droppedResync\":%llu,\"gop\":%u,\"maxGop\":%u,\"sinceKeyframe\":%u,"
+                    "\"keyframeBytes\":%zu,\"frameBytes\":%zu,\"kbps\":%.0f,\"peakKbps\":%.0f,\"intervalJitterMs\":%.1f,"
+                    "\"maxIntervalMs\":%.0f,\"lastError\":%s}",
+                    it.first == _Streams.begin()->first ? "" : ",", JsonString(health.name).c_str(), StateName(health.state),
+                    (unsigned long long)health.frames, (unsigned long long)health.keyframes, (unsigned long long)health.bytes,
+                    health.fps, (long long)health.lastFrameAgeMs, health.reconnects, health.fanoutClients,
+                    (unsigned long long)health.jitter.received, (unsigned long long)health.jitter.recovered,
+                    (unsigned long long)health.jitter.lost, (unsigned long long)health.latency.droppedNonRef,
+                    (unsigned long long)health.latency.droppedResync, health.stream.gopLength, health.stream.maxGopLength,
+                    health.stream.framesSinceKeyframe, health.stream.keyframeBytes, health.stream.frameBytes,
+                    health.stream.bitrate / 1000, health.stream.peakBitrate / 1000, health.stream.intervalJitterMs,
+                    health.stream.maxIntervalMs, JsonString(health.lastError).c_str());
+                json += line;
+            }
+            json += "\n]}\n";
+
+            if (_Config.healthPath == "-") {
+                ::fputs(json.c_str(), stdout);
+                ::fflush(stdout);
+                return;
+            }
+
+            // readers never see a half written file
+            std::string tmp = _Config.healthPath + ".tmp";
+            FILE *fp = ::fopen(tmp.c_str(), "w");
+            if (!fp) {
+                log(MODULE_TAG, "failed to write %s", tmp.c_str());
+                return;
+            }
+            ::fputs(json.c_str(), fp);
+            ::fclose(fp);
+            ::rename(tmp.c_str(), _Config.healthPath.c_str());
+        }
+
+        void Shutdown() {
+            _Listener.reset();
+            std::map<std::string, IngestStream::Ptr> streams;
+            {
+                std::lock_guard<std::mutex> lock(_Lock);
+                streams.swap(_Streams);
+            }
+            for (auto &it : streams) {
+                it.second->Stop();
+            }
+            _Group.reset();
+        }
+
+        void WriteTrace() {
+            if (_Config.tracePath.empty()) {
+                log(MODULE_TAG, "no trace path configured");
+            } else if (TraceDump(_Config.tracePath)) {
+                log(MODULE_TAG, "trace written to %s", _Config.tracePath.c_str());
+            }
+        }
+
+        int HealthIntervalMs() const { return _Config.healthIntervalMs; }
+    private:
+        EventLoopGroup::Ptr _Group;
+        IngestConfig _Config;
+        std::mutex _Lock;
+        std::map<std::string, IngestStream::Ptr> _Streams;
+        std::shared_ptr<RtspListener> _Listener;
+    };
+}
+
+using namespace RK;
+
+int main(int argc, char **argv) {
+    std::string path;
+    int opt;
+    while ((opt = ::getopt(argc, argv, "c:")) != -1) {
+        if (opt == 'c') {
+            path = optarg;
+        }
+    }
+    if (path.empty()) {
+        printf("usage: %s -c <config>\n", argv[0]);
+        return -1;
+    }
+
+    IngestConfig config;
+    if (!LoadIngestConfig(path, &config)) {
+        return -1;
+    }
+
+    // blocked before any loop thread exists so only sigtimedwait sees them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    ::pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    ::signal(SIGPIPE, SIG_IGN);
+
+    IngestDaemon daemon;
+    if (!daemon.Init(config)) {
+        return -1;
+    }
+
+    while (true) {
+        int interval = daemon.HealthIntervalMs();
+        struct timespec timeout = {interval / 1000, (interval % 1000) * 1000000L};
+        int sig = ::sigtimedwait(&signals, NULL, &timeout);
+        if (sig == SIGINT || sig == SIGTERM) {
+            break;
+        }
+        if (sig == SIGUSR1) {
+            daemon.WriteTrace();
+            continue;
+        }
+        if (sig == SIGHUP) {
+            log(MODULE_TAG, "reloading %s", path.c_str());
+            IngestConfig reloaded;
+            if (LoadIngestConfig(path, &reloaded)) {
+                daemon.Apply(reloaded);
+            } else {
+                log(MODULE_TAG, "keeping the previous configuration");
+            }
+            continue;
+        }
+        daemon.WriteHealth();
+    }
+
+    log(MODULE_TAG, "shutting down");
+    daemon.Shutdown();
+    return 0;
+}
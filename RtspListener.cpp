@@ -0,0 +1,145 @@
+//
+//  RtspListener.cpp
+//  Simple-Rtsp-Client
+//
+
+#include "RtspListener.hpp"
+#include <errno.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "Log.hpp"
+
+#define MODULE_TAG "RtspListener"
+
+namespace RK {
+
+    RtspListener::RtspListener(EventLoopGroup::Ptr group, AnnounceCallback announce, ClosedCallback closed)
+        : _Group(group), _Loop(group->At(0)), _Announce(announce), _Closed(closed) {
+    }
+
+    RtspListener::~RtspListener() {
+        if (_Socket >= 0) {
+            _Loop->RunInLoopSync([this] {
+                _Loop->RemoveFd(_Socket);
+            });
+            ::close(_Socket);
+        }
+
+        std::map<RtspPlayer *, Session> sessions;
+        {
+            std::lock_guard<std::mutex> lock(_Lock);
+            sessions.swap(_Sessions);
+        }
+        for (auto &it : sessions) {
+            it.second.player->Stop();
+        }
+    }
+
+    bool RtspListener::Listen(unsigned short port) {
+        _Socket = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (_Socket < 0) {
+            log(MODULE_TAG, "failed to create socket %s", strerror(errno));
+            return false;
+        }
+
+        int reuse = 1;
+        ::setsockopt(_Socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        struct sockaddr_in addr;
+        ::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        if (::bind(_Socket, (struct sockaddr *)&addr, sizeof(addr)) < 0 || ::listen(_Socket, 16) < 0) {
+            log(MODULE_TAG, "failed to listen on port %d %s", port, strerror(errno));
+            ::close(_Socket);
+            _Socket = -1;
+            return false;
+        }
+        _Port = port;
+
+        bool added = false;
+        _Loop->RunInLoopSync([this, &added] {
+            added = _Loop->AddFd(_Socket, EventRead, [this](int) {
+                HandleAccept();
+            });
+        });
+        return added;
+    }
+
+    size_t RtspListener::Sessions() {
+        std::lock_guard<std::mutex> lock(_Lock);
+        return _Sessions.size();
+    }
+
+    void RtspListener::HandleAccept() {
+        while (true) {
+            int fd = ::accept4(_Socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    log(MODULE_TAG, "accept on port %d failed %s", _Port, strerror(errno));
+                }
+                return;
+            }
+
+            int nodelay = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+            EventLoop::Ptr loop = _Group->Next();
+            RtspPlayer::Ptr player = std::make_shared<RtspPlayer>(loop);
+            RtspPlayer *key = player.get();
+            {
+                std::lock_guard<std::mutex> lock(_Lock);
+                Session session;
+                session.player = player;
+                session.loop = loop;
+                _Sessions[key] = session;
+            }
+
+            bool accepted = player->Accept(fd, [this, key](const std::string &url) {
+                RtspPlayer::Ptr player;
+                {
+                    std::lock_guard<std::mutex> lock(_Lock);
+                    auto it = _Sessions.find(key);
+                    if (it == _Sessions.end()) {
+                        return false;
+                    }
+                    it->second.url = url;
+                    player = it->second.player;
+                }
+                return !_Announce || _Announce(url, player);
+            }, [this, key](const RtspResult &result) {
+                if (result.method == RTSPTEARDOWN) {
+                    HandleClosed(key);
+                }
+            });
+            if (!accepted) {
+                HandleClosed(key);
+            }
+        }
+    }
+
+    void RtspListener::HandleClosed(RtspPlayer *key) {
+        Session session;
+        {
+            std::lock_guard<std::mutex> lock(_Lock);
+            auto it = _Sessions.find(key);
+            if (it == _Sessions.end()) {
+                return;
+            }
+            session = it->second;
+            _Sessions.erase(it);
+        }
+
+        log(MODULE_TAG, "push session %s closed", session.url.c_str());
+        if (_Closed && !session.url.empty()) {
+            _Closed(session.url, session.player);
+        }
+
+        // we are inside the player's own callback, let it unwind first
+        RtspPlayer::Ptr player = session.player;
+        session.loop->Post([player] {});
+    }
+
+} //namespace RK
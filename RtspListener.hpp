@@ -0,0 +1,52 @@
+//
+//  RtspListener.hpp
+//  Simple-Rtsp-Client
+//
+
+#ifndef RtspListener_hpp
+#define RtspListener_hpp
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include "EventLoopGroup.hpp"
+#include "RtspPlayer.hpp"
+
+namespace RK {
+
+    // accepts encoders pushing with ANNOUNCE/SETUP/RECORD. every connection
+    // gets its own player on the next loop of the group, frames then flow
+    // through the usual player callbacks.
+    class RtspListener {
+    public:
+        // announce decides whether a url is wanted and hooks up the player,
+        // closed runs once the encoder is gone for whatever reason
+        typedef std::function<bool(const std::string &url, RtspPlayer::Ptr player)> AnnounceCallback;
+        typedef std::function<void(const std::string &url, RtspPlayer::Ptr player)> ClosedCallback;
+
+        RtspListener(EventLoopGroup::Ptr group, AnnounceCallback announce, ClosedCallback closed);
+        ~RtspListener();
+        bool Listen(unsigned short port);
+        size_t Sessions();
+    protected:
+        struct Session {
+            RtspPlayer::Ptr player;
+            EventLoop::Ptr loop;
+            std::string url;
+        };
+
+        void HandleAccept();
+        void HandleClosed(RtspPlayer *key);
+    private:
+        EventLoopGroup::Ptr _Group;
+        EventLoop::Ptr _Loop;
+        AnnounceCallback _Announce;
+        ClosedCallback _Closed;
+        int _Socket = -1;
+        unsigned short _Port = 0;
+        std::mutex _Lock;
+        std::map<RtspPlayer *, Session> _Sessions;
+    };
+
+} //namespace RK
+#endif /* RtspListener_hpp */
@@ -7,29 +7,73 @@
 //
 
 #include "RtspPlayer.hpp"
+#include "LatencyQueue.hpp"
+#include "Trace.hpp"
+#include <algorithm>
+#include <future>
+#include <random>
 #include <unistd.h>
+#include "Log.hpp"
 
 #define MODULE_TAG "RtspPlayer"
 
-#define log(tag,fmt,...)\
-do {\
-    printf("%s:", tag);\
-    printf(fmt, ##__VA_ARGS__);\
-    printf("\n");\
-} while(0)
-
 #define SetNextState(x) _PlayState = x;
 
 #define VIDEO_RTP_PORT (12000)
 #define VIDEO_RTCP_PORT (12001)
+#define RTP_PORT_MAX (65534)
+
+// default memory budget of a session
+#define SESSION_FRAME_BYTES (4 * 1024 * 1024)
+#define SESSION_JITTER_PACKETS (512)
+#define SESSION_QUEUE_BYTES (8 * 1024 * 1024)
+#define SESSION_RTSP_BYTES (64 * 1024)
+#define SESSION_STACK_BYTES (256 * 1024)
+#define SESSION_RCVBUF_BYTES (2 * 1024 * 1024)
 
-static FILE *fp;
+#define RTSP_REQUEST_TIMEOUT_MS (5000)
+#define RTSP_TEARDOWN_TIMEOUT_MS (300)
+// rfc 2326 default when the Session header carries no timeout
+#define RTSP_SESSION_TIMEOUT_S (60)
+#define RTSP_PUSH_METHODS "OPTIONS, ANNOUNCE, SETUP, RECORD, GET_PARAMETER, SET_PARAMETER, TEARDOWN"
+// how long a hole may wait for its retransmission by default
+#define RTP_RETRANSMIT_BUDGET_MS (150)
+// capture packets handled per loop turn
+#define CAPTURE_BATCH_PACKETS (256)
+// datagrams per recvmmsg, each up to RTP_RECV_SIZE
+#define RTP_RECV_BATCH (32)
+#define RTP_RECV_SIZE (2048)
+// room past an outgoing rtcp packet for the srtcp index, mki and tag
+#define SRTCP_SPACE (64)
 
 namespace RK {
-    RtspPlayer::RtspPlayer() {
+    static std::atomic<int> s_NextRtpPort(VIDEO_RTP_PORT);
+    
+    RtspPlayer::RtspPlayer() : RtspPlayer(nullptr) {
+    }
+    
+    RtspPlayer::RtspPlayer(EventLoop::Ptr loop) {
         _Terminated = false;
         _NetWorked = false;
         _PlayState = RtspIdle;
+        _RetransmitBudgetMs = RTP_RETRANSMIT_BUDGET_MS;
+        _SessionTimeout = RTSP_SESSION_TIMEOUT_S;
+        _LocalSsrc = std::random_device()();
+        ::memset(&_RtcpVideoAddr, 0, sizeof(_RtcpVideoAddr));
+        
+        _Budget.frameBytes = SESSION_FRAME_BYTES;
+        _Budget.jitterPackets = SESSION_JITTER_PACKETS;
+        _Budget.queueBytes = SESSION_QUEUE_BYTES;
+        _Budget.rtspBytes = SESSION_RTSP_BYTES;
+        _Budget.stackBytes = SESSION_STACK_BYTES;
+        _Budget.socketBytes = SESSION_RCVBUF_BYTES;
+        
+        _Loop = loop;
+        if (!_Loop) {
+            _Loop = std::make_shared<EventLoop>();
+            _Loop->SetStackSize(_Budget.stackBytes);
+            _OwnLoop = true;
+        }
     }
     
     RtspPlayer::~RtspPlayer() {
@@ -63,7 +107,6 @@ namespace RK {
             log(MODULE_TAG, "network init failed");
             return false;
         }
-        _Eventfd = std::max(_RtspSocket, _Eventfd);
         
         int ul = true;
         if (::ioctl(_RtspSocket, FIONBIO, &ul) < 0) {
@@ -85,50 +128,111 @@ namespace RK {
             return false;
         }
         
-        _NetWorked = true;
         return true;
     }
     
-    bool RtspPlayer::RTPSocketInit(int videoPort, int audioPort) {
-        if (videoPort) {
-            _RtpVideoSocket = ::socket(AF_INET, SOCK_DGRAM, 0);
-            if (_RtpVideoSocket < 0) {
-                log(MODULE_TAG, "rtp video socket init failed");
-                return false;
+    static int OpenRtpSocket(unsigned short port, int rcvbuf) {
+        int sock = ::socket(AF_INET, SOCK_DGRAM, 0);
+        if (sock < 0) {
+            return -1;
+        }
+        
+        int ul = true;
+        if (::ioctl(sock, FIONBIO, &ul) < 0) {
+            ::close(sock);
+            return -1;
+        }
+        
+        // room for bursts while the loop is busy, capped by net.core.rmem_max
+        ::setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        
+        struct sockaddr_in addr;
+        ::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_port = htons(port);
+        if (::bind(sock, (const struct sockaddr *)&addr, (socklen_t)sizeof(addr)) < 0) {
+            ::close(sock);
+            return -1;
+        }
+        
+        return sock;
+    }
+    
+    bool RtspPlayer::RTPSocketInit(int *rtp, int *rtcp, unsigned short *rtpPort) {
+        // every session needs its own even/odd pair, walk the range until one is free
+        for (int tries = 0; tries < (RTP_PORT_MAX - VIDEO_RTP_PORT) / 2; tries++) {
+            int port = s_NextRtpPort.fetch_add(2);
+            if (port >= RTP_PORT_MAX) {
+                s_NextRtpPort = VIDEO_RTP_PORT;
+                continue;
             }
-            _Eventfd = std::max(_RtpVideoSocket, _Eventfd);
             
-            int ul = true;
-            if (::ioctl(_RtpVideoSocket, FIONBIO, &ul) < 0) {
-                log(MODULE_TAG, "failed to set rtp video socket non block");
-                ::close(_RtpVideoSocket);
-                return false;
+            *rtp = OpenRtpSocket((unsigned short)port, _Budget.socketBytes);
+            if (*rtp < 0) {
+                continue;
             }
-            
-            _RtpVideoAddr.sin_family = AF_INET;
-            //_RtpVideoAddr.sin_addr.s_addr = inet_addr(_rtspip);
-            _RtpVideoAddr.sin_addr.s_addr = INADDR_ANY;
-            _RtpVideoAddr.sin_port = htons(VIDEO_RTP_PORT);
-            
-            if (::bind(_RtpVideoSocket, (const struct sockaddr *)&_RtpVideoAddr, (socklen_t)sizeof(_RtpVideoAddr)) < 0) {
-                log(MODULE_TAG, "failed to bind rtp video socket error %d %s", errno, strerror(errno));
-                return false;
+            *rtcp = OpenRtpSocket((unsigned short)(port + 1), _Budget.socketBytes);
+            if (*rtcp < 0) {
+                ::close(*rtp);
+                *rtp = -1;
+                continue;
             }
             
+            *rtpPort = (unsigned short)port;
             return true;
         }
-
+        
+        log(MODULE_TAG, "failed to bind rtp socket error %d %s", errno, strerror(errno));
         return false;
     }
     
-    void RtspPlayer::EventInit() {
-        FD_ZERO(&_readfd);
-        FD_ZERO(&_writefd);
-        FD_ZERO(&_errorfd);
+    bool RtspPlayer::MulticastInit(const char *buf, bool audio) {
+        char group[64] = {0};
+        char source[64] = {0};
+        int port = 0;
+        
+        if (strstr(buf, "destination=")) {
+            ::sscanf(strstr(buf, "destination="), "destination=%63[0-9.]", group);
+        }
+        if (strstr(buf, "source=")) {
+            ::sscanf(strstr(buf, "source="), "source=%63[0-9.]", source);
+        }
+        if (strstr(buf, ";port=")) {
+            ::sscanf(strstr(buf, ";port="), ";port=%d", &port);
+        }
+        
+        if (!group[0] || !port) {
+            log(MODULE_TAG, "server replied multicast without destination or port");
+            return false;
+        }
         
-        FD_SET(_RtspSocket, &_readfd);
-        FD_SET(_RtspSocket, &_writefd);
-        FD_SET(_RtspSocket, &_errorfd);
+        // source specific join when the server names the sender
+        MulticastGroup::Ptr &joined = audio ? _McastAudioGroup : _McastGroup;
+        joined = MulticastGroup::Join(group, (unsigned short)port, source);
+        if (!joined) {
+            log(MODULE_TAG, "failed to join multicast group %s:%d", group, port);
+            return false;
+        }
+        
+        MediaClock *clock = audio ? &_AudioClock : &_VideoClock;
+        joined->Subscribe(this, _Loop.get(), [this, audio](const char *buf, ssize_t bufsize) {
+            if (audio) {
+                HandleAudioRtpMsg(buf, bufsize);
+            } else {
+                HandleRtpPacket(buf, bufsize);
+            }
+        }, [this, clock](const char *buf, ssize_t bufsize) {
+            HandleRtcpMsg(buf, bufsize, clock);
+        });
+        
+        return true;
+    }
+    
+    void RtspPlayer::EventInit() {
+        _Loop->AddFd(_RtspSocket, EventRead | EventWrite, [this](int events) {
+            HandleRtspEvent(events);
+        });
     }
     
     std::vector<std::string> RtspPlayer::GetSDPFromMessage(const char *buffer, size_t length, const char *pattern) {
@@ -148,76 +252,500 @@ namespace RK {
         return rvector;
     }
     
-    void RtspPlayer::SendDescribe(std::string url) {
-        char buf[1024];
-        sprintf(buf, "DESCRIBE %s RTSP/1.0\r\n"
-                "Accept: application/sdp\r\n"
-                "CSeq: %d\r\n"
-                "User-Agent: Lavf58.12.100\r\n"
-                "\r\n", url.c_str(), RTSPDESCRIBE);
+    void RtspPlayer::Complete(RtspPlayerCSeq method, int status, const std::string &reason, Clock::time_point start, RtspCallback callback,
+                              const std::string &body) {
+        Clock::time_point now = Clock::now();
+        
+        RtspResult result;
+        result.method = method;
+        result.status = status;
+        result.reason = reason;
+        result.body = body;
+        result.elapsedMs = std::chrono::duration<double, std::milli>(now - start).count();
+        result.sinceConnectMs = std::chrono::duration<double, std::milli>(now - _ConnectStart).count();
+        
+        if (!result.Succeeded()) {
+            log(MODULE_TAG, "rtsp request %d failed %d %s", method, status, reason.c_str());
+        }
+        if (callback) {
+            callback(result);
+        }
+    }
+    
+    void RtspPlayer::SendRequest(RtspPlayerCSeq method, const char *name, const std::string &url, const char *headers, RtspCallback callback,
+                                 const std::string &body) {
+        Clock::time_point start = Clock::now();
+        if (!_NetWorked) {
+            Complete(method, 0, "not connected", start, callback);
+            return;
+        }
+        
+        char session[256] = {0};
+        if (!_RtspSessionID.empty()) {
+            snprintf(session, sizeof(session), "Session: %s\r\n", _RtspSessionID.c_str());
+        }
+        
+        char length[128] = {0};
+        if (!body.empty()) {
+            snprintf(length, sizeof(length), "Content-Type: text/parameters\r\nContent-Length: %zu\r\n", body.size());
+        }
+        
+        char buf[2048];
+        int CSeq = ++_CSeq;
+        snprintf(buf, sizeof(buf), "%s %s RTSP/1.0\r\n"
+                 "CSeq: %d\r\n"
+                 "%s%s%s"
+                 "User-Agent: Lavf58.12.100\r\n"
+                 "\r\n", name, url.c_str(), CSeq, session, headers, length);
         
-        ::send(_RtspSocket, buf, strlen(buf), 0);
+        std::string msg = buf + body;
+        if (::send(_RtspSocket, msg.data(), msg.size(), MSG_NOSIGNAL) < 0) {
+            Complete(method, 0, strerror(errno), start, callback);
+            return;
+        }
+        
+        RtspPending pending;
+        pending.method = method;
+        pending.start = start;
+        pending.callback = callback;
+        pending.timer = _Loop->RunAfter(RTSP_REQUEST_TIMEOUT_MS, [this, CSeq] {
+            auto it = _Pending.find(CSeq);
+            if (it == _Pending.end()) {
+                return;
+            }
+            
+            RtspPending timedout = it->second;
+            _Pending.erase(it);
+            Complete(timedout.method, 0, "timeout", timedout.start, timedout.callback);
+        });
+        _Pending[CSeq] = pending;
+    }
+    
+    void RtspPlayer::SendDescribe(RtspCallback callback) {
+        log(MODULE_TAG, "rtsp send describe");
+        SetNextState(RtspSendDescribe);
+        SendRequest(RTSPDESCRIBE, "DESCRIBE", _rtspurl, "Accept: application/sdp\r\n", callback);
     }
     
     void RtspPlayer::HandleDescribe(const char *buf, ssize_t bufsize) {
         std::vector<std::string> rvector = GetSDPFromMessage(buf, bufsize, "\r\n");
         std::string sdp;
         for (auto substr : rvector) {
-            if (strstr(substr.c_str(),"Session:")) {
-                ::sscanf(substr.c_str(), "Session:%ld", &_RtspSessionID);
-            } else if (strchr(substr.c_str(), '=')) {
+            if (strchr(substr.c_str(), '=')) {
                 sdp.append(substr);
                 sdp.append("\n");
             }
         }
         
+        if (_SdpParser) {
+            sdp_destroy(_SdpParser);
+        }
         _SdpParser = sdp_parse(sdp.c_str());
+        _SdpBytes = 0;
+        TRACE_SESSION(_LocalSsrc, _rtspurl);
+        if (_SdpParser) {
+            // the parser keeps a copy of the text plus pointer arrays into it
+            _SdpBytes = sizeof(*_SdpParser) + sdp.size() + 1 + _SdpParser->medias_count * sizeof(*_SdpParser->medias);
+            for (size_t i = 0; i < _SdpParser->medias_count; i++) {
+                _SdpBytes += _SdpParser->medias[i].attributes_count * sizeof(char *);
+            }
+        }
+        
+        // only keep the raw strings here, decoding waits for GetStreamInfo
+        std::lock_guard<std::mutex> lock(_InfoLock);
+        _InfoValid = _SdpParser != nullptr;
+        _InfoParsed = false;
+        _VideoRtpmap.clear();
+        _VideoFmtp.clear();
+        _VideoFramerate.clear();
+        _InbandSps.clear();
+        _InbandVps.clear();
+        _InbandPps.clear();
+        _RtxPayloadType = -1;
+        _RtxApt = -1;
+        // first video and first audio media, like the setup
+        bool seen[2] = {false, false};
+        for (size_t i = 0; _SdpParser && i < _SdpParser->medias_count; i++) {
+            struct sdp_payload::sdp_media *media = &_SdpParser->medias[i];
+            bool video = strcmp(media->info.type, "video") == 0;
+            if ((!video && strcmp(media->info.type, "audio") != 0) || seen[video]) {
+                continue;
+            }
+            seen[video] = true;
+            for (size_t j = 0; j < media->attributes_count; j++) {
+                const char *attr = media->attributes[j];
+                int rate = 0;
+                if (strncmp(attr, "rtpmap:", 7) == 0 && ::sscanf(attr, "rtpmap:%*d %*[^/]/%d", &rate) == 1) {
+                    (video ? _VideoClock : _AudioClock).SetClockRate(rate);
+                }
+                if (!video) {
+                    continue;
+                }
+                int pt = 0, apt = 0;
+                if (::sscanf(attr, "rtpmap:%d rtx/%d", &pt, &rate) == 2) {
+                    _RtxPayloadType = pt;
+                    continue;
+                }
+                if (::sscanf(attr, "fmtp:%d apt=%d", &pt, &apt) == 2 && pt == _RtxPayloadType) {
+                    _RtxApt = apt;
+                    continue;
+                }
+                if (strncmp(attr, "rtpmap:", 7) == 0) {
+                    _VideoRtpmap = attr + 7;
+                } else if (strncmp(attr, "fmtp:", 5) == 0) {
+                    _VideoFmtp = attr + 5;
+                } else if (strncmp(attr, "framerate:", 10) == 0) {
+                    _VideoFramerate = attr + 10;
+                }
+            }
+        }
+        UpdateVideoCodec();
+    }
+    
+    static size_t DecodeBase64(const std::string &in, unsigned char *out) {
+        size_t n = 0;
+        uint32_t acc = 0;
+        int bits = 0;
+        
+        for (char c : in) {
+            int v;
+            if (c >= 'A' && c <= 'Z') {
+                v = c - 'A';
+            } else if (c >= 'a' && c <= 'z') {
+                v = c - 'a' + 26;
+            } else if (c >= '0' && c <= '9') {
+                v = c - '0' + 52;
+            } else if (c == '+') {
+                v = 62;
+            } else if (c == '/') {
+                v = 63;
+            } else {
+                break;
+            }
+            acc = acc << 6 | v;
+            bits += 6;
+            if (bits >= 8) {
+                bits -= 8;
+                out[n++] = (acc >> bits) & 0xff;
+            }
+        }
+        return n;
     }
     
-    void RtspPlayer::RtspSetup(const std::string url, int track, int CSeq, char *proto, short rtp_port, short rtcp_port) {
-        char buf[1024];
-        sprintf(buf, "SETUP %s/trackID=%d RTSP/1.0\r\n"
-                "CSeq: %d\r\n"
-                "User-Agent: Lavf58.12.100\r\n"
-                "Transport: %s;unicast;client_port=%d-%d\r\n"
-                "\r\n", url.c_str(), track, CSeq, proto, rtp_port, rtcp_port);
+    // value of key in an fmtp line "96 key=value;key=value"
+    static std::string GetFmtpParam(const std::string &fmtp, const char *key) {
+        size_t keylen = strlen(key);
+        size_t pos = fmtp.find(' ');
         
-        ::send(_RtspSocket, buf, strlen(buf), 0);
+        while (pos != std::string::npos) {
+            pos = fmtp.find_first_not_of("; ", pos);
+            if (pos == std::string::npos) {
+                break;
+            }
+            size_t end = fmtp.find(';', pos);
+            if (fmtp.compare(pos, keylen, key) == 0 && pos + keylen < fmtp.size() && fmtp[pos + keylen] == '=') {
+                pos += keylen + 1;
+                return fmtp.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+            }
+            pos = end;
+        }
+        return "";
     }
     
-    void RtspPlayer::SendVideoSetup() {
-        int i = 0, j = 0;
-        int videoTrackID = 0;
-        for (i = 0; i < _SdpParser->medias_count; i++) {
-            if (strcmp(_SdpParser->medias[i].info.type, "video") == 0) {
+    void RtspPlayer::UpdateVideoCodec() {
+        char encoding[64] = {0};
+        if (::sscanf(_VideoRtpmap.c_str(), "%d %63[^/]", &_VideoPayloadType, encoding) < 1) {
+            _VideoPayloadType = -1;
+        }
+        if (strcasecmp(encoding, "H265") == 0 || strcasecmp(encoding, "HEVC") == 0) {
+            _VideoCodec = VideoCodecH265;
+            _VideoDonl = atoi(GetFmtpParam(_VideoFmtp, "sprop-max-don-diff").c_str()) > 0;
+        } else {
+            // h264, and what the depacketizer always assumed for the rest
+            _VideoCodec = VideoCodecH264;
+            _VideoDonl = false;
+        }
+    }
+    
+    void RtspPlayer::ParseStreamInfo() {
+        StreamInfo info = StreamInfo();
+        char encoding[64] = {0};
+        
+        if (::sscanf(_VideoRtpmap.c_str(), "%d %63[^/]/%d", &info.payloadType, encoding, &info.clockRate) >= 2) {
+            info.encoding = encoding;
+        }
+        if (strcasecmp(encoding, "H264") == 0) {
+            info.video.codec = VideoCodecH264;
+        } else if (strcasecmp(encoding, "H265") == 0 || strcasecmp(encoding, "HEVC") == 0) {
+            info.video.codec = VideoCodecH265;
+        }
+        
+        // h264 carries all sets in one list, h265 one list per type
+        std::vector<std::string> sets;
+        if (info.video.codec == VideoCodecH264) {
+            std::string list = GetFmtpParam(_VideoFmtp, "sprop-parameter-sets");
+            sets = GetSDPFromMessage(list.c_str(), list.size(), ",");
+            
+            std::string profile = GetFmtpParam(_VideoFmtp, "profile-level-id");
+            unsigned int id = 0;
+            if (profile.size() == 6 && ::sscanf(profile.c_str(), "%x", &id) == 1) {
+                info.video.profile = id >> 16;
+                info.video.level = id & 0xff;
+            }
+        } else if (info.video.codec == VideoCodecH265) {
+            for (const char *key : {"sprop-vps", "sprop-sps", "sprop-pps"}) {
+                std::string list = GetFmtpParam(_VideoFmtp, key);
+                std::vector<std::string> more = GetSDPFromMessage(list.c_str(), list.size(), ",");
+                sets.insert(sets.end(), more.begin(), more.end());
+            }
+        }
+        
+        for (const std::string &set : sets) {
+            unsigned char nalu[1024];
+            if (set.size() > sizeof(nalu) * 4 / 3) {
+                continue;
+            }
+            size_t size = DecodeBase64(set, nalu);
+            if (size < 2) {
+                continue;
+            }
+            
+            VideoParams params = info.video;
+            if (info.video.codec == VideoCodecH264 && (nalu[0] & 0x1f) == 7 && ParseH264Sps(nalu, size, &params)) {
+                info.video = params;
+            } else if (info.video.codec == VideoCodecH265 && ((nalu[0] >> 1) & 0x3f) == 33 && ParseH265Sps(nalu, size, &params)) {
+                info.video = params;
+            }
+            
+            const unsigned char header[] = {0, 0, 0, 1};
+            info.parameterSets.insert(info.parameterSets.end(), header, header + sizeof(header));
+            info.parameterSets.insert(info.parameterSets.end(), nalu, nalu + size);
+        }
+        
+        // what the stream actually sends wins over what the sdp announced
+        VideoParams params = info.video;
+        bool h265 = info.video.codec == VideoCodecH265;
+        if (!_InbandSps.empty() && (h265 ? ParseH265Sps : ParseH264Sps)(_InbandSps.data(), _InbandSps.size(), &params)) {
+            info.video = params;
+        }
+        if (info.video.framerate == 0 && !_VideoFramerate.empty()) {
+            info.video.framerate = atof(_VideoFramerate.c_str());
+        }
+        
+        _StreamInfo = info;
+        _InfoParsed = true;
+    }
+    
+    bool RtspPlayer::GetStreamInfo(StreamInfo *info) {
+        std::lock_guard<std::mutex> lock(_InfoLock);
+        if (!_InfoValid) {
+            return false;
+        }
+        if (!_InfoParsed) {
+            ParseStreamInfo();
+        }
+        *info = _StreamInfo;
+        return true;
+    }
+    
+    void RtspPlayer::RtspSetup(RtspPlayerCSeq method, const std::string url, int track, char *proto, short rtp_port, short rtcp_port, RtspCallback callback) {
+        char headers[256];
+        if (_Transport == RtspTransportMulticast) {
+            // the server picks destination group and ports
+            snprintf(headers, sizeof(headers), "Transport: %s;multicast\r\n", proto);
+        } else {
+            snprintf(headers, sizeof(headers), "Transport: %s;unicast;client_port=%d-%d\r\n", proto, rtp_port, rtcp_port);
+        }
+        
+        char trackurl[1024];
+        snprintf(trackurl, sizeof(trackurl), "%s/trackID=%d", url.c_str(), track);
+        SendRequest(method, "SETUP", trackurl, headers, callback);
+    }
+    
+    struct sdp_payload::sdp_media *RtspPlayer::FindMedia(const char *type, int *track) {
+        size_t i = 0, j = 0;
+        
+        for (i = 0; _SdpParser && i < _SdpParser->medias_count; i++) {
+            if (strcmp(_SdpParser->medias[i].info.type, type) == 0) {
                 for (j = 0; j < _SdpParser->medias[i].attributes_count; j++) {
-                    if (strstr(_SdpParser->medias[i].attributes[j], "trackID")) {
-                        ::sscanf(_SdpParser->medias[i].attributes[j], "control:trackID=%d", &videoTrackID);
+                    if (track && strstr(_SdpParser->medias[i].attributes[j], "trackID")) {
+                        ::sscanf(_SdpParser->medias[i].attributes[j], "control:trackID=%d", track);
+                    }
+                }
+                return &_SdpParser->medias[i];
+            }
+        }
+        
+        return nullptr;
+    }
+    
+    struct sdp_payload::sdp_media *RtspPlayer::FindMediaByControl(const char *url) {
+        size_t length = strlen(url);
+        for (size_t i = 0; i < _SdpParser->medias_count; i++) {
+            struct sdp_payload::sdp_media *media = &_SdpParser->medias[i];
+            for (size_t j = 0; j < media->attributes_count; j++) {
+                // relative (streamid=0) or absolute, either way a suffix of the setup url
+                const char *control = media->attributes[j];
+                if (strncmp(control, "control:", 8) != 0) {
+                    continue;
+                }
+                control += 8;
+                size_t size = strlen(control);
+                if (size > 0 && size <= length && strcmp(url + length - size, control) == 0) {
+                    return media;
+                }
+            }
+        }
+        
+        // a lone media may leave out its control attribute
+        return _SdpParser->medias_count == 1 ? &_SdpParser->medias[0] : nullptr;
+    }
+    
+    void RtspPlayer::SendVideoSetup(RtspCallback callback) {
+        int videoTrackID = 0;
+        
+        log(MODULE_TAG, "rtsp send video setup");
+        SetNextState(RtspSendVideoSetup);
+        struct sdp_payload::sdp_media *media = FindMedia("video", &videoTrackID);
+        if (!media) {
+            Complete(RTSPVIDEO_SETUP, 0, "no video track in sdp", Clock::now(), callback);
+            return;
+        }
+        if (!SetupSrtp(false, media)) {
+            Complete(RTSPVIDEO_SETUP, 0, "no usable srtp key for video", Clock::now(), callback);
+            return;
+        }
+        if (_VideoDonl) {
+            Complete(RTSPVIDEO_SETUP, 0, "h265 with sprop-max-don-diff, interleaved decoding order is not supported", Clock::now(), callback);
+            return;
+        }
+        
+        if (_Transport == RtspTransportUnicast && _RtpVideoSocket < 0 && !RTPSocketInit(&_RtpVideoSocket, &_RtcpVideoSocket, &_RtpVideoPort)) {
+            Complete(RTSPVIDEO_SETUP, 0, "rtp socket init failed", Clock::now(), callback);
+            return;
+        }
+        RtspSetup(RTSPVIDEO_SETUP, _rtspurl, videoTrackID, media->info.proto, _RtpVideoPort, _RtpVideoPort + 1, callback);
+    }
+    
+    void RtspPlayer::SendAudioSetup(RtspCallback callback) {
+        int audioTrackID = 0;
+        
+        log(MODULE_TAG, "rtsp send audio setup");
+        SetNextState(RtspSendAudioSetup);
+        struct sdp_payload::sdp_media *media = FindMedia("audio", &audioTrackID);
+        if (!media) {
+            Complete(RTSPAUDIO_SETUP, 0, "no audio track in sdp", Clock::now(), callback);
+            return;
+        }
+        if (!SetupSrtp(true, media)) {
+            log(MODULE_TAG, "no usable srtp key for audio, playing video only");
+            SendPlay("0.000-", callback);
+            return;
+        }
+        
+        if (_Transport == RtspTransportUnicast && _RtpAudioSocket < 0 && !RTPSocketInit(&_RtpAudioSocket, &_RtcpAudioSocket, &_RtpAudioPort)) {
+            Complete(RTSPAUDIO_SETUP, 0, "rtp socket init failed", Clock::now(), callback);
+            return;
+        }
+        RtspSetup(RTSPAUDIO_SETUP, _rtspurl, audioTrackID, media->info.proto, _RtpAudioPort, _RtpAudioPort + 1, callback);
+    }
+    
+    // RTP/SAVP needs one a=crypto we can use, plain RTP/AVP clears the keys.
+    // a=crypto:<tag> <suite> inline:<key||salt base64>[|<lifetime>][|<mki>:<length>]
+    bool RtspPlayer::SetupSrtp(bool audio, struct sdp_payload::sdp_media *media) {
+        SrtpContext::Ptr &srtp = audio ? _SrtpAudio : _SrtpVideo;
+        srtp.reset();
+        if (!strstr(media->info.proto, "/SAVP")) {
+            return true;
+        }
+        if (_Transport == RtspTransportMulticast) {
+            // the group's packets are shared between players, no in place decryption
+            log(MODULE_TAG, "srtp over multicast is not supported");
+            return false;
+        }
+        
+        for (size_t i = 0; i < media->attributes_count; i++) {
+            int tag = 0;
+            char suite[64] = {0};
+            char key[256] = {0};
+            if (::sscanf(media->attributes[i], "crypto:%d %63s inline:%255[^| ]", &tag, suite, key) != 3) {
+                continue;
+            }
+            
+            std::vector<unsigned char> mki;
+            const char *params = strchr(strstr(media->attributes[i], "inline:"), '|');
+            while (params && *params == '|') {
+                unsigned long value = 0;
+                int length = 0;
+                if (::sscanf(params, "|%lu:%d", &value, &length) == 2 && length > 0 && length <= 4) {
+                    for (int j = length - 1; j >= 0; j--) {
+                        mki.push_back((value >> (8 * j)) & 0xff);
                     }
                 }
-                RtspSetup(_rtspurl, videoTrackID, RTSPVIDEO_SETUP, _SdpParser->medias[i].info.proto, VIDEO_RTP_PORT, VIDEO_RTCP_PORT);
+                params = strpbrk(params + 1, "| ");
+            }
+            
+            unsigned char master[sizeof(key)];
+            size_t size = DecodeBase64(key, master);
+            SrtpContext::Ptr context = std::make_shared<SrtpContext>();
+            bool ok = context->Init(suite, master, size, mki);
+            ::memset(master, 0, sizeof(master));
+            if (ok) {
+                log(MODULE_TAG, "%s srtp with %s", audio ? "audio" : "video", suite);
+                srtp = context;
+                return true;
             }
         }
+        
+        log(MODULE_TAG, "%s is RTP/SAVP without a usable a=crypto", audio ? "audio" : "video");
+        return false;
     }
     
-    bool RtspPlayer::HandleVideoSetup(const char *buf, ssize_t bufsize) {
-        int rtp_port = 0;
-        int rtcp_port = 0;
+    bool RtspPlayer::HandleSetup(const char *buf, ssize_t, bool audio) {
+        if (strstr(buf, ";multicast")) {
+            return MulticastInit(buf, audio);
+        } else if (_Transport == RtspTransportMulticast) {
+            log(MODULE_TAG, "server refused multicast");
+            return false;
+        }
+        
         int remote_port = 0;
         int remote_rtcp_port = 0;
         
-        if (strstr(buf, "client_port=")) {
-            ::sscanf(strstr(buf, "client_port="), "client_port=%d-%d", &rtp_port, &rtcp_port);
-        }
-        
         if(strstr(buf, "server_port=")) {
             ::sscanf(strstr(buf, "server_port="), "server_port=%d-%d", &remote_port, &remote_rtcp_port);
         }
         
-        if (!RTPSocketInit(rtp_port ? rtp_port : VIDEO_RTP_PORT, 0)) {
-            log(MODULE_TAG, "rtp socket init failed");
-            return false;
-        }
+        StartRtp(audio, remote_port, remote_rtcp_port);
+        return true;
+    }
+    
+    // the jitter buffer's timer belongs to the loop. a stats reader may drop
+    // the last reference, the buffer still goes away on the loop
+    static std::shared_ptr<JitterBuffer> OnLoop(EventLoop::Ptr loop, JitterBuffer *jitter) {
+        return std::shared_ptr<JitterBuffer>(jitter, [loop](JitterBuffer *jitter) {
+            loop->RunInLoop([jitter] {
+                delete jitter;
+            });
+        });
+    }
+    
+    void RtspPlayer::StartRtp(bool audio, int remote_port, int remote_rtcp_port) {
+        int rtp = audio ? _RtpAudioSocket : _RtpVideoSocket;
+        int rtcp = audio ? _RtcpAudioSocket : _RtcpVideoSocket;
+        MediaClock *clock = audio ? &_AudioClock : &_VideoClock;
+        _Loop->AddFd(rtp, EventRead, [this, rtp, audio](int) {
+            if (audio) {
+                HandleRtpEvent(rtp, _SrtpAudio, false, [this](const char *buf, ssize_t bufsize) { HandleAudioRtpMsg(buf, bufsize); });
+            } else {
+                HandleRtpEvent(rtp, _SrtpVideo, false, [this](const char *buf, ssize_t bufsize) { HandleRtpPacket(buf, bufsize); });
+            }
+        });
+        _Loop->AddFd(rtcp, EventRead, [this, rtcp, clock, audio](int) {
+            HandleRtpEvent(rtcp, audio ? _SrtpAudio : _SrtpVideo, true, [this, clock](const char *buf, ssize_t bufsize) {
+                HandleRtcpMsg(buf, bufsize, clock);
+            });
+        });
         
         struct sockaddr_in remoteAddr;
         remoteAddr.sin_family = AF_INET;
@@ -225,238 +753,1478 @@ namespace RK {
         remoteAddr.sin_addr.s_addr = inet_addr(_rtspip);
         
         const unsigned char natpacket[] = {0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-        ::sendto(_RtpVideoSocket, natpacket, sizeof(natpacket), 0, (const struct sockaddr *)&remoteAddr, (socklen_t)sizeof(remoteAddr));
+        ::sendto(rtp, natpacket, sizeof(natpacket), 0, (const struct sockaddr *)&remoteAddr, (socklen_t)sizeof(remoteAddr));
         
-        return true;
+        // empty receiver report, opens the rtcp path for the sender reports
+        unsigned char natrtcp[8 + SRTCP_SPACE] = {0x80, 0xc9, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00};
+        size_t natsize = 8;
+        SrtpContext::Ptr srtp = audio ? _SrtpAudio : _SrtpVideo;
+        if (srtp) {
+            srtp->ProtectRtcp(natrtcp, &natsize);
+        }
+        remoteAddr.sin_port = htons(remote_rtcp_port ? remote_rtcp_port : remote_port + 1);
+        ::sendto(rtcp, natrtcp, natsize, 0, (const struct sockaddr *)&remoteAddr, (socklen_t)sizeof(remoteAddr));
+        
+        // nacks need the unicast return path, multicast goes without recovery
+        if (!audio && _RetransmitBudgetMs > 0) {
+            _RtcpVideoAddr = remoteAddr;
+            std::atomic_store(&_Jitter, OnLoop(_Loop, new JitterBuffer(_Loop.get(), _RetransmitBudgetMs, _Budget.jitterPackets, [this](const char *buf, ssize_t bufsize) {
+                HandleRtpMsg(buf, bufsize);
+            }, [this](const std::vector<uint16_t> &seqs) {
+                SendNack(seqs);
+            })));
+        }
     }
     
-    void RtspPlayer::SendPlay(const std::string url) {
-        char buf[1024];
-        sprintf(buf, "PLAY %s RTSP/1.0\r\n"
-                "CSeq: %u\r\n"
-                "Session: %ld\r\n"
-                "Range: npt=0.000-\r\n" // Range
-                "User-Agent: Lavf58.12.100\r\n"
-                "\r\n", url.c_str(), RTSPPLAY, _RtspSessionID);
+    void RtspPlayer::SendPlay(const char *range, RtspCallback callback) {
+        char headers[128];
+        snprintf(headers, sizeof(headers), "Range: npt=%s\r\n", range);
         
-        ::send(_RtspSocket, buf, strlen(buf), 0);
+        log(MODULE_TAG, "rtsp send play");
+        SetNextState(RtspSendPlay);
+        SendRequest(RTSPPLAY, "PLAY", _rtspurl, headers, callback);
+    }
+    
+    void RtspPlayer::SendPause(RtspCallback callback) {
+        log(MODULE_TAG, "rtsp send pause");
+        SetNextState(RtspSendPause);
+        SendRequest(RTSPPAUSE, "PAUSE", _rtspurl, "", callback);
+    }
+    
+    void RtspPlayer::SendTeardown(RtspCallback callback) {
+        log(MODULE_TAG, "rtsp send teardown");
+        SetNextState(RtspSendTerminate);
+        SendRequest(RTSPTEARDOWN, "TEARDOWN", _rtspurl, "", callback);
     }
     
     bool RtspPlayer::HandleRtspMsg(const char *buf, ssize_t bufsize) {
-        int MsgType = 0;
-        if (::sscanf(buf, "%*[^C]CSeq:%d", &MsgType) != 1) {
+        _LastActivity = Clock::now();
+        if (strncmp(buf, "RTSP/", 5) != 0) {
+            return HandleRtspRequest(buf, bufsize);
+        }
+        
+        int status = 0;
+        int CSeq = 0;
+        char reason[128] = {0};
+        if (::sscanf(buf, "RTSP/%*d.%*d %d %127[^\r\n]", &status, reason) < 1 || !strstr(buf, "CSeq:") ||
+            ::sscanf(strstr(buf, "CSeq:"), "CSeq:%d", &CSeq) != 1) {
             log(MODULE_TAG, "invalid rtsp message");
             return false;
         }
         
-        switch (MsgType) {
-            case RTSPOPTIONS:
-                
-                break;
-            case RTSPDESCRIBE:
-                HandleDescribe(buf, bufsize);
-                SetNextState(RtspSendVideoSetup);
-                break;
-            case RTSPVIDEO_SETUP:
-                if (HandleVideoSetup(buf, bufsize)) {
-                    SetNextState(RtspSendPlay);
-                }
-                break;
-            
-            case RTSPAUDIO_SETUP:
-                break;
-            
-            case RTSPPLAY:
-                break;
-                
-            default:
-                log(MODULE_TAG, "unknow rtsp message");
-                break;
+        auto it = _Pending.find(CSeq);
+        if (it == _Pending.end()) {
+            log(MODULE_TAG, "unknow rtsp message");
+            return false;
         }
+        RtspPending pending = it->second;
+        _Pending.erase(it);
+        _Loop->Cancel(pending.timer);
         
-        return true;
-    }
-    
-    void RtspPlayer::HandleRtspState() {
-        switch (_PlayState.load()) {
-            case RtspSendOptions:
-                log(MODULE_TAG, "rtsp send options");
-                break;
-            case RtspHandleOptions:
-                log(MODULE_TAG, "rtsp handle options");
-                break;
-            case RtspSendDescribe:
-                log(MODULE_TAG, "rtsp send describe");
-                SendDescribe(_rtspurl);
-                break;
-            case RtspHandleDescribe:
+        const char *session = strstr(buf, "Session:");
+        if (session) {
+            char id[128] = {0};
+            if (::sscanf(session, "Session:%*[ ]%127[^;\r\n]", id) == 1 || ::sscanf(session, "Session:%127[^;\r\n]", id) == 1) {
+                _RtspSessionID = id;
+            }
+            const char *timeout = strstr(session, "timeout=");
+            const char *eol = strstr(session, "\r\n");
+            int seconds = 0;
+            if (timeout && (!eol || timeout < eol) && ::sscanf(timeout, "timeout=%d", &seconds) == 1 && seconds > 0) {
+                _SessionTimeout = seconds;
+            }
+        }
+        const char *body = strstr(buf, "\r\n\r\n");
+        body = body ? body + 4 : buf + bufsize;
+        
+        bool ok = status >= 200 && status < 300;
+        switch (pending.method) {
+            case RTSPDESCRIBE:
                 log(MODULE_TAG, "rtsp handle describe");
+                if (ok) {
+                    HandleDescribe(body, buf + bufsize - body);
+                    SetNextState(RtspHandleDescribe);
+                }
                 break;
-            case RtspSendVideoSetup:
-                log(MODULE_TAG, "rtsp send video setup");
-                SendVideoSetup();
-                break;
-            case RtspHandleVideoSetup:
+            case RTSPVIDEO_SETUP:
                 log(MODULE_TAG, "rtsp handle video setup");
+                if (ok && !HandleSetup(buf, bufsize, false)) {
+                    status = 0;
+                    snprintf(reason, sizeof(reason), "rtp transport init failed");
+                } else if (ok) {
+                    SetNextState(RtspHandleVideoSetup);
+                }
                 break;
-            case RtspSendAudioSetup:
-                log(MODULE_TAG, "rtsp send audio setup");
-                break;
-            case RtspHandleAudioSetup:
+            case RTSPAUDIO_SETUP:
                 log(MODULE_TAG, "rtsp handle audio setup");
+                if (ok && !HandleSetup(buf, bufsize, true)) {
+                    status = 0;
+                    snprintf(reason, sizeof(reason), "rtp transport init failed");
+                } else if (ok) {
+                    SetNextState(RtspHandleAudioSetup);
+                }
                 break;
-            case RtspSendPlay:
-                log(MODULE_TAG, "rtsp send play");
-                SendPlay(_rtspurl);
-                break;
-            case RtspHandlePlay:
+            case RTSPPLAY:
                 log(MODULE_TAG, "rtsp handle play");
+                if (ok) {
+                    SetNextState(RtspHandlePlay);
+                    if (!_KeepaliveTimer) {
+                        Keepalive();
+                    }
+                }
                 break;
-            case RtspSendPause:
-                log(MODULE_TAG, "rtsp send pause");
-                break;
-            case RtspHandlePause:
+            case RTSPPAUSE:
                 log(MODULE_TAG, "rtsp handle pause");
+                if (ok) {
+                    SetNextState(RtspHandlePause);
+                }
                 break;
-            case RtspIdle:
+            case RTSPTEARDOWN:
+                log(MODULE_TAG, "rtsp handle teardown");
+                _RtspSessionID.clear();
+                SetNextState(RtspHandleTerminate);
                 break;
             default:
-                log(MODULE_TAG, "unkonw rtsp state");
                 break;
         }
         
-        SetNextState(RtspIdle);
+        Complete(pending.method, status, reason, pending.start, pending.callback, std::string(body, buf + bufsize - body));
+        return true;
     }
     
-#define RTP_OFFSET (12)
-#define FU_OFFSET (14)
+    void RtspPlayer::SendResponse(int CSeq, int status, const char *reason, const std::string &headers) {
+        char buf[256];
+        snprintf(buf, sizeof(buf), "RTSP/1.0 %d %s\r\nCSeq: %d\r\n", status, reason, CSeq);
+        std::string msg = buf + headers + "\r\n";
+        if (::send(_RtspSocket, msg.data(), msg.size(), MSG_NOSIGNAL) < 0) {
+            log(MODULE_TAG, "failed to send rtsp response %s", strerror(errno));
+        }
+    }
     
-    void RtspPlayer::HandleRtpMsg(const char *buf, ssize_t bufsize) {
-        char header[] = {0, 0, 0, 1};
-        struct Nalu nalu = *(struct Nalu *)(buf + RTP_OFFSET);
+    bool RtspPlayer::HandleRtspRequest(const char *buf, ssize_t bufsize) {
+        char method[32] = {0};
+        char url[1024] = {0};
+        int CSeq = 0;
+        if (::sscanf(buf, "%31s %1023s RTSP/", method, url) != 2 || !strstr(buf, "CSeq:") ||
+            ::sscanf(strstr(buf, "CSeq:"), "CSeq:%d", &CSeq) != 1) {
+            log(MODULE_TAG, "invalid rtsp request");
+            return false;
+        }
+        const char *body = strstr(buf, "\r\n\r\n");
+        body = body ? body + 4 : buf + bufsize;
         
-        if (!fp) {
-            fp = ::fopen("test.h264", "w+");
-            if (!fp) {
-                log(MODULE_TAG, "failed to oepen test.h264");
-                return;
-            }
+        char session[256] = {0};
+        if (!_RtspSessionID.empty()) {
+            snprintf(session, sizeof(session), "Session: %s;timeout=%d\r\n", _RtspSessionID.c_str(), _SessionTimeout);
         }
         
-        if (nalu.type >= 0 && nalu.type < 24) { //one nalu
-            ::fwrite(header, 4, 1, fp);
-            ::fwrite(buf + RTP_OFFSET, bufsize - RTP_OFFSET, 1, fp);
-            ::fflush(fp);
-        } else if (nalu.type == 28) { //fu-a slice
-            struct FU fu;
-            char in = buf[RTP_OFFSET + 1];
-            fu.S = in >> 7;
-            fu.E = (in >> 6) & 0x01;
-            fu.R = (in >> 5) & 0x01;
-            fu.type = in & 0x1f;
-            
-            if (fu.S == 1) {
-                char naluType = nalu.forbidden_zero_bit << 7 | nalu.nal_ref_idc << 5 | fu.type;
-                ::fwrite(header, 4, 1, fp);
-                ::fwrite(&naluType, 1, 1, fp);
-                ::fwrite(buf + FU_OFFSET, bufsize - FU_OFFSET, 1, fp);
-                ::fflush(fp);
-            } else if (fu.E == 1) {
-                ::fwrite(buf + FU_OFFSET, bufsize - FU_OFFSET, 1, fp);
-                ::fflush(fp);
-            } else {
-                ::fwrite(buf + FU_OFFSET, bufsize - FU_OFFSET, 1, fp);
-                ::fflush(fp);
-            }
+        // servers probe pulling clients too, answer the keepalives
+        if (strcmp(method, "OPTIONS") == 0) {
+            SendResponse(CSeq, 200, "OK", _Push ? "Public: " RTSP_PUSH_METHODS "\r\n" : "Public: OPTIONS, GET_PARAMETER\r\n");
+            return true;
         }
-    }
-    
-    bool RtspPlayer::Play(std::string url) {
-        char ip[256];
-        unsigned short port = 0;
-        _rtspurl = url;
-
-        if (!getIPFromUrl(url, ip, &port)) {
-            log(MODULE_TAG, "get ip and port failed");
-            return false;
+        if (strcmp(method, "GET_PARAMETER") == 0) {
+            SendResponse(CSeq, 200, "OK", session);
+            return true;
+        }
+        if (!_Push) {
+            SendResponse(CSeq, 405, "Method Not Allowed", "Allow: OPTIONS, GET_PARAMETER\r\n");
+            return true;
         }
-        ::memcpy(_rtspip, ip, sizeof(ip));
         
-        if (!NetworkInit(ip, port)) {
-            log(MODULE_TAG, "network uninitizial");
-            return false;
+        if (strcmp(method, "ANNOUNCE") == 0) {
+            log(MODULE_TAG, "rtsp handle announce %s", url);
+            if (_SdpParser) {
+                SendResponse(CSeq, 455, "Method Not Valid in This State", "");
+                return true;
+            }
+            _rtspurl = url;
+            if (_PushAnnounce && !_PushAnnounce(_rtspurl)) {
+                SendResponse(CSeq, 404, "Not Found", "");
+                return true;
+            }
+            HandleDescribe(body, buf + bufsize - body);
+            if (!_SdpParser) {
+                SendResponse(CSeq, 400, "Bad Request", "");
+                return true;
+            }
+            SetNextState(RtspHandleDescribe);
+            SendResponse(CSeq, 200, "OK", "");
+        } else if (strcmp(method, "SETUP") == 0) {
+            struct sdp_payload::sdp_media *media = _SdpParser ? FindMediaByControl(url) : nullptr;
+            if (!media) {
+                SendResponse(CSeq, _SdpParser ? 404 : 455, _SdpParser ? "Not Found" : "Method Not Valid in This State", "");
+                return true;
+            }
+            
+            bool audio = strcmp(media->info.type, "audio") == 0;
+            int *rtp = audio ? &_RtpAudioSocket : &_RtpVideoSocket;
+            int *rtcp = audio ? &_RtcpAudioSocket : &_RtcpVideoSocket;
+            unsigned short *port = audio ? &_RtpAudioPort : &_RtpVideoPort;
+            
+            // udp only, one track per kind
+            const char *transport = strstr(buf, "Transport:");
+            int client_port = 0, client_rtcp_port = 0;
+            if ((!audio && strcmp(media->info.type, "video") != 0) || *rtp >= 0 || !transport || strstr(transport, "/TCP") ||
+                !strstr(transport, "client_port=") || ::sscanf(strstr(transport, "client_port="), "client_port=%d-%d", &client_port, &client_rtcp_port) < 1) {
+                SendResponse(CSeq, 461, "Unsupported Transport", session);
+                return true;
+            }
+            if (!SetupSrtp(audio, media)) {
+                SendResponse(CSeq, 461, "Unsupported Transport", session);
+                return true;
+            }
+            if (!audio && _VideoDonl) {
+                log(MODULE_TAG, "h265 with sprop-max-don-diff, interleaved decoding order is not supported");
+                SendResponse(CSeq, 415, "Unsupported Media Type", session);
+                return true;
+            }
+            if (!RTPSocketInit(rtp, rtcp, port)) {
+                SendResponse(CSeq, 500, "Internal Server Error", session);
+                return true;
+            }
+            StartRtp(audio, client_port, client_rtcp_port);
+            
+            if (_RtspSessionID.empty()) {
+                std::random_device random;
+                snprintf(session, sizeof(session), "%08X%08X", random(), random());
+                _RtspSessionID = session;
+                snprintf(session, sizeof(session), "Session: %s;timeout=%d\r\n", _RtspSessionID.c_str(), _SessionTimeout);
+            }
+            char headers[512];
+            snprintf(headers, sizeof(headers), "Transport: %s;unicast;client_port=%d-%d;server_port=%d-%d;mode=record\r\n%s",
+                     media->info.proto, client_port, client_rtcp_port ? client_rtcp_port : client_port + 1, *port, *port + 1, session);
+            SetNextState(audio ? RtspHandleAudioSetup : RtspHandleVideoSetup);
+            SendResponse(CSeq, 200, "OK", headers);
+        } else if (strcmp(method, "RECORD") == 0) {
+            if (_RtpVideoSocket < 0 && _RtpAudioSocket < 0) {
+                SendResponse(CSeq, 455, "Method Not Valid in This State", session);
+                return true;
+            }
+            log(MODULE_TAG, "rtsp handle record");
+            SetNextState(RtspHandlePlay);
+            SendResponse(CSeq, 200, "OK", session);
+            Complete(RTSPRECORD, 200, "OK", _ConnectStart, _PushCallback);
+        } else if (strcmp(method, "SET_PARAMETER") == 0) {
+            if (body < buf + bufsize) {
+                SendResponse(CSeq, 451, "Parameter Not Understood", session);
+            } else {
+                SendResponse(CSeq, 200, "OK", session);
+            }
+        } else if (strcmp(method, "TEARDOWN") == 0) {
+            log(MODULE_TAG, "rtsp handle teardown");
+            SendResponse(CSeq, 200, "OK", session);
+            RtspCallback callback = _PushCallback;
+            _PushCallback = nullptr;
+            ReleaseResources();
+            Complete(RTSPTEARDOWN, 200, "OK", _ConnectStart, callback);
+        } else {
+            SendResponse(CSeq, 501, "Not Implemented", "");
+        }
+        return true;
+    }
+    
+    void RtspPlayer::CloseRtspSocket() {
+        if (_KeepaliveTimer) {
+            _Loop->Cancel(_KeepaliveTimer);
+            _KeepaliveTimer = 0;
+        }
+        if (_RtspSocket >= 0) {
+            _Loop->RemoveFd(_RtspSocket);
+            ::close(_RtspSocket);
+            _RtspSocket = -1;
+        }
+        _NetWorked = false;
+        _RtspRecvBuf.clear();
+    }
+    
+    void RtspPlayer::HandleRtspClosed(const char *reason) {
+        log(MODULE_TAG, "%s", reason);
+        CloseRtspSocket();
+        
+        // every outstanding request fails now instead of at its timeout
+        std::map<int, RtspPending> pending;
+        pending.swap(_Pending);
+        for (auto &it : pending) {
+            _Loop->Cancel(it.second.timer);
+            Complete(it.second.method, 0, reason, it.second.start, it.second.callback);
         }
         
-        EventInit();
+        // a pushing encoder is gone for good, free its ports now
+        if (_Push) {
+            RtspCallback callback = _PushCallback;
+            _PushCallback = nullptr;
+            ReleaseResources();
+            Complete(RTSPTEARDOWN, 0, reason, _ConnectStart, callback);
+        }
+    }
+    
+    void RtspPlayer::HandleConnected() {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        ::getsockopt(_RtspSocket, SOL_SOCKET, SO_ERROR, &err, &len);
+        
+        _Loop->Cancel(_ConnectTimer);
+        _ConnectTimer = 0;
+        RtspCallback callback = _ConnectCallback;
+        _ConnectCallback = nullptr;
+        
+        if (err) {
+            CloseRtspSocket();
+            Complete(RTSPCONNECT, 0, strerror(err), _ConnectStart, callback);
+            return;
+        }
         
-        // internal rtsp play thread
-        _PlayThreadPtr = std::make_shared<std::thread>([&] {
-            char recvbuf[2048];
+        log(MODULE_TAG, "async connect success");
+        _Loop->ModifyFd(_RtspSocket, EventRead);
+        _NetWorked = true;
+        Complete(RTSPCONNECT, 200, "OK", _ConnectStart, callback);
+    }
+    
+    // header names are case insensitive, the value follows at the offset
+    // returned, npos when no line before end has the header
+    static size_t FindHeader(const std::string &msg, size_t end, const char *name) {
+        size_t len = strlen(name);
+        for (size_t pos = msg.find("\r\n"); pos != std::string::npos && pos < end; pos = msg.find("\r\n", pos + 2)) {
+            if (strncasecmp(msg.c_str() + pos + 2, name, len) == 0) {
+                return pos + 2 + len;
+            }
+        }
+        return std::string::npos;
+    }
+    
+    void RtspPlayer::HandleRtspEvent(int) {
+        if (!_NetWorked) {
+            HandleConnected();
+            return;
+        }
+        
+        char recvbuf[2048];
+        while (true) {
+            ssize_t recvbytes = ::recv(_RtspSocket, recvbuf, sizeof(recvbuf), 0);
+            if (recvbytes == 0) {
+                HandleRtspClosed("socket peer close");
+                return;
+            } else if (recvbytes < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                HandleRtspClosed(strerror(errno));
+                return;
+            }
+            _RtspRecvBuf.append(recvbuf, recvbytes);
+            if (_RtspRecvBuf.size() > _Budget.rtspBytes) {
+                HandleRtspClosed("rtsp input over budget");
+                return;
+            }
+        }
+        
+        // tcp is a stream, cut it into messages by header end and content length
+        while (true) {
+            size_t end = _RtspRecvBuf.find("\r\n\r\n");
+            if (end == std::string::npos) {
+                break;
+            }
             
-            while (!_Terminated) {
-                FD_ZERO(&_readfd);
-                FD_ZERO(&_errorfd);
-                FD_SET(_RtspSocket, &_readfd);
-                FD_SET(_RtspSocket, &_errorfd);
-                
-                // rtp video socket has connected
-                if (_RtpVideoSocket) {
-                    FD_SET(_RtpVideoSocket, &_readfd);
+            size_t length = end + 4;
+            size_t value = FindHeader(_RtspRecvBuf, end, "Content-Length:");
+            if (value != std::string::npos) {
+                length += strtoul(_RtspRecvBuf.c_str() + value, NULL, 10);
+            }
+            if (_RtspRecvBuf.size() < length) {
+                break;
+            }
+            
+            std::string msg = _RtspRecvBuf.substr(0, length);
+            _RtspRecvBuf.erase(0, length);
+            if (!HandleRtspMsg(msg.c_str(), msg.size())) {
+                log(MODULE_TAG, "failed to handle rtsp msg");
+            }
+        }
+    }
+    
+    // one batch per loop thread, shared by all sessions on it
+    static unsigned char *RecvBatch() {
+        static thread_local std::unique_ptr<unsigned char[]> batch;
+        if (!batch) {
+            batch.reset(new unsigned char[RTP_RECV_BATCH * RTP_RECV_SIZE]);
+        }
+        return batch.get();
+    }
+    
+    void RtspPlayer::HandleRtpEvent(int sock, SrtpContext::Ptr srtp, bool rtcp, const std::function<void(const char *buf, ssize_t bufsize)> &handler) {
+        unsigned char *batch = RecvBatch();
+        struct mmsghdr msgs[RTP_RECV_BATCH];
+        struct iovec iovs[RTP_RECV_BATCH];
+        size_t sizes[RTP_RECV_BATCH];
+        
+        while (true) {
+            ::memset(msgs, 0, sizeof(msgs));
+            for (int i = 0; i < RTP_RECV_BATCH; i++) {
+                iovs[i].iov_base = batch + i * RTP_RECV_SIZE;
+                iovs[i].iov_len = RTP_RECV_SIZE;
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            int count = ::recvmmsg(sock, msgs, RTP_RECV_BATCH, MSG_DONTWAIT, NULL);
+            if (count <= 0) {
+                break;
+            }
+            
+            // decrypt in place, the whole batch back to back while the keys
+            // are hot, what fails authentication is dropped
+            for (int i = 0; i < count; i++) {
+                unsigned char *packet = batch + i * RTP_RECV_SIZE;
+                sizes[i] = msgs[i].msg_len;
+                if (srtp && !(rtcp ? srtp->UnprotectRtcp(packet, &sizes[i]) : srtp->UnprotectRtp(packet, &sizes[i]))) {
+                    sizes[i] = 0;
                 }
-                
-                int r = ::select(_Eventfd + 1, &_readfd, &_writefd, &_errorfd, NULL);
-                if (r < 0) {
-                    log(MODULE_TAG, "event error...");
-                    break;
-                } else if (r == 0) {
-                    log(MODULE_TAG, "event over time...");
+            }
+            for (int i = 0; i < count; i++) {
+                if (sizes[i] > 0) {
+                    handler((const char *)batch + i * RTP_RECV_SIZE, (ssize_t)sizes[i]);
+                }
+            }
+            _LastActivity = Clock::now();
+            
+            if (count < RTP_RECV_BATCH) {
+                break;
+            }
+        }
+    }
+    
+    void RtspPlayer::ContinueHandshake(const RtspResult &result, RtspCallback callback) {
+        RtspCallback next = [this, callback](const RtspResult &result) {
+            ContinueHandshake(result, callback);
+        };
+        
+        // a refused audio track still leaves us the video
+        if (result.method == RTSPAUDIO_SETUP && !result.Succeeded() && result.status != 0) {
+            log(MODULE_TAG, "audio setup refused %d %s, playing video only", result.status, result.reason.c_str());
+            SendPlay("0.000-", next);
+            return;
+        }
+        
+        if (!result.Succeeded()) {
+            if (callback) {
+                callback(result);
+            }
+            return;
+        }
+        
+        switch (result.method) {
+            case RTSPCONNECT:
+                SendDescribe(next);
+                break;
+            case RTSPDESCRIBE:
+                SendVideoSetup(next);
+                break;
+            case RTSPVIDEO_SETUP:
+                if (onAudioFrameGet && FindMedia("audio", nullptr)) {
+                    SendAudioSetup(next);
                 } else {
-                    if (FD_ISSET(_RtspSocket, &_readfd)) {
-                        ::memset(recvbuf, 0, sizeof(recvbuf));
-                        ssize_t recvbytes = ::recv(_RtspSocket, recvbuf, sizeof(recvbuf), 0);
-                        if (recvbytes <= 0) {
-                            log(MODULE_TAG, "socket peer close");
-                            break;
-                        } else {
-                            if (!HandleRtspMsg(recvbuf, recvbytes)) {
-                                log(MODULE_TAG, "failed to handle rtsp msg");
-                            }
-                        }
-                    }
+                    SendPlay("0.000-", next);
+                }
+                break;
+            case RTSPAUDIO_SETUP:
+                SendPlay("0.000-", next);
+                break;
+            default:
+                log(MODULE_TAG, "rtsp handshake done in %.1f ms", result.sinceConnectMs);
+                if (callback) {
+                    callback(result);
+                }
+                break;
+        }
+    }
+    
+    void RtspPlayer::AsyncConnect(std::string url, RtspCallback callback) {
+        if (!AsyncReady(RTSPCONNECT, callback)) {
+            return;
+        }
+        
+        _Loop->RunInLoop([this, url, callback] {
+            char ip[256];
+            unsigned short port = 0;
+            
+            _ConnectStart = Clock::now();
+            if (_RtspSocket >= 0) {
+                Complete(RTSPCONNECT, 0, "already connected", _ConnectStart, callback);
+                return;
+            }
+            
+            _rtspurl = url;
+            if (!getIPFromUrl(url, ip, &port)) {
+                Complete(RTSPCONNECT, 0, "invalid url", _ConnectStart, callback);
+                return;
+            }
+            ::memcpy(_rtspip, ip, sizeof(ip));
+            
+            if (!NetworkInit(ip, port)) {
+                CloseRtspSocket();
+                Complete(RTSPCONNECT, 0, "network uninitizial", _ConnectStart, callback);
+                return;
+            }
+            
+            _ConnectCallback = callback;
+            _ConnectTimer = _Loop->RunAfter(RTSP_REQUEST_TIMEOUT_MS, [this] {
+                RtspCallback callback = _ConnectCallback;
+                _ConnectCallback = nullptr;
+                _ConnectTimer = 0;
+                CloseRtspSocket();
+                Complete(RTSPCONNECT, 0, "timeout", _ConnectStart, callback);
+            });
+            EventInit();
+        });
+    }
 
-                    if (FD_ISSET(_RtpVideoSocket, &_readfd)) {
-                        socklen_t socklen = sizeof(_RtpVideoAddr);
-                        ::memset(recvbuf, 0, sizeof(recvbuf));
-                        ssize_t recvbytes = ::recvfrom(_RtpVideoSocket, recvbuf, sizeof(recvbuf), 0, (struct sockaddr *)&_RtpVideoAddr, &socklen);
-                        log(MODULE_TAG, "recv rtp video packet %ld bytes", recvbytes);
-                        
-                        HandleRtpMsg(recvbuf, recvbytes);
-                    }
-                    
-                    if (FD_ISSET(_RtspSocket, &_writefd)) {
-                        log(MODULE_TAG, "async connect success");
-                        SetNextState(RtspSendDescribe);
-                        FD_CLR(_RtspSocket, &_writefd);
-                    }
-                    
-                    if (FD_ISSET(_RtspSocket, &_errorfd)) {
-                        log(MODULE_TAG, "event error occur");
-                        break;
+    bool RtspPlayer::AsyncReady() {
+        if (_Terminated) {
+            return false;
+        }
+        if (_OwnLoop) {
+            _Loop->Start();
+        }
+        return true;
+    }
+    
+    bool RtspPlayer::AsyncReady(RtspPlayerCSeq method, const RtspCallback &callback) {
+        if (AsyncReady()) {
+            return true;
+        }
+        // a stopped player still answers, nobody waits on it forever
+        Complete(method, 0, "terminated", Clock::now(), callback);
+        return false;
+    }
+    
+    void RtspPlayer::AsyncDescribe(RtspCallback callback) {
+        if (AsyncReady(RTSPDESCRIBE, callback)) {
+            _Loop->RunInLoop([this, callback] { SendDescribe(callback); });
+        }
+    }
+    
+    void RtspPlayer::AsyncSetup(RtspCallback callback) {
+        if (AsyncReady(RTSPVIDEO_SETUP, callback)) {
+            _Loop->RunInLoop([this, callback] {
+                // video, then audio when there is a consumer for it
+                SendVideoSetup([this, callback](const RtspResult &result) {
+                    if (result.Succeeded() && onAudioFrameGet && FindMedia("audio", nullptr)) {
+                        SendAudioSetup(callback);
+                    } else if (callback) {
+                        callback(result);
                     }
+                });
+            });
+        }
+    }
+    
+    void RtspPlayer::AsyncPlay(RtspCallback callback) {
+        if (AsyncReady(RTSPPLAY, callback)) {
+            _Loop->RunInLoop([this, callback] { SendPlay("0.000-", callback); });
+        }
+    }
+    
+    void RtspPlayer::AsyncPause(RtspCallback callback) {
+        if (AsyncReady(RTSPPAUSE, callback)) {
+            _Loop->RunInLoop([this, callback] { SendPause(callback); });
+        }
+    }
+    
+    void RtspPlayer::AsyncSeek(double npt, RtspCallback callback) {
+        char range[64];
+        snprintf(range, sizeof(range), "%.3f-", npt);
+        std::string seek = range;
+        if (AsyncReady(RTSPPLAY, callback)) {
+            _Loop->RunInLoop([this, seek, callback] { SendPlay(seek.c_str(), callback); });
+        }
+    }
+    
+    void RtspPlayer::AsyncTeardown(RtspCallback callback) {
+        if (AsyncReady(RTSPTEARDOWN, callback)) {
+            _Loop->RunInLoop([this, callback] { SendTeardown(callback); });
+        }
+    }
+    
+    void RtspPlayer::AsyncGetParameter(const std::string &parameters, RtspCallback callback) {
+        if (AsyncReady(RTSPGET_PARAMETER, callback)) {
+            _Loop->RunInLoop([this, parameters, callback] {
+                SendRequest(RTSPGET_PARAMETER, "GET_PARAMETER", _rtspurl, "", callback, parameters);
+            });
+        }
+    }
+    
+    void RtspPlayer::AsyncSetParameter(const std::string &parameters, RtspCallback callback) {
+        if (AsyncReady(RTSPSET_PARAMETER, callback)) {
+            _Loop->RunInLoop([this, parameters, callback] {
+                SendRequest(RTSPSET_PARAMETER, "SET_PARAMETER", _rtspurl, "", callback, parameters);
+            });
+        }
+    }
+    
+    bool RtspPlayer::Accept(int fd, std::function<bool(const std::string &url)> announce, RtspCallback callback) {
+        if (!AsyncReady()) {
+            ::close(fd);
+            return false;
+        }
+        
+        _Loop->RunInLoop([this, fd, announce, callback] {
+            if (_RtspSocket >= 0) {
+                log(MODULE_TAG, "player already has a connection");
+                ::close(fd);
+                return;
+            }
+            
+            int ul = true;
+            struct sockaddr_in peer;
+            socklen_t len = sizeof(peer);
+            if (::ioctl(fd, FIONBIO, &ul) < 0 || ::getpeername(fd, (struct sockaddr *)&peer, &len) < 0) {
+                log(MODULE_TAG, "accepted socket unusable %s", strerror(errno));
+                ::close(fd);
+                return;
+            }
+            ::inet_ntop(AF_INET, &peer.sin_addr, _rtspip, sizeof(_rtspip));
+            
+            _Push = true;
+            _PushAnnounce = announce;
+            _PushCallback = callback;
+            _RtspSocket = fd;
+            _NetWorked = true;
+            _ConnectStart = Clock::now();
+            _LastActivity = _ConnectStart;
+            _Loop->AddFd(_RtspSocket, EventRead, [this](int events) {
+                HandleRtspEvent(events);
+            });
+            // a silent encoder still gets timed out
+            Keepalive();
+        });
+        return true;
+    }
+    
+    void RtspPlayer::Keepalive() {
+        _KeepaliveTimer = _Loop->RunAfter(_SessionTimeout * 1000 / 2, [this] {
+            _KeepaliveTimer = 0;
+            if (_Push) {
+                // the encoder keeps the session alive, we only watch it
+                if (Clock::now() - _LastActivity > std::chrono::seconds(_SessionTimeout)) {
+                    HandleRtspClosed("push session timeout");
+                    return;
+                }
+            } else if (_NetWorked && !_RtspSessionID.empty()) {
+                if (_KeepaliveOptions) {
+                    SendRequest(RTSPOPTIONS, "OPTIONS", _rtspurl, "", nullptr);
+                } else {
+                    SendRequest(RTSPGET_PARAMETER, "GET_PARAMETER", _rtspurl, "", [this](const RtspResult &result) {
+                        // older servers only know OPTIONS
+                        if (result.status >= 400) {
+                            _KeepaliveOptions = true;
+                        }
+                    });
                 }
-                
-                HandleRtspState();
             }
+            Keepalive();
+        });
+    }
+    
+#define RTP_OFFSET (12)
+#define FU_OFFSET (2)
+#define STAP_OFFSET (1)
+    
+    void RtspPlayer::SetVideoFrameCallback(std::function<void(const MediaFrame &frame)> callback) {
+        onVideoFrameGet = callback;
+    }
+    
+    void RtspPlayer::SetKeyframeCallback(int intervalMs, std::function<void(const MediaFrame &frame)> callback) {
+        _KeyframeIntervalUs = (int64_t)std::max(intervalMs, 0) * 1000;
+        onKeyframeGet = callback;
+    }
+    
+    void RtspPlayer::SetAudioFrameCallback(std::function<void(const MediaFrame &frame)> callback) {
+        onAudioFrameGet = callback;
+    }
+    
+    void RtspPlayer::SetFrameRing(FrameRing::Ptr ring) {
+        _FrameRing = ring;
+    }
+    
+    void RtspPlayer::SetTransport(RtspTransport transport) {
+        _Transport = transport;
+    }
+    
+    void RtspPlayer::SetLowLatency(int maxLatencyMs) {
+        if (maxLatencyMs <= 0) {
+            _LatencyQueue.reset();
+            return;
+        }
+        
+        _LatencyQueue = std::make_shared<LatencyQueue>(maxLatencyMs, [this](const MediaFrame &frame) {
+            if (onVideoFrameGet) {
+                TRACE_FRAME(_LocalSsrc, frame.timestamp, TraceCallback);
+                onVideoFrameGet(frame);
+                TRACE_FRAME(_LocalSsrc, frame.timestamp, TraceDone);
+            }
+        }, _Loop->Cpu(), _Budget.queueBytes, _Budget.stackBytes);
+    }
+    
+    void RtspPlayer::SetMemoryBudget(const MemoryBudget &budget) {
+        _Budget = budget;
+        if (_OwnLoop) {
+            _Loop->SetStackSize(budget.stackBytes);
+        }
+    }
+    
+    MemoryStats RtspPlayer::GetMemoryStats() {
+        MemoryStats stats = MemoryStats();
+        _Loop->RunInLoopSync([this, &stats] {
+            stats.frameBuffer = _FrameBuf.capacity() + _KeyframeBuf.capacity();
+            std::shared_ptr<JitterBuffer> jitter = std::atomic_load(&_Jitter);
+            if (jitter) {
+                stats.jitter = jitter->MemoryBytes();
+            }
+            if (_LatencyQueue) {
+                stats.queue = _LatencyQueue->MemoryBytes();
+            }
+            
+            stats.rtsp = _RtspRecvBuf.capacity() + _SdpBytes;
+            {
+                std::lock_guard<std::mutex> lock(_InfoLock);
+                stats.rtsp += _VideoRtpmap.capacity() + _VideoFmtp.capacity() + _VideoFramerate.capacity() + _InbandSps.capacity() +
+                    _InbandPps.capacity() + _StreamInfo.parameterSets.capacity();
+            }
+            stats.total = stats.frameBuffer + stats.jitter + stats.queue + stats.rtsp;
             
-            fclose(fp);
+            int sockets[] = {_RtpVideoSocket, _RtcpVideoSocket, _RtpAudioSocket, _RtcpAudioSocket};
+            for (int sock : sockets) {
+                int rcvbuf = 0;
+                socklen_t len = sizeof(rcvbuf);
+                if (sock >= 0 && ::getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &len) == 0) {
+                    stats.socketBuffers += rcvbuf;
+                }
+            }
         });
+        return stats;
+    }
+    
+    void RtspPlayer::SetRetransmission(int budgetMs) {
+        _RetransmitBudgetMs = budgetMs;
+    }
+    
+    JitterStats RtspPlayer::GetJitterStats() const {
+        JitterStats stats = JitterStats();
+        std::shared_ptr<JitterBuffer> jitter = std::atomic_load(&_Jitter);
+        if (jitter) {
+            stats.received = jitter->Received();
+            stats.recovered = jitter->Recovered();
+            stats.lost = jitter->Lost();
+            stats.nacked = jitter->Nacked();
+        }
+        return stats;
+    }
+    
+    StreamStats RtspPlayer::GetStreamStats() const {
+        return _Analyzer.GetStats();
+    }
+    
+    LatencyStats RtspPlayer::GetLatencyStats() const {
+        LatencyStats stats = LatencyStats();
+        if (_LatencyQueue) {
+            stats = _LatencyQueue->GetStats();
+        }
+        return stats;
+    }
+    
+    bool RtspPlayer::FrameFits(size_t size) {
+        size_t needed = _FrameBuf.size() + size;
+        if (needed > _Budget.frameBytes) {
+            if (!_FrameDamaged) {
+                log(MODULE_TAG, "access unit over %zu bytes, dropped", _Budget.frameBytes);
+            }
+            _FrameDamaged = true;
+            return false;
+        }
         
+        // grow like the vector would, but never past the budget
+        if (needed > _FrameBuf.capacity()) {
+            _FrameBuf.reserve(std::min(std::max(needed, _FrameBuf.capacity() * 2), _Budget.frameBytes));
+        }
         return true;
     }
     
-    void RtspPlayer::Stop() {
-        _Terminated = true;
+    // h265 types
+#define H265_NAL_IRAP_FIRST (16)
+#define H265_NAL_IRAP_LAST (21)
+#define H265_NAL_VPS (32)
+#define H265_NAL_SPS (33)
+#define H265_NAL_PPS (34)
+    
+    void RtspPlayer::AppendNalu(const unsigned char *nalu, size_t size) {
+        const unsigned char header[] = {0, 0, 0, 1};
+        bool h265 = _VideoCodec == VideoCodecH265;
+        uint8_t type = NaluType(_VideoCodec, nalu);
+        // a fragmented nal unit only has its header here, a set counts
+        // when it came whole
+        bool whole = size > (h265 ? 2u : 1u);
+        
+        _Analyzer.AddNalu(type);
+        // h265 has no nal_ref_idc, the even vcl types up to 14 are the
+        // sub-layer non-reference ones
+        if (h265 ? type < H265_NAL_VPS && !(type <= 14 && type % 2 == 0) : (nalu[0] & 0x60) != 0) {
+            _FrameRef = true;
+        }
+        if (!FrameFits(sizeof(header) + size)) {
+            return;
+        }
+        if (h265 ? type >= H265_NAL_IRAP_FIRST && type <= H265_NAL_IRAP_LAST : type == 5) {
+            _FrameKey = true;
+        } else if (whole && h265 && type == H265_NAL_VPS) {
+            _FrameVps = true;
+            _InbandVps.assign(nalu, nalu + size);
+        } else if (whole && type == (h265 ? H265_NAL_SPS : 7)) {
+            _FrameSps = true;
+            if (size != _InbandSps.size() || memcmp(nalu, _InbandSps.data(), size) != 0) {
+                // new or changed sps, stream info is parsed again on next request
+                std::lock_guard<std::mutex> lock(_InfoLock);
+                _InbandSps.assign(nalu, nalu + size);
+                _InfoParsed = false;
+            }
+        } else if (whole && type == (h265 ? H265_NAL_PPS : 8)) {
+            _FramePps = true;
+            _InbandPps.assign(nalu, nalu + size);
+        }
+        _FrameBuf.insert(_FrameBuf.end(), header, header + sizeof(header));
+        _FrameBuf.insert(_FrameBuf.end(), nalu, nalu + size);
+    }
+    
+    void RtspPlayer::DeliverVideoFrame() {
+        if (_FrameBuf.empty()) {
+            _FrameDamaged = false;
+            return;
+        }
+        
+        TRACE_FRAME(_LocalSsrc, _FrameTimestamp, TraceReassembled);
+        _Analyzer.AddFrame(_FrameBuf.size(), _FrameKey, _FrameDamaged, _FrameArrival);
+        MediaFrame frame;
+        frame.data = _FrameBuf.data();
+        frame.size = _FrameBuf.size();
+        frame.timestamp = _FrameTimestamp;
+        frame.pts = _VideoClock.Pts(_FrameExtended);
+        frame.wallclock = _VideoClock.WallClock(_FrameExtended);
+        frame.keyframe = _FrameKey;
+        frame.codec = _VideoCodec;
+        
+        // a frame with a hole would decode to garbage, never hand it out
+        if (_FrameRing && !_FrameDamaged) {
+            _FrameRing->Publish(frame.data, frame.size, frame.timestamp, frame.pts, frame.wallclock, frame.keyframe ? FrameRingKeyFrame : 0);
+        }
+        
+        if (onKeyframeGet && frame.keyframe && !_FrameDamaged) {
+            TapKeyframe(frame);
+        }
+        
+        if (_LatencyQueue) {
+            _LatencyQueue->Push(frame, _FrameRef, _FrameDamaged, _FrameArrival);
+        } else if (onVideoFrameGet && !_FrameDamaged) {
+            TRACE_FRAME(_LocalSsrc, frame.timestamp, TraceCallback);
+            onVideoFrameGet(frame);
+            TRACE_FRAME(_LocalSsrc, frame.timestamp, TraceDone);
+        }
+        
+        _FrameBuf.clear();
+        _FrameKey = false;
+        _FrameRef = false;
+        _FrameVps = false;
+        _FrameSps = false;
+        _FramePps = false;
+        _FrameDamaged = false;
+    }
+    
+    void RtspPlayer::TapKeyframe(const MediaFrame &frame) {
+        // stream time, a replay thins out the same at any speed. pts going
+        // back means the clock started over
+        if (_KeyframeTapped && frame.pts >= _KeyframePts && frame.pts - _KeyframePts < _KeyframeIntervalUs) {
+            return;
+        }
+        bool h265 = frame.codec == VideoCodecH265;
+        if (_FrameSps && _FramePps && (_FrameVps || !h265)) {
+            _KeyframeTapped = true;
+            _KeyframePts = frame.pts;
+            onKeyframeGet(frame);
+            return;
+        }
+        
+        // sets in front of the idr, the in-band ones when the stream sent
+        // both so far, else what the sdp announced
+        const unsigned char header[] = {0, 0, 0, 1};
+        _KeyframeBuf.clear();
+        if (!_InbandSps.empty() && !_InbandPps.empty() && (!_InbandVps.empty() || !h265)) {
+            if (h265) {
+                _KeyframeBuf.insert(_KeyframeBuf.end(), header, header + sizeof(header));
+                _KeyframeBuf.insert(_KeyframeBuf.end(), _InbandVps.begin(), _InbandVps.end());
+            }
+            _KeyframeBuf.insert(_KeyframeBuf.end(), header, header + sizeof(header));
+            _KeyframeBuf.insert(_KeyframeBuf.end(), _InbandSps.begin(), _InbandSps.end());
+            _KeyframeBuf.insert(_KeyframeBuf.end(), header, header + sizeof(header));
+            _KeyframeBuf.insert(_KeyframeBuf.end(), _InbandPps.begin(), _InbandPps.end());
+        } else {
+            std::lock_guard<std::mutex> lock(_InfoLock);
+            if (!_InfoParsed) {
+                ParseStreamInfo();
+            }
+            _KeyframeBuf.assign(_StreamInfo.parameterSets.begin(), _StreamInfo.parameterSets.end());
+        }
+        if (_KeyframeBuf.empty()) {
+            // nothing a decoder could start from, try the next idr
+            return;
+        }
+        _KeyframeBuf.insert(_KeyframeBuf.end(), frame.data, frame.data + frame.size);
+        
+        _KeyframeTapped = true;
+        _KeyframePts = frame.pts;
+        MediaFrame keyframe = frame;
+        keyframe.data = _KeyframeBuf.data();
+        keyframe.size = _KeyframeBuf.size();
+        onKeyframeGet(keyframe);
+    }
+    
+    // payload bounds of an rtp packet, false when there is none
+    static bool GetRtpPayload(const unsigned char *packet, ssize_t bufsize, size_t *offset, size_t *end) {
+        if (bufsize <= RTP_OFFSET || (packet[0] >> 6) != 2) {
+            return false;
+        }
+        
+        // skip csrc list and header extension, strip padding
+        *offset = RTP_OFFSET + (packet[0] & 0x0f) * 4;
+        *end = (size_t)bufsize;
+        if ((packet[0] & 0x10) && *offset + 4 <= *end) {
+            *offset += 4 + ((packet[*offset + 2] << 8 | packet[*offset + 3]) * 4);
+        }
+        if (packet[0] & 0x20) {
+            *end = packet[*end - 1] < *end ? *end - packet[*end - 1] : 0;
+        }
+        return *offset < *end;
+    }
+    
+    static uint32_t GetRtpTimestamp(const unsigned char *packet) {
+        return (uint32_t)packet[4] << 24 | packet[5] << 16 | packet[6] << 8 | packet[7];
+    }
+    
+    void RtspPlayer::HandleRtpPacket(const char *buf, ssize_t bufsize) {
+        const unsigned char *packet = (const unsigned char *)buf;
+        size_t offset = 0, end = 0;
+        if (!GetRtpPayload(packet, bufsize, &offset, &end)) {
+            return;
+        }
+        
+        std::shared_ptr<JitterBuffer> jitter = std::atomic_load(&_Jitter);
+        if (_RtxPayloadType < 0 || (packet[1] & 0x7f) != _RtxPayloadType) {
+            _VideoSsrc = (uint32_t)packet[8] << 24 | packet[9] << 16 | packet[10] << 8 | packet[11];
+            if (jitter) {
+                jitter->Insert(buf, bufsize);
+            } else {
+                HandleRtpMsg(buf, bufsize);
+            }
+            return;
+        }
+        
+        // rfc 4588: the original sequence number leads the original payload,
+        // rebuild the packet the media stream lost
+        if (end - offset < 2 || !jitter) {
+            return;
+        }
+        unsigned char original[2048];
+        if (end - 2 > sizeof(original)) {
+            return;
+        }
+        ::memcpy(original, packet, offset);
+        original[0] &= ~0x20;
+        original[1] = (packet[1] & 0x80) | (_RtxApt >= 0 ? _RtxApt : packet[1] & 0x7f);
+        original[2] = packet[offset];
+        original[3] = packet[offset + 1];
+        original[8] = _VideoSsrc >> 24;
+        original[9] = _VideoSsrc >> 16;
+        original[10] = _VideoSsrc >> 8;
+        original[11] = _VideoSsrc;
+        ::memcpy(original + offset, packet + offset + 2, end - offset - 2);
+        jitter->Insert((const char *)original, (ssize_t)(end - 2));
+    }
+    
+#define RTCP_RR (201)
+#define RTCP_RTPFB (205)
+#define RTCP_NACK_FMT (1)
+#define RTCP_NACK_SIZE (1024)
+    
+    void RtspPlayer::SendNack(const std::vector<uint16_t> &seqs) {
+        if (_RtcpVideoSocket < 0 || _RtcpVideoAddr.sin_port == 0 || seqs.empty()) {
+            return;
+        }
+        
+        // compound packet: empty receiver report, then one generic nack
+        // (rfc 4585) with a pid/blp pair per 17 sequence numbers
+        unsigned char buf[RTCP_NACK_SIZE + SRTCP_SPACE];
+        size_t pos = 0;
+        auto put32 = [&buf, &pos](uint32_t v) {
+            buf[pos++] = v >> 24;
+            buf[pos++] = v >> 16;
+            buf[pos++] = v >> 8;
+            buf[pos++] = v;
+        };
+        
+        put32(0x80000000 | RTCP_RR << 16 | 1);
+        put32(_LocalSsrc);
+        
+        size_t nack = pos;
+        put32(0);
+        put32(_LocalSsrc);
+        put32(_VideoSsrc);
+        for (size_t i = 0; i < seqs.size() && pos + 4 <= RTCP_NACK_SIZE; ) {
+            uint16_t pid = seqs[i++];
+            uint16_t blp = 0;
+            while (i < seqs.size() && (uint16_t)(seqs[i] - pid) >= 1 && (uint16_t)(seqs[i] - pid) <= 16) {
+                blp |= 1 << ((uint16_t)(seqs[i] - pid) - 1);
+                i++;
+            }
+            put32((uint32_t)pid << 16 | blp);
+        }
+        size_t words = (pos - nack) / 4 - 1;
+        buf[nack] = 0x80 | RTCP_NACK_FMT;
+        buf[nack + 1] = RTCP_RTPFB;
+        buf[nack + 2] = words >> 8;
+        buf[nack + 3] = words;
+        
+        if (_SrtpVideo && !_SrtpVideo->ProtectRtcp(buf, &pos)) {
+            return;
+        }
+        ::sendto(_RtcpVideoSocket, buf, pos, 0, (const struct sockaddr *)&_RtcpVideoAddr, (socklen_t)sizeof(_RtcpVideoAddr));
+    }
+    
+    void RtspPlayer::HandleRtpMsg(const char *buf, ssize_t bufsize) {
+        const unsigned char *packet = (const unsigned char *)buf;
+        size_t offset = 0, end = 0;
+        if (!GetRtpPayload(packet, bufsize, &offset, &end)) {
+            return;
+        }
+        
+        bool marker = packet[1] >> 7;
+        uint32_t timestamp = GetRtpTimestamp(packet);
+        
+        // the lost packets may belong to either side of a frame boundary
+        uint16_t seq = packet[2] << 8 | packet[3];
+        bool gap = _HasRtpSeq && seq != (uint16_t)(_RtpSeq + 1);
+        _HasRtpSeq = true;
+        _RtpSeq = seq;
+        
+        // a new timestamp starts a new access unit even if the marker got lost
+        if (!_FrameBuf.empty() && timestamp != _FrameTimestamp) {
+            _FrameDamaged = _FrameDamaged || gap;
+            DeliverVideoFrame();
+        }
+        if (_FrameBuf.empty()) {
+            _FrameArrival = Clock::now();
+            TRACE_FRAME_AT(_LocalSsrc, timestamp, TraceArrival, _FrameArrival);
+        }
+        _FrameDamaged = _FrameDamaged || gap;
+        _FrameTimestamp = timestamp;
+        _FrameExtended = _VideoClock.Extend(timestamp);
+        
+        const unsigned char *payload = packet + offset;
+        size_t payloadsize = end - offset;
+        struct Nalu nalu = *(struct Nalu *)payload;
+        
+        if (payloadsize > 3 && payload[0] == 0 && payload[1] == 0 && (payload[2] == 1 || (payload[2] == 0 && payload[3] == 1))) {
+            // some cameras packetize whole annex-b chunks, split them again
+            ForEachNalu(payload, payloadsize, [this](const unsigned char *data, size_t size) {
+                AppendNalu(data, size);
+            });
+        } else if (_VideoCodec == VideoCodecH265) {
+            HandleH265Payload(payload, payloadsize);
+        } else if (nalu.type > 0 && nalu.type < 24) { //one nalu
+            AppendNalu(payload, payloadsize);
+        } else if (nalu.type == 24) { //stap-a
+            size_t pos = STAP_OFFSET;
+            while (pos + 2 < payloadsize) {
+                size_t size = payload[pos] << 8 | payload[pos + 1];
+                pos += 2;
+                if (size == 0 || pos + size > payloadsize) {
+                    break;
+                }
+                AppendNalu(payload + pos, size);
+                pos += size;
+            }
+        } else if (nalu.type == 28 && payloadsize > FU_OFFSET) { //fu-a slice
+            struct FU fu;
+            char in = payload[1];
+            fu.S = in >> 7;
+            fu.E = (in >> 6) & 0x01;
+            fu.R = (in >> 5) & 0x01;
+            fu.type = in & 0x1f;
+            
+            if (fu.S == 1) {
+                unsigned char naluType = nalu.forbidden_zero_bit << 7 | nalu.nal_ref_idc << 5 | fu.type;
+                AppendNalu(&naluType, 1);
+            }
+            if (FrameFits(payloadsize - FU_OFFSET)) {
+                _FrameBuf.insert(_FrameBuf.end(), payload + FU_OFFSET, payload + payloadsize);
+            }
+        }
+        
+        if (marker) {
+            DeliverVideoFrame();
+        }
+    }
+    
+    // rfc 7798 without decoding order numbers, the setup refuses streams
+    // that carry them
+#define H265_AP (48)
+#define H265_FU (49)
+#define H265_PAYLOAD_OFFSET (2)
+#define H265_FU_OFFSET (3)
+    
+    void RtspPlayer::HandleH265Payload(const unsigned char *payload, size_t size) {
+        if (size <= H265_PAYLOAD_OFFSET) {
+            return;
+        }
+        uint8_t type = NaluType(VideoCodecH265, payload);
+        
+        if (type < H265_AP) { //one nalu
+            AppendNalu(payload, size);
+        } else if (type == H265_AP) { //aggregation packet
+            size_t pos = H265_PAYLOAD_OFFSET;
+            while (pos + 2 < size) {
+                size_t length = payload[pos] << 8 | payload[pos + 1];
+                pos += 2;
+                if (length < 2 || pos + length > size) {
+                    break;
+                }
+                AppendNalu(payload + pos, length);
+                pos += length;
+            }
+        } else if (type == H265_FU && size > H265_FU_OFFSET) { //fragmentation unit
+            if (payload[2] & 0x80) {
+                // the payload header with the fragment's type is the nal header
+                unsigned char header[2] = {(unsigned char)((payload[0] & 0x81) | (payload[2] & 0x3f) << 1), payload[1]};
+                AppendNalu(header, sizeof(header));
+            }
+            if (FrameFits(size - H265_FU_OFFSET)) {
+                _FrameBuf.insert(_FrameBuf.end(), payload + H265_FU_OFFSET, payload + size);
+            }
+        }
+    }
+    
+    void RtspPlayer::HandleAudioRtpMsg(const char *buf, ssize_t bufsize) {
+        const unsigned char *packet = (const unsigned char *)buf;
+        size_t offset = 0, end = 0;
+        if (!onAudioFrameGet || !GetRtpPayload(packet, bufsize, &offset, &end)) {
+            return;
+        }
+        
+        int64_t extended = _AudioClock.Extend(GetRtpTimestamp(packet));
+        
+        MediaFrame frame;
+        frame.data = packet + offset;
+        frame.size = end - offset;
+        frame.timestamp = GetRtpTimestamp(packet);
+        frame.pts = _AudioClock.Pts(extended);
+        frame.wallclock = _AudioClock.WallClock(extended);
+        frame.keyframe = true;
+        frame.codec = VideoCodecUnknown;
+        onAudioFrameGet(frame);
+    }
+    
+#define RTCP_SR (200)
+    
+    void RtspPlayer::HandleRtcpMsg(const char *buf, ssize_t bufsize, MediaClock *clock) {
+        const unsigned char *packet = (const unsigned char *)buf;
+        size_t pos = 0;
+        
+        // compound packet, walk every report for the sender report
+        while (pos + 4 <= (size_t)bufsize && (packet[pos] >> 6) == 2) {
+            size_t length = ((packet[pos + 2] << 8 | packet[pos + 3]) + 1) * 4;
+            if (pos + length > (size_t)bufsize) {
+                break;
+            }
+            
+            if (packet[pos + 1] == RTCP_SR && length >= 28) {
+                const unsigned char *sr = packet + pos + 8;
+                uint64_t ntp = (uint64_t)GetRtpTimestamp(sr - 4) << 32 | GetRtpTimestamp(sr);
+                clock->OnSenderReport(ntp, GetRtpTimestamp(sr + 4));
+            }
+            pos += length;
+        }
+    }
+    
+    bool RtspPlayer::Play(std::string url, RtspCallback callback) {
+        char ip[256];
+        unsigned short port = 0;
+        
+        if (!getIPFromUrl(url, ip, &port)) {
+            log(MODULE_TAG, "get ip and port failed");
+            return false;
+        }
+        
+        AsyncConnect(url, [this, callback](const RtspResult &result) {
+            ContinueHandshake(result, callback);
+        });
+        
+        return true;
+    }
+    
+    bool RtspPlayer::PlayCapture(const std::string &path, double speed, std::function<void()> done, unsigned short port, const std::string &sdp) {
+        CaptureReader::Ptr reader = std::make_shared<CaptureReader>();
+        if (!reader->Open(path) || !AsyncReady()) {
+            return false;
+        }
+        TRACE_SESSION(_LocalSsrc, path);
+        
+        _Loop->RunInLoop([this, reader, speed, done, port, sdp] {
+            if (_Capture || _RtspSocket >= 0) {
+                // the caller still waits for its done
+                log(MODULE_TAG, "capture replay needs an idle player");
+                if (done) {
+                    done();
+                }
+                return;
+            }
+            if (!sdp.empty()) {
+                HandleDescribe(sdp.data(), (ssize_t)sdp.size());
+            }
+            
+            _Capture = reader;
+            _CaptureHeld = false;
+            _CaptureSpeed = speed;
+            _CapturePort = port;
+            _CaptureStart = Clock::now();
+            _CaptureDone = done;
+            _VideoClock.Reset();
+            _HasRtpSeq = false;
+            
+            // nothing to nack, holes only wait for reordered packets. at full
+            // speed wall time is meaningless, so they wait for the window
+            std::shared_ptr<JitterBuffer> jitter;
+            if (_RetransmitBudgetMs > 0) {
+                int budget = speed > 0 ? (int)(_RetransmitBudgetMs / speed) : -1;
+                jitter = OnLoop(_Loop, new JitterBuffer(_Loop.get(), budget, _Budget.jitterPackets, [this](const char *buf, ssize_t bufsize) {
+                    HandleRtpMsg(buf, bufsize);
+                }, nullptr));
+            }
+            std::atomic_store(&_Jitter, jitter);
+            ReplayCapture();
+        });
+        
+        return true;
+    }
+    
+    void RtspPlayer::ReplayCapture() {
+        std::weak_ptr<CaptureReader> reader = _Capture;
+        _CaptureTimer = 0;
+        
+        for (int i = 0; i < CAPTURE_BATCH_PACKETS; i++) {
+            if (!_CaptureHeld && !_Capture->Next(&_CapturePacket)) {
+                EndCapture();
+                return;
+            }
+            _CaptureHeld = false;
+            
+            if (_CaptureSpeed > 0) {
+                Clock::time_point due = _CaptureStart + std::chrono::microseconds((int64_t)(_CapturePacket.timeUs / _CaptureSpeed));
+                Clock::time_point now = Clock::now();
+                if (due > now) {
+                    _CaptureHeld = true;
+                    _CaptureTimer = _Loop->RunAfter((int)std::chrono::duration_cast<std::chrono::milliseconds>(due - now).count(), [this] {
+                        ReplayCapture();
+                    });
+                    return;
+                }
+            }
+            HandleCapturePacket(_CapturePacket);
+        }
+        
+        // give the loop back between batches so stop and other sessions get a
+        // turn, the reader goes away with ReleaseResources
+        _Loop->Post([this, reader] {
+            if (!reader.expired()) {
+                ReplayCapture();
+            }
+        });
+    }
+    
+    void RtspPlayer::HandleCapturePacket(const CapturePacket &packet) {
+        if (packet.size < 8 || (packet.data[0] >> 6) != 2) {
+            return;
+        }
+        
+        // rtpdump holds a single session, a pcap may hold anything
+        if (_Capture->Format() == CaptureFormatPcap) {
+            // audio may come first, lock onto the video payload type when
+            // the sdp told it
+            if (!_CapturePort && !packet.rtcp && (_VideoPayloadType < 0 || (packet.data[1] & 0x7f) == _VideoPayloadType)) {
+                _CapturePort = packet.port;
+            }
+            if (!_CapturePort || (packet.port != _CapturePort && packet.port != _CapturePort + 1)) {
+                return;
+            }
+        }
+        
+        if (packet.rtcp) {
+            HandleRtcpMsg((const char *)packet.data, (ssize_t)packet.size, &_VideoClock);
+        } else {
+            HandleRtpPacket((const char *)packet.data, (ssize_t)packet.size);
+        }
+    }
+    
+    void RtspPlayer::EndCapture() {
+        std::shared_ptr<JitterBuffer> jitter = std::atomic_load(&_Jitter);
+        if (jitter) {
+            jitter->Flush();
+        }
+        
+        std::function<void()> done = _CaptureDone;
+        _CaptureDone = nullptr;
+        _Capture.reset();
+        if (done) {
+            done();
+        }
+    }
+    
+    void RtspPlayer::ReleaseResources() {
+        if (_ConnectTimer) {
+            _Loop->Cancel(_ConnectTimer);
+            _ConnectTimer = 0;
+        }
+        
+        // complete whatever is outstanding so awaiting callers resume
+        std::map<int, RtspPending> pending;
+        pending.swap(_Pending);
+        for (auto &it : pending) {
+            _Loop->Cancel(it.second.timer);
+            Complete(it.second.method, 0, "stopped", it.second.start, it.second.callback);
+        }
+        if (_ConnectCallback) {
+            RtspCallback callback = _ConnectCallback;
+            _ConnectCallback = nullptr;
+            Complete(RTSPCONNECT, 0, "stopped", _ConnectStart, callback);
+        }
+        if (_PushCallback) {
+            RtspCallback callback = _PushCallback;
+            _PushCallback = nullptr;
+            Complete(RTSPTEARDOWN, 0, "stopped", _ConnectStart, callback);
+        }
+        
+        CloseRtspSocket();
+        if (_CaptureTimer) {
+            _Loop->Cancel(_CaptureTimer);
+            _CaptureTimer = 0;
+        }
+        _Capture.reset();
+        _CaptureDone = nullptr;
+        if (_RtpVideoSocket >= 0) {
+            _Loop->RemoveFd(_RtpVideoSocket);
+            ::close(_RtpVideoSocket);
+            _RtpVideoSocket = -1;
+        }
+        if (_RtcpVideoSocket >= 0) {
+            _Loop->RemoveFd(_RtcpVideoSocket);
+            ::close(_RtcpVideoSocket);
+            _RtcpVideoSocket = -1;
+        }
+        if (_RtpAudioSocket >= 0) {
+            _Loop->RemoveFd(_RtpAudioSocket);
+            ::close(_RtpAudioSocket);
+            _RtpAudioSocket = -1;
+        }
+        if (_RtcpAudioSocket >= 0) {
+            _Loop->RemoveFd(_RtcpAudioSocket);
+            ::close(_RtcpAudioSocket);
+            _RtcpAudioSocket = -1;
+        }
+        if (_McastGroup) {
+            _McastGroup->Unsubscribe(this);
+            _McastGroup.reset();
+        }
+        if (_McastAudioGroup) {
+            _McastAudioGroup->Unsubscribe(this);
+            _McastAudioGroup.reset();
+        }
+        _VideoClock.Reset();
+        _AudioClock.Reset();
+        std::atomic_store(&_Jitter, std::shared_ptr<JitterBuffer>());
+        _SrtpVideo.reset();
+        _SrtpAudio.reset();
+        ::memset(&_RtcpVideoAddr, 0, sizeof(_RtcpVideoAddr));
+        _HasRtpSeq = false;
+        
+        if (_SdpParser) {
+            sdp_destroy(_SdpParser);
+            _SdpParser = nullptr;
+        }
+        _SdpBytes = 0;
+        _RtspSessionID.clear();
+        _Push = false;
+        _PushAnnounce = nullptr;
+        std::string().swap(_RtspRecvBuf);
+        std::vector<unsigned char>().swap(_FrameBuf);
+        std::vector<unsigned char>().swap(_KeyframeBuf);
+        _KeyframeTapped = false;
+        _Analyzer.Reset();
+    }
+    
+    void RtspPlayer::AsyncStop(std::function<void()> done) {
+        if (_Terminated.exchange(true)) {
+            if (done) {
+                done();
+            }
+            return;
+        }
         _PlayState = RtspTurnOff;
-        _PlayThreadPtr->join();
+        
+        _Loop->RunInLoop([this, done] {
+            if (!_NetWorked || _RtspSessionID.empty() || _Push) {
+                ReleaseResources();
+                if (done) {
+                    done();
+                }
+                return;
+            }
+            
+            // TEARDOWN so the server drops the session now instead of at its
+            // timeout, but never wait on an unresponsive server for long
+            std::shared_ptr<bool> finished = std::make_shared<bool>(false);
+            std::function<void()> finish = [this, done, finished] {
+                if (*finished) {
+                    return;
+                }
+                *finished = true;
+                ReleaseResources();
+                if (done) {
+                    done();
+                }
+            };
+            
+            uint64_t timer = _Loop->RunAfter(RTSP_TEARDOWN_TIMEOUT_MS, finish);
+            SendTeardown([this, finish, timer](const RtspResult &) {
+                _Loop->Cancel(timer);
+                finish();
+            });
+        });
+    }
+    
+    void RtspPlayer::Stop() {
+        if (!_Loop->IsInLoopThread()) {
+            std::promise<void> stopped;
+            AsyncStop([&stopped] {
+                stopped.set_value();
+            });
+            stopped.get_future().wait();
+        } else if (!_Terminated.exchange(true)) {
+            // called from one of our callbacks, the loop can't deliver the
+            // teardown reply while we block it, so fire and forget
+            _PlayState = RtspTurnOff;
+            if (_NetWorked && !_RtspSessionID.empty() && !_Push) {
+                SendTeardown(nullptr);
+            }
+            ReleaseResources();
+        }
+        
+        if (_OwnLoop) {
+            _Loop->Stop();
+        }
     }
 }
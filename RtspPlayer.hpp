@@ -10,12 +10,27 @@
 #define RtspPlayer_hpp
 
 #include <iostream>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <vector>
+#include <string.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <sys/ioctl.h>
-#include <sys/select.h>
+#include "CaptureReader.hpp"
+#include "EventLoop.hpp"
+#include "FrameRing.hpp"
+#include "JitterBuffer.hpp"
+#include "MediaClock.hpp"
+#include "MulticastGroup.hpp"
+#include "NalParser.hpp"
+#include "Srtp.hpp"
+#include "StreamAnalyzer.hpp"
 
 extern "C" {
 #include "sdp.h"
@@ -42,7 +57,9 @@ namespace RK {
         RtspTurnOff,
     };
     
+    // request kind, the wire CSeq is a per session counter
     enum RtspPlayerCSeq {
+        RTSPCONNECT = 0,
         RTSPOPTIONS = 1,
         RTSPDESCRIBE,
         RTSPVIDEO_SETUP,
@@ -50,6 +67,29 @@ namespace RK {
         RTSPPLAY,
         RTSPPAUSE,
         RTSPTEARDOWN,
+        RTSPGET_PARAMETER,
+        RTSPSET_PARAMETER,
+        RTSPANNOUNCE,           // push mode, requests the encoder sent us
+        RTSPRECORD,
+    };
+    
+    // outcome of one asynchronous rtsp request
+    struct RtspResult {
+        RtspPlayerCSeq method;
+        int status;             // rtsp status code, 200 for a completed connect, 0 on transport failure or timeout
+        std::string reason;
+        std::string body;       // response body, e.g. GET_PARAMETER values
+        double elapsedMs;       // request sent to response handled
+        double sinceConnectMs;  // connect started to response handled
+        
+        bool Succeeded() const { return status >= 200 && status < 300; }
+    };
+    
+    typedef std::function<void(const RtspResult &result)> RtspCallback;
+    
+    enum RtspTransport {
+        RtspTransportUnicast = 0,
+        RtspTransportMulticast,
     };
     
     // h264 nalu
@@ -67,56 +107,325 @@ namespace RK {
         unsigned S :1;
     };
     
+    // one assembled access unit in annex-b format (video), or one rtp
+    // payload as the server packetized it (audio)
+    struct MediaFrame {
+        const unsigned char *data;
+        size_t size;
+        uint32_t timestamp;     // rtp timestamp
+        int64_t pts;            // microseconds since the first frame of the track, wraps unrolled
+        int64_t wallclock;      // sender wall clock in microseconds since the unix epoch, 0 until the first rtcp sender report
+        bool keyframe;
+        VideoCodec codec;       // video only, how to read the nal headers
+    };
+    
+    // video stream description, decoded on first request from the sdp
+    // (rtpmap/fmtp) and refined by the first in-band sps
+    struct StreamInfo {
+        int payloadType;
+        std::string encoding;   // rtpmap encoding name, e.g. H264
+        int clockRate;
+        VideoParams video;      // codec only until an sps was seen
+        std::vector<unsigned char> parameterSets;   // annex-b vps/sps/pps from the sdp, to prime a decoder
+    };
+    
+    // low latency delivery counters
+    struct LatencyStats {
+        uint64_t delivered;
+        uint64_t droppedNonRef;     // non-reference frames dropped to catch up
+        uint64_t droppedResync;     // frames skipped while waiting for the next idr
+    };
+    
+    // packet loss recovery counters
+    struct JitterStats {
+        uint64_t received;
+        uint64_t recovered;         // holes filled by a retransmission
+        uint64_t lost;              // holes given up on
+        uint64_t nacked;            // sequence numbers asked for, retries included
+    };
+    
+    // per session memory limits. the defaults fit a few hundred sessions
+    // per gigabyte, tighten them for dense deployments.
+    struct MemoryBudget {
+        size_t frameBytes;      // largest access unit, bigger ones are dropped as damaged
+        size_t jitterPackets;   // reorder window, rounded up to a power of two
+        size_t queueBytes;      // frame copies held by the low latency queue
+        size_t rtspBytes;       // unparsed rtsp input, the connection is dropped beyond it
+        size_t stackBytes;      // own loop thread and low latency consumer thread
+        int socketBytes;        // SO_RCVBUF of each rtp/rtcp socket, kernel memory
+    };
+    
+    // what a session holds right now
+    struct MemoryStats {
+        size_t frameBuffer;     // access unit assembly
+        size_t jitter;
+        size_t queue;
+        size_t rtsp;            // rtsp input, sdp and stream info
+        size_t total;           // heap bytes of the above
+        size_t socketBuffers;   // receive buffers the kernel granted, not counted in total
+    };
+    
+    class LatencyQueue;
+    
     class RtspPlayer {
     public:
         typedef std::shared_ptr<RtspPlayer> Ptr;
         RtspPlayer();
+        // run on a loop shared with other sessions instead of a private thread
+        RtspPlayer(EventLoop::Ptr loop);
         ~RtspPlayer();
-        bool Play(std::string url);
+        // connect, describe, setup and play in one go, callback gets the final step
+        bool Play(std::string url, RtspCallback callback = nullptr);
+        // sends TEARDOWN, waits a short deadline for the reply, releases everything
         void Stop();
+        // same without blocking, done runs on the loop once resources are released
+        void AsyncStop(std::function<void()> done);
+        RtspPlayerState GetState() const { return _PlayState; }
+        // feeds the video of a pcap or rtpdump capture through the same
+        // jitter/depacketizer/frame path instead of the network. speed 0 runs
+        // as fast as the pipeline goes, 1 keeps the recorded pacing. port is
+        // the rtp destination port in a pcap, 0 locks onto the first rtp
+        // packet with the sdp's video payload type, or the first rtp packet
+        // without an sdp. the sdp, as describe returned it, also picks codec
+        // and clock rate. done runs on the loop at the end of the file, or
+        // right away when the player is busy with a session or replay.
+        bool PlayCapture(const std::string &path, double speed, std::function<void()> done, unsigned short port = 0,
+                         const std::string &sdp = std::string());
+        
+        // single steps, thread safe, callbacks run on the event loop. a
+        // stopped player completes them right away with status 0
+        void AsyncConnect(std::string url, RtspCallback callback);
+        void AsyncDescribe(RtspCallback callback);
+        void AsyncSetup(RtspCallback callback);
+        void AsyncPlay(RtspCallback callback);
+        void AsyncPause(RtspCallback callback);
+        void AsyncSeek(double npt, RtspCallback callback);
+        void AsyncTeardown(RtspCallback callback);
+        // parameters are "name: value" lines, GET_PARAMETER values come back in result.body.
+        // playing sessions send an empty GET_PARAMETER as keepalive on their own
+        void AsyncGetParameter(const std::string &parameters, RtspCallback callback);
+        void AsyncSetParameter(const std::string &parameters, RtspCallback callback);
+        
+        // push mode: serve an encoder that connected to us and records with
+        // ANNOUNCE/SETUP/RECORD over udp, see RtspListener. announce runs on
+        // the loop with the announced url before any media is set up, it may
+        // configure this player and returns false to refuse the stream.
+        // callback gets RECORD once media flows and TEARDOWN (status 0 unless
+        // the encoder sent one) when the session ends for whatever reason.
+        bool Accept(int fd, std::function<bool(const std::string &url)> announce, RtspCallback callback);
+        
+        // must be set before Play
+        void SetVideoFrameCallback(std::function<void(const MediaFrame &frame)> callback);
+        // idr access units only, sps and pps in front even when the camera
+        // sends them out of band, at most one per interval of stream time
+        // (0 for every idr). runs on the loop whatever SetLowLatency says,
+        // copy the frame to decode it elsewhere. must be set before Play
+        void SetKeyframeCallback(int intervalMs, std::function<void(const MediaFrame &frame)> callback);
+        // the audio track is only set up when this is set
+        void SetAudioFrameCallback(std::function<void(const MediaFrame &frame)> callback);
+        void SetFrameRing(FrameRing::Ptr ring);
+        void SetTransport(RtspTransport transport);
+        // deliver video on a separate thread and keep at most this much
+        // latency by dropping frames, 0 calls the consumer on the loop
+        void SetLowLatency(int maxLatencyMs);
+        LatencyStats GetLatencyStats() const;
+        // how long a hole in the unicast video stream may wait for a nacked
+        // retransmission (rtx or plain resend), 0 turns recovery off
+        void SetRetransmission(int budgetMs);
+        JitterStats GetJitterStats() const;
+        // gop, frame sizes, bitrate, frame gaps and nal types of the video
+        // as received, thread safe
+        StreamStats GetStreamStats() const;
+        // before SetLowLatency and Play
+        void SetMemoryBudget(const MemoryBudget &budget);
+        MemoryBudget GetMemoryBudget() const { return _Budget; }
+        // thread safe, runs on the loop
+        MemoryStats GetMemoryStats();
+        
+        // thread safe, false until DESCRIBE succeeded. video.width is 0 as
+        // long as neither the sdp nor the stream carried an sps.
+        bool GetStreamInfo(StreamInfo *info);
     protected:
+        typedef std::chrono::steady_clock Clock;
+        
+        struct RtspPending {
+            RtspPlayerCSeq method;
+            Clock::time_point start;
+            uint64_t timer;
+            RtspCallback callback;
+        };
+        
         bool NetworkInit(const char *ip, const short port);
-        bool RTPSocketInit(int videoPort, int audioPort);
+        bool RTPSocketInit(int *rtp, int *rtcp, unsigned short *port);
+        bool MulticastInit(const char *buf, bool audio);
         bool getIPFromUrl(std::string url, char *ip, unsigned short *port);
         void EventInit();
+        bool AsyncReady();
+        // same, completing callback with status 0 when the player was stopped
+        bool AsyncReady(RtspPlayerCSeq method, const RtspCallback &callback);
+        void ContinueHandshake(const RtspResult &result, RtspCallback callback);
+        void Complete(RtspPlayerCSeq method, int status, const std::string &reason, Clock::time_point start, RtspCallback callback,
+                      const std::string &body = std::string());
+        void Keepalive();
+        
+        void HandleRtspEvent(int events);
+        void HandleConnected();
         bool HandleRtspMsg(const char *buf, ssize_t bufsize);
-        void HandleRtspState();
+        bool HandleRtspRequest(const char *buf, ssize_t bufsize);
+        void SendResponse(int CSeq, int status, const char *reason, const std::string &headers);
+        void HandleRtspClosed(const char *reason);
+        void CloseRtspSocket();
+        void ReleaseResources();
+        
+        void ReplayCapture();
+        void HandleCapturePacket(const CapturePacket &packet);
+        void EndCapture();
         
+        void HandleRtpEvent(int sock, SrtpContext::Ptr srtp, bool rtcp, const std::function<void(const char *buf, ssize_t bufsize)> &handler);
+        void HandleRtpPacket(const char *buf, ssize_t bufsize);
         void HandleRtpMsg(const char *buf, ssize_t bufsize);
+        void HandleH265Payload(const unsigned char *payload, size_t size);
+        void SendNack(const std::vector<uint16_t> &seqs);
+        void HandleAudioRtpMsg(const char *buf, ssize_t bufsize);
+        void HandleRtcpMsg(const char *buf, ssize_t bufsize, MediaClock *clock);
+        void AppendNalu(const unsigned char *nalu, size_t size);
+        bool FrameFits(size_t size);
+        void DeliverVideoFrame();
+        void TapKeyframe(const MediaFrame &frame);
         
         // rtsp message send/handle function
-        void SendDescribe(std::string url);
+        void SendRequest(RtspPlayerCSeq method, const char *name, const std::string &url, const char *headers, RtspCallback callback,
+                         const std::string &body = std::string());
+        void SendDescribe(RtspCallback callback);
         void HandleDescribe(const char *buf, ssize_t bufsize);
-        void RtspSetup(const std::string url, int track, int CSeq, char *proto, short rtp_port, short rtcp_port);
-        void SendVideoSetup();
-        bool HandleVideoSetup(const char *buf, ssize_t bufsize);
-        void SendPlay(const std::string url);
+        void ParseStreamInfo();
+        void UpdateVideoCodec();
+        void RtspSetup(RtspPlayerCSeq method, const std::string url, int track, char *proto, short rtp_port, short rtcp_port, RtspCallback callback);
+        struct sdp_payload::sdp_media *FindMedia(const char *type, int *track);
+        struct sdp_payload::sdp_media *FindMediaByControl(const char *url);
+        void SendVideoSetup(RtspCallback callback);
+        void SendAudioSetup(RtspCallback callback);
+        bool HandleSetup(const char *buf, ssize_t bufsize, bool audio);
+        bool SetupSrtp(bool audio, struct sdp_payload::sdp_media *media);
+        void StartRtp(bool audio, int remotePort, int remoteRtcpPort);
+        void SendPlay(const char *range, RtspCallback callback);
+        void SendPause(RtspCallback callback);
+        void SendTeardown(RtspCallback callback);
         
         std::vector<std::string> GetSDPFromMessage(const char *buffer, size_t length, const char *pattern);
     private:
         std::atomic<bool> _Terminated;
         std::atomic<bool> _NetWorked;
-        std::shared_ptr<std::thread> _PlayThreadPtr;
         std::atomic<RtspPlayerState> _PlayState;
-        fd_set _readfd;
-        fd_set _writefd;
-        fd_set _errorfd;
+        
+        EventLoop::Ptr _Loop;
+        bool _OwnLoop = false;
         
         std::string _rtspurl;
         char _rtspip[256];
         
-        int _Eventfd = 0;
-        int _RtspSocket = 0;
-        int _RtpVideoSocket = 0;
-        int _RtpAudioSocket = 0;
-        struct sockaddr_in _RtpVideoAddr;
+        int _RtspSocket = -1;
+        int _RtpVideoSocket = -1;
+        int _RtcpVideoSocket = -1;
+        int _RtpAudioSocket = -1;
+        int _RtcpAudioSocket = -1;
+        unsigned short _RtpVideoPort = 0;
+        unsigned short _RtpAudioPort = 0;
+        
+        RtspTransport _Transport = RtspTransportUnicast;
+        MulticastGroup::Ptr _McastGroup;
+        MulticastGroup::Ptr _McastAudioGroup;
+        struct sockaddr_in _RtcpVideoAddr;
+        
+        // loss recovery
+        int _RetransmitBudgetMs;
+        std::shared_ptr<JitterBuffer> _Jitter;     // atomic_load/atomic_store, stats read it off the loop
+        int _RtxPayloadType = -1;
+        int _RtxApt = -1;
+        uint32_t _VideoSsrc = 0;
+        uint32_t _LocalSsrc = 0;
+        
+        // RTP/SAVP media, keyed from the sdp a=crypto
+        SrtpContext::Ptr _SrtpVideo;
+        SrtpContext::Ptr _SrtpAudio;
+        
+        // capture replay
+        CaptureReader::Ptr _Capture;
+        CapturePacket _CapturePacket;
+        bool _CaptureHeld = false;
+        double _CaptureSpeed = 0;
+        unsigned short _CapturePort = 0;
+        Clock::time_point _CaptureStart;
+        uint64_t _CaptureTimer = 0;
+        std::function<void()> _CaptureDone;
+        
+        MemoryBudget _Budget;
+        
+        struct sdp_payload *_SdpParser = nullptr;
+        size_t _SdpBytes = 0;
+        
+        // raw video attributes, parsed lazily by GetStreamInfo
+        std::mutex _InfoLock;
+        bool _InfoValid = false;
+        bool _InfoParsed = false;
+        std::string _VideoRtpmap;
+        std::string _VideoFmtp;
+        std::string _VideoFramerate;
+        std::vector<unsigned char> _InbandSps;
+        std::vector<unsigned char> _InbandVps;  // loop thread only
+        std::vector<unsigned char> _InbandPps;  // loop thread only
+        StreamInfo _StreamInfo;
+        
+        std::string _RtspSessionID;
+        int _SessionTimeout;
+        uint64_t _KeepaliveTimer = 0;
+        bool _KeepaliveOptions = false;     // server refused GET_PARAMETER
+        Clock::time_point _LastActivity;
+        
+        // push mode
+        bool _Push = false;
+        std::function<bool(const std::string &url)> _PushAnnounce;
+        RtspCallback _PushCallback;
+        int _CSeq = 0;
+        std::map<int, RtspPending> _Pending;
+        std::string _RtspRecvBuf;
+        Clock::time_point _ConnectStart;
+        RtspCallback _ConnectCallback;
+        uint64_t _ConnectTimer = 0;
+        
+        std::function<void(const MediaFrame &frame)> onVideoFrameGet;
+        std::function<void(const MediaFrame &frame)> onAudioFrameGet;
+        FrameRing::Ptr _FrameRing;
+        std::shared_ptr<LatencyQueue> _LatencyQueue;
+        
+        // keyframe tap
+        std::function<void(const MediaFrame &frame)> onKeyframeGet;
+        int64_t _KeyframeIntervalUs = 0;
+        int64_t _KeyframePts = 0;
+        bool _KeyframeTapped = false;
+        std::vector<unsigned char> _KeyframeBuf;
         
-        struct sdp_payload *_SdpParser;
+        MediaClock _VideoClock;
+        MediaClock _AudioClock;
         
-        long _RtspSessionID = 0;
-        std::function<void(unsigned char *nalu, ssize_t size)> onVideoFrameGet;
+        // depacketizer, from the sdp rtpmap, loop thread only
+        VideoCodec _VideoCodec = VideoCodecH264;
+        int _VideoPayloadType = -1;
+        bool _VideoDonl = false;    // h265 sprop-max-don-diff > 0
         
-        FILE *_fp;
+        std::vector<unsigned char> _FrameBuf;
+        uint32_t _FrameTimestamp = 0;
+        int64_t _FrameExtended = 0;
+        bool _FrameKey = false;
+        bool _FrameRef = false;
+        bool _FrameVps = false;
+        bool _FrameSps = false;
+        bool _FramePps = false;
+        StreamAnalyzer _Analyzer;
+        bool _FrameDamaged = false;
+        Clock::time_point _FrameArrival;
+        bool _HasRtpSeq = false;
+        uint16_t _RtpSeq = 0;
     };
     
 } //namespace RK
@@ -0,0 +1,491 @@
+//
+//  Srtp.cpp
+//  Simple-Rtsp-Client
+//
+
+#include "Srtp.hpp"
+#include <string.h>
+#ifdef RTSP_SRTP
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#endif
+#include "Log.hpp"
+
+#define MODULE_TAG "Srtp"
+
+// packets older than this many indices behind the newest are dropped
+#define SRTP_REPLAY_WINDOW (64)
+// ssrcs tracked per direction before the replay state starts over
+#define SRTP_MAX_STREAMS (16)
+#define SRTP_MAX_KEY (32)
+#define SRTP_AUTH_KEY (20)
+#define SRTP_GCM_TAG (16)
+#define SRTCP_INDEX_SIZE (4)
+
+namespace RK {
+
+    struct SrtpSuite {
+        const char *name;
+        size_t keySize;
+        size_t saltSize;
+        size_t rtpTag;          // srtcp always carries the 80 bit tag
+        bool gcm;
+    };
+
+    static const SrtpSuite Suites[] = {
+        {"AES_CM_128_HMAC_SHA1_80", 16, 14, 10, false},
+        {"AES_CM_128_HMAC_SHA1_32", 16, 14, 4, false},
+        {"AES_256_CM_HMAC_SHA1_80", 32, 14, 10, false},
+        {"AES_256_CM_HMAC_SHA1_32", 32, 14, 4, false},
+        {"AEAD_AES_128_GCM", 16, 12, SRTP_GCM_TAG, true},
+        {"AEAD_AES_256_GCM", 32, 12, SRTP_GCM_TAG, true},
+    };
+
+    SrtpContext::SrtpContext() {
+        ::memset(_RtpSalt, 0, sizeof(_RtpSalt));
+        ::memset(_RtcpSalt, 0, sizeof(_RtcpSalt));
+    }
+
+    bool SrtpContext::Check(std::map<uint32_t, Replay> &streams, uint32_t ssrc, uint64_t index) {
+        auto it = streams.find(ssrc);
+        if (it == streams.end() || index > it->second.highest) {
+            return true;
+        }
+        uint64_t delta = it->second.highest - index;
+        return delta < SRTP_REPLAY_WINDOW && !((it->second.window >> delta) & 1);
+    }
+
+    void SrtpContext::Update(std::map<uint32_t, Replay> &streams, uint32_t ssrc, uint64_t index) {
+        auto it = streams.find(ssrc);
+        if (it == streams.end()) {
+            if (streams.size() >= SRTP_MAX_STREAMS) {
+                streams.clear();
+            }
+            Replay replay;
+            replay.highest = index;
+            replay.window = 1;
+            streams[ssrc] = replay;
+            return;
+        }
+
+        Replay &replay = it->second;
+        if (index > replay.highest) {
+            uint64_t shift = index - replay.highest;
+            replay.window = shift < SRTP_REPLAY_WINDOW ? (replay.window << shift) | 1 : 1;
+            replay.highest = index;
+        } else {
+            replay.window |= 1ULL << (replay.highest - index);
+        }
+    }
+
+    size_t SrtpContext::Overhead() const {
+        return SRTCP_INDEX_SIZE + _Mki.size() + _RtcpTag;
+    }
+
+#ifdef RTSP_SRTP
+
+    static uint32_t Read32(const unsigned char *p) {
+        return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+    }
+
+    static void Write32(unsigned char *p, uint32_t v) {
+        p[0] = v >> 24;
+        p[1] = v >> 16;
+        p[2] = v >> 8;
+        p[3] = v;
+    }
+
+    // fixed header, csrcs and extension stay in the clear
+    static size_t RtpHeaderSize(const unsigned char *packet, size_t size) {
+        if (size < 12 || (packet[0] >> 6) != 2) {
+            return 0;
+        }
+        size_t header = 12 + (packet[0] & 0x0f) * 4;
+        if ((packet[0] & 0x10) && header + 4 <= size) {
+            header += 4 + ((packet[header + 2] << 8 | packet[header + 3]) * 4);
+        }
+        return header <= size ? header : 0;
+    }
+
+    SrtpContext::~SrtpContext() {
+        EVP_CIPHER_CTX_free(_RtpCipher);
+        EVP_CIPHER_CTX_free(_RtcpCipher);
+        EVP_MAC_CTX_free(_RtpMac);
+        EVP_MAC_CTX_free(_RtcpMac);
+    }
+
+    bool SrtpContext::Available() {
+        return true;
+    }
+
+    static EVP_MAC_CTX *NewMac(const unsigned char *key) {
+        EVP_MAC *hmac = EVP_MAC_fetch(NULL, "HMAC", NULL);
+        EVP_MAC_CTX *ctx = hmac ? EVP_MAC_CTX_new(hmac) : NULL;
+        EVP_MAC_free(hmac);
+
+        OSSL_PARAM params[] = {
+            OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char *)"SHA1", 0),
+            OSSL_PARAM_construct_end(),
+        };
+        if (ctx && !EVP_MAC_init(ctx, key, SRTP_AUTH_KEY, params)) {
+            EVP_MAC_CTX_free(ctx);
+            ctx = NULL;
+        }
+        return ctx;
+    }
+
+    static EVP_CIPHER_CTX *NewCipher(const EVP_CIPHER *cipher, const unsigned char *key) {
+        EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+        if (ctx && !EVP_CipherInit_ex(ctx, cipher, NULL, key, NULL, 1)) {
+            EVP_CIPHER_CTX_free(ctx);
+            ctx = NULL;
+        }
+        return ctx;
+    }
+
+    // rfc 3711 4.3.1 with kdr 0: aes-cm keystream under the master key,
+    // the label xored into the salt
+    bool SrtpContext::Derive(const unsigned char *masterKey, const unsigned char *masterSalt, uint8_t label, unsigned char *out, size_t size) {
+        unsigned char iv[16] = {0};
+        ::memcpy(iv, masterSalt, 14);
+        iv[7] ^= label;
+        ::memset(out, 0, size);
+
+        EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+        int len = 0;
+        bool ok = ctx && EVP_EncryptInit_ex(ctx, _KeySize == 16 ? EVP_aes_128_ctr() : EVP_aes_256_ctr(), NULL, masterKey, iv) &&
+            EVP_EncryptUpdate(ctx, out, &len, out, (int)size);
+        EVP_CIPHER_CTX_free(ctx);
+        return ok;
+    }
+
+    static const SrtpSuite *FindSuite(const std::string &suite) {
+        for (auto &it : Suites) {
+            if (suite == it.name) {
+                return &it;
+            }
+        }
+        return nullptr;
+    }
+
+    bool SrtpContext::Init(const std::string &suite, const unsigned char *key, size_t size, const std::vector<unsigned char> &mki) {
+        const SrtpSuite *found = FindSuite(suite);
+        if (!found || size != found->keySize + found->saltSize || _RtpCipher) {
+            log(MODULE_TAG, "unsupported crypto suite %s with %zu key bytes", suite.c_str(), size);
+            return false;
+        }
+
+        // the 96 bit gcm salt is zero padded on the right for the kdf
+        _KeySize = found->keySize;
+        unsigned char masterSalt[14] = {0};
+        ::memcpy(masterSalt, key + _KeySize, found->saltSize);
+
+        // session keys laid out like the master: key || salt
+        unsigned char rtpKey[SRTP_MAX_KEY + 14], rtcpKey[SRTP_MAX_KEY + 14];
+        unsigned char rtpAuth[SRTP_AUTH_KEY], rtcpAuth[SRTP_AUTH_KEY];
+        bool ok = Derive(key, masterSalt, 0, rtpKey, _KeySize) && Derive(key, masterSalt, 2, rtpKey + _KeySize, found->saltSize) &&
+            Derive(key, masterSalt, 3, rtcpKey, _KeySize) && Derive(key, masterSalt, 5, rtcpKey + _KeySize, found->saltSize) &&
+            (found->gcm || (Derive(key, masterSalt, 1, rtpAuth, SRTP_AUTH_KEY) && Derive(key, masterSalt, 4, rtcpAuth, SRTP_AUTH_KEY)));
+        ok = ok && InitSession(suite, rtpKey, rtcpKey, rtpAuth, rtcpAuth, mki);
+
+        OPENSSL_cleanse(rtpKey, sizeof(rtpKey));
+        OPENSSL_cleanse(rtcpKey, sizeof(rtcpKey));
+        OPENSSL_cleanse(rtpAuth, sizeof(rtpAuth));
+        OPENSSL_cleanse(rtcpAuth, sizeof(rtcpAuth));
+        if (!ok) {
+            log(MODULE_TAG, "failed to set up %s", suite.c_str());
+        }
+        return ok;
+    }
+
+    bool SrtpContext::InitSession(const std::string &suite, const unsigned char *rtpKey, const unsigned char *rtcpKey,
+                                  const unsigned char *rtpAuth, const unsigned char *rtcpAuth, const std::vector<unsigned char> &mki) {
+        const SrtpSuite *found = FindSuite(suite);
+        if (!found || _RtpCipher) {
+            return false;
+        }
+
+        _Gcm = found->gcm;
+        _KeySize = found->keySize;
+        _SaltSize = found->saltSize;
+        _RtpTag = found->rtpTag;
+        _RtcpTag = _Gcm ? SRTP_GCM_TAG : 10;
+        _Mki = mki;
+        ::memcpy(_RtpSalt, rtpKey + _KeySize, _SaltSize);
+        ::memcpy(_RtcpSalt, rtcpKey + _KeySize, _SaltSize);
+
+        if (_Gcm) {
+            const EVP_CIPHER *cipher = _KeySize == 16 ? EVP_aes_128_gcm() : EVP_aes_256_gcm();
+            _RtpCipher = NewCipher(cipher, rtpKey);
+            _RtcpCipher = NewCipher(cipher, rtcpKey);
+        } else {
+            const EVP_CIPHER *cipher = _KeySize == 16 ? EVP_aes_128_ctr() : EVP_aes_256_ctr();
+            _RtpCipher = NewCipher(cipher, rtpKey);
+            _RtcpCipher = NewCipher(cipher, rtcpKey);
+            _RtpMac = NewMac(rtpAuth);
+            _RtcpMac = NewMac(rtcpAuth);
+            if (!_RtpMac || !_RtcpMac) {
+                return false;
+            }
+        }
+        return _RtpCipher && _RtcpCipher;
+    }
+
+    // aes-cm iv: salt ^ ssrc << 64 ^ index << 16, the same keystream
+    // encrypts and decrypts
+    bool SrtpContext::Crypt(EVP_CIPHER_CTX *ctx, const unsigned char *salt, uint32_t ssrc, uint64_t index, unsigned char *data, size_t size) {
+        unsigned char iv[16] = {0};
+        ::memcpy(iv, salt, 14);
+        iv[4] ^= ssrc >> 24;
+        iv[5] ^= ssrc >> 16;
+        iv[6] ^= ssrc >> 8;
+        iv[7] ^= ssrc;
+        for (int i = 0; i < 6; i++) {
+            iv[8 + i] ^= index >> (40 - 8 * i);
+        }
+
+        int len = 0;
+        return EVP_CipherInit_ex(ctx, NULL, NULL, NULL, iv, 1) && (size == 0 || EVP_CipherUpdate(ctx, data, &len, data, (int)size));
+    }
+
+    bool SrtpContext::Open(EVP_CIPHER_CTX *ctx, const unsigned char *iv, const unsigned char *aad, size_t aadSize,
+                           const unsigned char *aad2, size_t aad2Size, unsigned char *data, size_t size, const unsigned char *tag) {
+        int len = 0;
+        if (!EVP_CipherInit_ex(ctx, NULL, NULL, NULL, iv, 0) || !EVP_CipherUpdate(ctx, NULL, &len, aad, (int)aadSize) ||
+            (aad2Size && !EVP_CipherUpdate(ctx, NULL, &len, aad2, (int)aad2Size)) ||
+            (size && !EVP_CipherUpdate(ctx, data, &len, data, (int)size))) {
+            return false;
+        }
+        return EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, SRTP_GCM_TAG, (void *)tag) && EVP_CipherFinal_ex(ctx, data + size, &len) > 0;
+    }
+
+    bool SrtpContext::Seal(EVP_CIPHER_CTX *ctx, const unsigned char *iv, const unsigned char *aad, size_t aadSize,
+                           unsigned char *data, size_t size, unsigned char *tag) {
+        int len = 0;
+        return EVP_CipherInit_ex(ctx, NULL, NULL, NULL, iv, 1) && EVP_CipherUpdate(ctx, NULL, &len, aad, (int)aadSize) &&
+            (size == 0 || EVP_CipherUpdate(ctx, data, &len, data, (int)size)) && EVP_CipherFinal_ex(ctx, data + size, &len) &&
+            EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, SRTP_GCM_TAG, tag);
+    }
+
+    bool SrtpContext::Mac(EVP_MAC_CTX *ctx, const unsigned char *data, size_t size, const unsigned char *extra, size_t extraSize,
+                          unsigned char *tag) {
+        // a null key restarts from the precomputed pads
+        size_t len = 0;
+        return EVP_MAC_init(ctx, NULL, 0, NULL) && EVP_MAC_update(ctx, data, size) &&
+            (extraSize == 0 || EVP_MAC_update(ctx, extra, extraSize)) && EVP_MAC_final(ctx, tag, &len, SRTP_AUTH_KEY);
+    }
+
+    bool SrtpContext::UnprotectRtp(unsigned char *packet, size_t *size) {
+        size_t header = RtpHeaderSize(packet, *size);
+        if (!_RtpCipher || !header || *size < header + _RtpTag + _Mki.size()) {
+            _Dropped++;
+            return false;
+        }
+
+        // the tag trails the mki for hmac, the aead tag ends the ciphertext
+        size_t end = *size - _RtpTag - _Mki.size();
+        const unsigned char *mki = _Gcm ? packet + *size - _Mki.size() : packet + end;
+        const unsigned char *tag = _Gcm ? packet + end : packet + *size - _RtpTag;
+        if (!_Mki.empty() && ::memcmp(mki, _Mki.data(), _Mki.size()) != 0) {
+            _Dropped++;
+            return false;
+        }
+
+        // rfc 3711 3.3.1: guess the rollover counter from the newest packet
+        uint32_t ssrc = Read32(packet + 8);
+        uint16_t seq = packet[2] << 8 | packet[3];
+        uint64_t index = seq;
+        auto it = _RtpReplay.find(ssrc);
+        if (it != _RtpReplay.end()) {
+            uint32_t roc = (uint32_t)(it->second.highest >> 16);
+            uint16_t last = it->second.highest & 0xffff;
+            if (last < 32768 && seq > last + 32768 && roc > 0) {
+                roc--;
+            } else if (last >= 32768 && seq < last - 32768) {
+                roc++;
+            }
+            index = (uint64_t)roc << 16 | seq;
+        }
+        if (!Check(_RtpReplay, ssrc, index)) {
+            _Dropped++;
+            return false;
+        }
+
+        bool ok;
+        if (_Gcm) {
+            // rfc 7714 8.1: iv = salt ^ (00 00 || ssrc || roc || seq)
+            unsigned char iv[12];
+            ::memcpy(iv, _RtpSalt, sizeof(iv));
+            iv[2] ^= ssrc >> 24;
+            iv[3] ^= ssrc >> 16;
+            iv[4] ^= ssrc >> 8;
+            iv[5] ^= ssrc;
+            for (int i = 0; i < 6; i++) {
+                iv[6 + i] ^= index >> (40 - 8 * i);
+            }
+            ok = Open(_RtpCipher, iv, packet, header, NULL, 0, packet + header, end - header, tag);
+        } else {
+            unsigned char roc[4], expected[SRTP_AUTH_KEY];
+            Write32(roc, (uint32_t)(index >> 16));
+            ok = Mac(_RtpMac, packet, end, roc, sizeof(roc), expected) && CRYPTO_memcmp(expected, tag, _RtpTag) == 0 &&
+                Crypt(_RtpCipher, _RtpSalt, ssrc, index, packet + header, end - header);
+        }
+        if (!ok) {
+            _Dropped++;
+            return false;
+        }
+
+        Update(_RtpReplay, ssrc, index);
+        *size = end;
+        return true;
+    }
+
+    bool SrtpContext::UnprotectRtcp(unsigned char *packet, size_t *size) {
+        if (!_RtcpCipher || *size < 8 + Overhead()) {
+            _Dropped++;
+            return false;
+        }
+
+        // hmac: header | payload | e+index | mki | tag
+        // gcm:  header | payload | tag | e+index | mki
+        const unsigned char *mki = packet + *size - _Mki.size() - (_Gcm ? 0 : _RtcpTag);
+        if (!_Mki.empty() && ::memcmp(mki, _Mki.data(), _Mki.size()) != 0) {
+            _Dropped++;
+            return false;
+        }
+        const unsigned char *word = mki - SRTCP_INDEX_SIZE;
+        const unsigned char *tag = _Gcm ? word - SRTP_GCM_TAG : packet + *size - _RtcpTag;
+        size_t end = _Gcm ? tag - packet : word - packet;
+
+        uint32_t ssrc = Read32(packet + 4);
+        bool encrypted = (word[0] & 0x80) != 0;
+        uint32_t index = Read32(word) & 0x7fffffff;
+        if (!Check(_RtcpReplay, ssrc, index)) {
+            _Dropped++;
+            return false;
+        }
+
+        bool ok;
+        if (_Gcm) {
+            // rfc 7714 9.1: iv = salt ^ (00 00 || ssrc || 00 00 || index)
+            unsigned char iv[12];
+            ::memcpy(iv, _RtcpSalt, sizeof(iv));
+            iv[2] ^= ssrc >> 24;
+            iv[3] ^= ssrc >> 16;
+            iv[4] ^= ssrc >> 8;
+            iv[5] ^= ssrc;
+            iv[8] ^= index >> 24;
+            iv[9] ^= index >> 16;
+            iv[10] ^= index >> 8;
+            iv[11] ^= index;
+            if (encrypted) {
+                ok = Open(_RtcpCipher, iv, packet, 8, word, SRTCP_INDEX_SIZE, packet + 8, end - 8, tag);
+            } else {
+                ok = Open(_RtcpCipher, iv, packet, end, word, SRTCP_INDEX_SIZE, NULL, 0, tag);
+            }
+        } else {
+            unsigned char expected[SRTP_AUTH_KEY];
+            ok = Mac(_RtcpMac, packet, end + SRTCP_INDEX_SIZE, NULL, 0, expected) && CRYPTO_memcmp(expected, tag, _RtcpTag) == 0 &&
+                (!encrypted || Crypt(_RtcpCipher, _RtcpSalt, ssrc, index, packet + 8, end - 8));
+        }
+        if (!ok) {
+            _Dropped++;
+            return false;
+        }
+
+        Update(_RtcpReplay, ssrc, index);
+        *size = end;
+        return true;
+    }
+
+    bool SrtpContext::ProtectRtcp(unsigned char *packet, size_t *size) {
+        if (!_RtcpCipher || *size < 8) {
+            return false;
+        }
+
+        uint32_t ssrc = Read32(packet + 4);
+        uint32_t index = _RtcpIndex++ & 0x7fffffff;
+        unsigned char word[SRTCP_INDEX_SIZE];
+        Write32(word, 0x80000000 | index);
+
+        size_t end = *size;
+        if (_Gcm) {
+            unsigned char iv[12];
+            ::memcpy(iv, _RtcpSalt, sizeof(iv));
+            iv[2] ^= ssrc >> 24;
+            iv[3] ^= ssrc >> 16;
+            iv[4] ^= ssrc >> 8;
+            iv[5] ^= ssrc;
+            iv[8] ^= index >> 24;
+            iv[9] ^= index >> 16;
+            iv[10] ^= index >> 8;
+            iv[11] ^= index;
+
+            unsigned char aad[8 + SRTCP_INDEX_SIZE];
+            ::memcpy(aad, packet, 8);
+            ::memcpy(aad + 8, word, SRTCP_INDEX_SIZE);
+            if (!Seal(_RtcpCipher, iv, aad, sizeof(aad), packet + 8, end - 8, packet + end)) {
+                return false;
+            }
+            end += SRTP_GCM_TAG;
+            ::memcpy(packet + end, word, SRTCP_INDEX_SIZE);
+            end += SRTCP_INDEX_SIZE;
+            ::memcpy(packet + end, _Mki.data(), _Mki.size());
+            end += _Mki.size();
+        } else {
+            if (!Crypt(_RtcpCipher, _RtcpSalt, ssrc, index, packet + 8, end - 8)) {
+                return false;
+            }
+            ::memcpy(packet + end, word, SRTCP_INDEX_SIZE);
+            end += SRTCP_INDEX_SIZE;
+            unsigned char tag[SRTP_AUTH_KEY];
+            if (!Mac(_RtcpMac, packet, end, NULL, 0, tag)) {
+                return false;
+            }
+            ::memcpy(packet + end, _Mki.data(), _Mki.size());
+            end += _Mki.size();
+            ::memcpy(packet + end, tag, _RtcpTag);
+            end += _RtcpTag;
+        }
+
+        *size = end;
+        return true;
+    }
+
+#else
+
+    SrtpContext::~SrtpContext() {
+    }
+
+    bool SrtpContext::Available() {
+        return false;
+    }
+
+    bool SrtpContext::Init(const std::string &suite, const unsigned char *, size_t, const std::vector<unsigned char> &) {
+        log(MODULE_TAG, "built without openssl, %s is not available", suite.c_str());
+        return false;
+    }
+
+    bool SrtpContext::InitSession(const std::string &, const unsigned char *, const unsigned char *, const unsigned char *, const unsigned char *,
+                                  const std::vector<unsigned char> &) {
+        return false;
+    }
+
+    bool SrtpContext::UnprotectRtp(unsigned char *, size_t *) {
+        _Dropped++;
+        return false;
+    }
+
+    bool SrtpContext::UnprotectRtcp(unsigned char *, size_t *) {
+        _Dropped++;
+        return false;
+    }
+
+    bool SrtpContext::ProtectRtcp(unsigned char *, size_t *) {
+        return false;
+    }
+
+#endif
+
+} //namespace RK
@@ -0,0 +1,92 @@
+//
+//  Srtp.hpp
+//  Simple-Rtsp-Client
+//
+
+#ifndef Srtp_hpp
+#define Srtp_hpp
+
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+struct evp_cipher_ctx_st;
+struct evp_mac_ctx_st;
+
+namespace RK {
+
+    // rfc 3711 srtp/srtcp for one media of a session, keyed from an sdes
+    // a=crypto line (rfc 4568). aes counter mode with hmac-sha1, or aes-gcm
+    // (rfc 7714). all work happens in place on the packet buffer. the cipher
+    // is libcrypto's, which picks aes-ni/vaes and sha extensions at runtime.
+    //
+    // receiving is srtp and srtcp, sending only srtcp for our reports and
+    // nacks, encrypted with the same master key under our own ssrc.
+    class SrtpContext {
+    public:
+        typedef std::shared_ptr<SrtpContext> Ptr;
+        SrtpContext();
+        ~SrtpContext();
+
+        // false when built without openssl
+        static bool Available();
+        // suite as named in a=crypto, key is the decoded master key || salt.
+        // a non empty mki is expected in front of every tag
+        bool Init(const std::string &suite, const unsigned char *key, size_t size, const std::vector<unsigned char> &mki);
+
+        // size shrinks by the trailer. false for forged, replayed or
+        // truncated packets, which are to be dropped
+        bool UnprotectRtp(unsigned char *packet, size_t *size);
+        bool UnprotectRtcp(unsigned char *packet, size_t *size);
+        // the buffer needs Overhead() bytes past size
+        bool ProtectRtcp(unsigned char *packet, size_t *size);
+        size_t Overhead() const;
+
+        uint64_t Dropped() const { return _Dropped; }
+    protected:
+        struct Replay {
+            uint64_t highest;   // highest authenticated index
+            uint64_t window;    // bit n: highest - n was seen
+        };
+
+        // Init past the key derivation: cipher key || salt per direction,
+        // hmac keys ignored for gcm. lets tests feed session key vectors
+        bool InitSession(const std::string &suite, const unsigned char *rtpKey, const unsigned char *rtcpKey,
+                         const unsigned char *rtpAuth, const unsigned char *rtcpAuth, const std::vector<unsigned char> &mki);
+        bool Derive(const unsigned char *masterKey, const unsigned char *masterSalt, uint8_t label, unsigned char *out, size_t size);
+        bool Check(std::map<uint32_t, Replay> &streams, uint32_t ssrc, uint64_t index);
+        void Update(std::map<uint32_t, Replay> &streams, uint32_t ssrc, uint64_t index);
+        bool Crypt(struct evp_cipher_ctx_st *ctx, const unsigned char *salt, uint32_t ssrc, uint64_t index,
+                   unsigned char *data, size_t size);
+        bool Open(struct evp_cipher_ctx_st *ctx, const unsigned char *iv, const unsigned char *aad, size_t aadSize,
+                  const unsigned char *aad2, size_t aad2Size, unsigned char *data, size_t size, const unsigned char *tag);
+        bool Seal(struct evp_cipher_ctx_st *ctx, const unsigned char *iv, const unsigned char *aad, size_t aadSize,
+                  unsigned char *data, size_t size, unsigned char *tag);
+        bool Mac(struct evp_mac_ctx_st *ctx, const unsigned char *data, size_t size, const unsigned char *extra, size_t extraSize,
+                 unsigned char *tag);
+    private:
+        bool _Gcm = false;
+        size_t _KeySize = 0;
+        size_t _SaltSize = 0;
+        size_t _RtpTag = 0;
+        size_t _RtcpTag = 0;
+        std::vector<unsigned char> _Mki;
+
+        unsigned char _RtpSalt[14];
+        unsigned char _RtcpSalt[14];
+        struct evp_cipher_ctx_st *_RtpCipher = nullptr;
+        struct evp_cipher_ctx_st *_RtcpCipher = nullptr;
+        struct evp_mac_ctx_st *_RtpMac = nullptr;
+        struct evp_mac_ctx_st *_RtcpMac = nullptr;
+
+        std::map<uint32_t, Replay> _RtpReplay;
+        std::map<uint32_t, Replay> _RtcpReplay;
+        uint32_t _RtcpIndex = 0;
+        uint64_t _Dropped = 0;
+    };
+
+} //namespace RK
+#endif /* Srtp_hpp */
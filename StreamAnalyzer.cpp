@@ -0,0 +1,149 @@
+//
+//  StreamAnalyzer.cpp
+//  Simple-Rtsp-Client
+//
+
+#include "StreamAnalyzer.hpp"
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#define STREAM_ANALYZER_BUCKETS (STREAM_ANALYZER_WINDOW_S + 1)
+
+namespace RK {
+
+    StreamAnalyzer::StreamAnalyzer() {
+        Reset();
+    }
+
+    void StreamAnalyzer::Reset() {
+        std::lock_guard<std::mutex> lock(_Lock);
+        ::memset(_Buckets, 0, sizeof(_Buckets));
+        for (Bucket &bucket : _Buckets) {
+            bucket.second = -1;
+        }
+        ::memset(_Pending, 0, sizeof(_Pending));
+        _PendingTypes = 0;
+        _Started = false;
+        _Gop = 0;
+        _SinceKeyframe = 0;
+        _SeenKeyframe = false;
+    }
+
+    StreamAnalyzer::Bucket &StreamAnalyzer::Current(int64_t second) {
+        Bucket &bucket = _Buckets[second % STREAM_ANALYZER_BUCKETS];
+        if (bucket.second != second) {
+            // a second nothing arrived in leaves its slot stale, the
+            // second number tells it apart
+            ::memset(&bucket, 0, sizeof(bucket));
+            bucket.second = second;
+        }
+        return bucket;
+    }
+
+    void StreamAnalyzer::AddFrame(size_t size, bool keyframe, bool damaged, Clock::time_point arrival) {
+        std::lock_guard<std::mutex> lock(_Lock);
+        if (!_Started) {
+            _Started = true;
+            _Start = arrival;
+            _LastArrival = arrival;
+        }
+        int64_t second = std::chrono::duration_cast<std::chrono::seconds>(std::max(arrival - _Start, Clock::duration::zero())).count();
+        Bucket &bucket = Current(second);
+
+        bucket.frames++;
+        bucket.bytes += size;
+        bucket.maxFrameBytes = std::max(bucket.maxFrameBytes, size);
+        if (damaged) {
+            bucket.damaged++;
+        }
+        if (keyframe) {
+            bucket.keyframes++;
+            bucket.keyframeBytes += size;
+            if (_SeenKeyframe) {
+                _Gop = _SinceKeyframe;
+                bucket.maxGop = std::max(bucket.maxGop, _Gop);
+            }
+            _SeenKeyframe = true;
+            _SinceKeyframe = 1;
+        } else {
+            _SinceKeyframe++;
+        }
+
+        if (arrival > _LastArrival) {
+            double interval = std::chrono::duration<double, std::milli>(arrival - _LastArrival).count();
+            bucket.intervals++;
+            bucket.intervalSum += interval;
+            bucket.intervalSquares += interval * interval;
+            bucket.maxInterval = std::max(bucket.maxInterval, interval);
+            _LastArrival = arrival;
+        }
+
+        // an access unit holds few distinct types, fold only those
+        for (uint64_t types = _PendingTypes; types; types &= types - 1) {
+            int type = __builtin_ctzll(types);
+            bucket.nalTypes[type] += _Pending[type];
+            _Pending[type] = 0;
+        }
+        _PendingTypes = 0;
+    }
+
+    StreamStats StreamAnalyzer::GetStats() const {
+        StreamStats stats = StreamStats();
+        std::lock_guard<std::mutex> lock(_Lock);
+        if (!_Started) {
+            return stats;
+        }
+
+        // complete seconds of the window plus the one being filled
+        double elapsed = std::chrono::duration<double>(Clock::now() - _Start).count();
+        int64_t now = (int64_t)elapsed;
+        int64_t first = std::max<int64_t>(0, now - STREAM_ANALYZER_WINDOW_S + 1);
+        stats.windowSeconds = std::max(elapsed - first, 0.001);
+
+        uint64_t bytes = 0, keyframeBytes = 0, intervals = 0;
+        double intervalSum = 0, intervalSquares = 0;
+        for (const Bucket &bucket : _Buckets) {
+            if (bucket.second < first || bucket.second > now) {
+                continue;
+            }
+            stats.frames += bucket.frames;
+            stats.keyframes += bucket.keyframes;
+            stats.damaged += bucket.damaged;
+            stats.maxGopLength = std::max(stats.maxGopLength, bucket.maxGop);
+            stats.maxFrameBytes = std::max(stats.maxFrameBytes, bucket.maxFrameBytes);
+            bytes += bucket.bytes;
+            keyframeBytes += bucket.keyframeBytes;
+            intervals += bucket.intervals;
+            intervalSum += bucket.intervalSum;
+            intervalSquares += bucket.intervalSquares;
+            stats.maxIntervalMs = std::max(stats.maxIntervalMs, bucket.maxInterval);
+            for (int i = 0; i < 64; i++) {
+                stats.nalTypes[i] += bucket.nalTypes[i];
+            }
+            if (bucket.second < now) {
+                stats.peakBitrate = std::max(stats.peakBitrate, bucket.bytes * 8.0);
+                if (bucket.second == now - 1) {
+                    stats.lastSecondBitrate = bucket.bytes * 8.0;
+                }
+            }
+        }
+
+        stats.fps = stats.frames / stats.windowSeconds;
+        stats.bitrate = bytes * 8.0 / stats.windowSeconds;
+        stats.gopLength = _Gop;
+        stats.framesSinceKeyframe = _SinceKeyframe;
+        if (stats.keyframes) {
+            stats.keyframeBytes = keyframeBytes / stats.keyframes;
+        }
+        if (stats.frames > stats.keyframes) {
+            stats.frameBytes = (bytes - keyframeBytes) / (stats.frames - stats.keyframes);
+        }
+        if (intervals) {
+            stats.intervalMs = intervalSum / intervals;
+            stats.intervalJitterMs = ::sqrt(std::max(intervalSquares / intervals - stats.intervalMs * stats.intervalMs, 0.0));
+        }
+        return stats;
+    }
+
+} //namespace RK
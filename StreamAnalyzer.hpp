@@ -0,0 +1,95 @@
+//
+//  StreamAnalyzer.hpp
+//  Simple-Rtsp-Client
+//
+
+#ifndef StreamAnalyzer_hpp
+#define StreamAnalyzer_hpp
+
+#include <chrono>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+
+// seconds of arrivals the windowed statistics cover
+#define STREAM_ANALYZER_WINDOW_S (10)
+
+namespace RK {
+
+    // what a camera really sends. the windowed values cover the last
+    // windowSeconds of arrivals, gop values count frames.
+    struct StreamStats {
+        double windowSeconds;       // shorter right after the start
+        uint64_t frames;            // in the window
+        uint64_t keyframes;
+        uint64_t damaged;           // access units with a hole, not delivered
+        double fps;
+        uint32_t gopLength;         // idr to idr, the latest complete gop, 0 before the second idr
+        uint32_t maxGopLength;      // longest gop that ended in the window
+        uint32_t framesSinceKeyframe;   // grows past any gop when idrs stop coming
+        size_t keyframeBytes;       // average idr access unit
+        size_t frameBytes;          // average other access unit
+        size_t maxFrameBytes;
+        double bitrate;             // bits per second, average over the window
+        double lastSecondBitrate;   // the latest complete second
+        double peakBitrate;         // busiest complete second in the window
+        double intervalMs;          // mean arrival gap between frames
+        double intervalJitterMs;    // standard deviation of the gap
+        double maxIntervalMs;
+        uint64_t nalTypes[64];      // nal units by type, h264 uses the first 32
+    };
+
+    // per stream statistics fed inline by the depacketizer: AddNalu for
+    // every nal unit, AddFrame when its access unit is complete. the
+    // window is a ring of one second buckets, a frame costs a few adds
+    // and an uncontended lock, GetStats sums the buckets.
+    class StreamAnalyzer {
+    public:
+        typedef std::chrono::steady_clock Clock;
+        StreamAnalyzer();
+
+        // loop thread only
+        void AddNalu(uint8_t type) {
+            _Pending[type & 0x3f]++;
+            _PendingTypes |= 1ull << (type & 0x3f);
+        }
+        void AddFrame(size_t size, bool keyframe, bool damaged, Clock::time_point arrival);
+        void Reset();
+
+        // thread safe
+        StreamStats GetStats() const;
+    protected:
+        struct Bucket {
+            int64_t second;         // since the first frame, -1 unused
+            uint64_t frames;
+            uint64_t keyframes;
+            uint64_t damaged;
+            uint64_t bytes;
+            uint64_t keyframeBytes;
+            size_t maxFrameBytes;
+            uint32_t maxGop;
+            uint64_t intervals;
+            double intervalSum;     // ms
+            double intervalSquares;
+            double maxInterval;
+            uint64_t nalTypes[64];
+        };
+
+        Bucket &Current(int64_t second);
+    private:
+        mutable std::mutex _Lock;
+        Bucket _Buckets[STREAM_ANALYZER_WINDOW_S + 1];     // the window plus the second being filled
+        bool _Started = false;
+        Clock::time_point _Start;
+        Clock::time_point _LastArrival;
+        uint32_t _Gop = 0;
+        uint32_t _SinceKeyframe = 0;
+        bool _SeenKeyframe = false;
+
+        // nal units of the access unit being assembled, loop thread only
+        uint32_t _Pending[64];
+        uint64_t _PendingTypes = 0;
+    };
+
+} //namespace RK
+#endif /* StreamAnalyzer_hpp */
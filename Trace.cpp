@@ -0,0 +1,206 @@
+//
+//  Trace.cpp
+//  Simple-Rtsp-Client
+//
+
+#include "Trace.hpp"
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "Log.hpp"
+
+#define MODULE_TAG "Trace"
+
+// events per thread, a power of two. 30 fps * 4 stages * 100 sessions
+// fill it in about 1.4 s on a loop thread
+#define TRACE_RING_SIZE (16384)
+
+namespace RK {
+
+#ifdef RTSP_TRACE
+
+    struct TraceEvent {
+        int64_t ns;
+        uint32_t session;
+        uint32_t timestamp;
+        uint32_t stage;
+        int tid;            // a ring outlives its thread and moves on to the next one
+    };
+
+    // single writer, the dump reads behind it
+    struct TraceRing {
+        int tid;            // writer only
+        std::atomic<uint64_t> head;
+        TraceEvent events[TRACE_RING_SIZE];
+    };
+
+    static std::mutex TraceLock;
+    static std::vector<std::shared_ptr<TraceRing>> TraceRings;     // never more than threads tracing at once
+    static std::vector<TraceRing *> TraceFree;                      // rings of exited threads
+    static std::map<uint32_t, std::string> TraceNames;
+
+    // hands the ring back when its thread exits, so threads that come and
+    // go with every reconnect reuse rings instead of piling them up. the
+    // events stay for the dump until the next owner overwrites them
+    struct TraceOwner {
+        TraceRing *ring = nullptr;
+
+        ~TraceOwner() {
+            if (ring) {
+                std::lock_guard<std::mutex> lock(TraceLock);
+                TraceFree.push_back(ring);
+            }
+        }
+    };
+
+    static TraceRing *CurrentRing() {
+        static thread_local TraceOwner owner;
+        if (!owner.ring) {
+            std::lock_guard<std::mutex> lock(TraceLock);
+            if (!TraceFree.empty()) {
+                owner.ring = TraceFree.back();
+                TraceFree.pop_back();
+            } else {
+                std::shared_ptr<TraceRing> created = std::make_shared<TraceRing>();
+                created->head = 0;
+                TraceRings.push_back(created);
+                owner.ring = created.get();
+            }
+            owner.ring->tid = (int)::syscall(SYS_gettid);
+        }
+        return owner.ring;
+    }
+
+    void TraceFrame(uint32_t session, uint32_t timestamp, TraceStage stage, std::chrono::steady_clock::time_point when) {
+        TraceRing *ring = CurrentRing();
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        TraceEvent &event = ring->events[head & (TRACE_RING_SIZE - 1)];
+        event.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(when.time_since_epoch()).count();
+        event.session = session;
+        event.timestamp = timestamp;
+        event.stage = stage;
+        event.tid = ring->tid;
+        ring->head.store(head + 1, std::memory_order_release);
+    }
+
+    void TraceSession(uint32_t session, const std::string &name) {
+        std::lock_guard<std::mutex> lock(TraceLock);
+        TraceNames[session] = name;
+    }
+
+    struct TracePoint {
+        int64_t ns[TraceStageCount];
+        int tid[TraceStageCount];
+    };
+
+    static std::string JsonString(const std::string &value) {
+        std::string out = "\"";
+        for (char c : value) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+            }
+            if ((unsigned char)c >= 0x20) {
+                out += c;
+            }
+        }
+        return out + "\"";
+    }
+
+    bool TraceDump(const std::string &path) {
+        std::vector<std::shared_ptr<TraceRing>> rings;
+        std::map<uint32_t, std::string> names;
+        {
+            std::lock_guard<std::mutex> lock(TraceLock);
+            rings = TraceRings;
+            names = TraceNames;
+        }
+
+        // stages of one frame land on different threads, join them by
+        // session and rtp timestamp
+        std::map<std::pair<uint32_t, uint32_t>, TracePoint> frames;
+        for (auto &ring : rings) {
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            uint64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+            std::vector<TraceEvent> events;
+            for (uint64_t i = first; i < head; i++) {
+                events.push_back(ring->events[i & (TRACE_RING_SIZE - 1)]);
+            }
+
+            // whatever the writer lapped while we copied may be torn
+            uint64_t now = ring->head.load(std::memory_order_acquire);
+            uint64_t valid = now > TRACE_RING_SIZE ? now - TRACE_RING_SIZE : 0;
+            for (uint64_t i = std::max(first, valid); i < head; i++) {
+                const TraceEvent &event = events[i - first];
+                auto inserted = frames.insert(std::make_pair(std::make_pair(event.session, event.timestamp), TracePoint()));
+                TracePoint &point = inserted.first->second;
+                if (inserted.second) {
+                    std::fill(point.ns, point.ns + TraceStageCount, -1);
+                }
+                point.ns[event.stage] = event.ns;
+                point.tid[event.stage] = event.tid;
+            }
+        }
+
+        FILE *fp = ::fopen(path.c_str(), "w");
+        if (!fp) {
+            log(MODULE_TAG, "failed to open %s", path.c_str());
+            return false;
+        }
+
+        // one process per session, one slice per stage a frame went through
+        static const char *Spans[TraceStageCount] = {"", "reassemble", "queue", "callback"};
+        ::fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        bool first = true;
+        for (auto &it : names) {
+            ::fprintf(fp, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":%s}}",
+                first ? "" : ",\n", it.first, JsonString(it.second).c_str());
+            first = false;
+        }
+        for (auto &it : frames) {
+            const TracePoint &point = it.second;
+            for (int stage = TraceReassembled; stage < TraceStageCount; stage++) {
+                if (point.ns[stage] < 0 || point.ns[stage - 1] < 0) {
+                    continue;
+                }
+                if (stage == TraceCallback) {
+                    // queued frames overlap each other, an async slice gets its own row
+                    ::fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"b\",\"id\":\"%08x%08x\",\"pid\":%u,\"tid\":%d,\"ts\":%.3f}"
+                        ",\n{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"e\",\"id\":\"%08x%08x\",\"pid\":%u,\"tid\":%d,\"ts\":%.3f}",
+                        first ? "" : ",\n", Spans[stage], it.first.first, it.first.second, it.first.first, point.tid[stage - 1], point.ns[stage - 1] / 1000.0,
+                        Spans[stage], it.first.first, it.first.second, it.first.first, point.tid[stage - 1], point.ns[stage] / 1000.0);
+                } else {
+                    ::fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"rtp\":%u}}",
+                        first ? "" : ",\n", Spans[stage], it.first.first, point.tid[stage],
+                        point.ns[stage - 1] / 1000.0, (point.ns[stage] - point.ns[stage - 1]) / 1000.0, it.first.second);
+                }
+                first = false;
+            }
+        }
+        ::fprintf(fp, "\n]}\n");
+        bool ok = ::ferror(fp) == 0;
+        ::fclose(fp);
+        return ok;
+    }
+
+#else
+
+    void TraceFrame(uint32_t, uint32_t, TraceStage, std::chrono::steady_clock::time_point) {
+    }
+
+    void TraceSession(uint32_t, const std::string &) {
+    }
+
+    bool TraceDump(const std::string &) {
+        log(MODULE_TAG, "tracing is compiled out, build with -DRTSP_TRACE=ON");
+        return false;
+    }
+
+#endif
+
+} //namespace RK
@@ -0,0 +1,48 @@
+//
+//  Trace.hpp
+//  Simple-Rtsp-Client
+//
+
+#ifndef Trace_hpp
+#define Trace_hpp
+
+#include <chrono>
+#include <stdint.h>
+#include <string>
+
+namespace RK {
+
+    // where a video frame is on its way from the socket to the callback
+    enum TraceStage {
+        TraceArrival = 0,       // first packet of the frame received
+        TraceReassembled,       // last packet in, access unit complete
+        TraceCallback,          // handed to the frame callback, after any queueing
+        TraceDone,              // frame callback returned
+        TraceStageCount,
+    };
+
+    // per frame stage timestamps, built with -DRTSP_TRACE=ON only. every
+    // thread records into its own ring without locks or allocation, the
+    // oldest events are overwritten. session is any per-player id, frames
+    // are told apart by their rtp timestamp.
+    void TraceFrame(uint32_t session, uint32_t timestamp, TraceStage stage,
+                    std::chrono::steady_clock::time_point when = std::chrono::steady_clock::now());
+    // shown instead of the bare id in the trace viewer
+    void TraceSession(uint32_t session, const std::string &name);
+    // chrome trace / perfetto json of what the rings hold, false when
+    // tracing is compiled out or the file can't be written
+    bool TraceDump(const std::string &path);
+
+} //namespace RK
+
+#ifdef RTSP_TRACE
+#define TRACE_FRAME(session, timestamp, stage) RK::TraceFrame(session, timestamp, stage)
+#define TRACE_FRAME_AT(session, timestamp, stage, when) RK::TraceFrame(session, timestamp, stage, when)
+#define TRACE_SESSION(session, name) RK::TraceSession(session, name)
+#else
+#define TRACE_FRAME(session, timestamp, stage) do {} while (0)
+#define TRACE_FRAME_AT(session, timestamp, stage, when) do {} while (0)
+#define TRACE_SESSION(session, name) do {} while (0)
+#endif
+
+#endif /* Trace_hpp */
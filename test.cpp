@@ -1,11 +1,72 @@
+#include <future>
+#include "FrameAligner.hpp"
 #include "RtspPlayer.hpp"
 
 using namespace RK;
 
 int main(int argc, char **argv) {
-	RtspPlayer::Ptr player = std::make_shared<RtspPlayer>();
+	FILE *fp = ::fopen("test.h264", "w+");
+	if (!fp) {
+		printf("failed to open test.h264\n");
+		return -1;
+	}
+
+	EventLoop::Ptr loop = std::make_shared<EventLoop>();
+	loop->Start();
+	RtspPlayer::Ptr player = std::make_shared<RtspPlayer>(loop);
+	size_t frames = 0, bytes = 0;
+	auto write = [fp, &frames, &bytes](const MediaFrame &frame) {
+		::fwrite(frame.data, frame.size, 1, fp);
+		::fflush(fp);
+		frames++;
+		bytes += frame.size;
+	};
+
+	// test <capture.pcap|capture.rtpdump> replays a recording at full speed
+	if (argc > 1) {
+		player->SetVideoFrameCallback(write);
+		std::promise<void> finished;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if (!player->PlayCapture(argv[1], 0, [&finished] { finished.set_value(); })) {
+			printf("failed to replay %s\n", argv[1]);
+			return -1;
+		}
+		finished.get_future().wait();
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		printf("%zu frames, %zu bytes in %.3f s, %.1f frames/s\n", frames, bytes, seconds, frames / seconds);
+		player->Stop();
+		loop->Stop();
+		::fclose(fp);
+		return 0;
+	}
+
+	// live, audio and video go out in sender wall clock order. a track
+	// that stalls holds the other one back 200 ms at most
+	size_t audioFrames = 0;
+	int video = 0, audio = 0;
+	FrameAligner::Ptr aligner = std::make_shared<FrameAligner>(loop, 200, [&write, &audioFrames, &audio](int track, const MediaFrame &frame) {
+		if (track == audio) {
+			audioFrames++;
+		} else {
+			write(frame);
+		}
+	});
+	video = aligner->AddTrack();
+	audio = aligner->AddTrack();
+	player->SetVideoFrameCallback([aligner, video](const MediaFrame &frame) {
+		aligner->Push(video, frame);
+	});
+	player->SetAudioFrameCallback([aligner, audio](const MediaFrame &frame) {
+		aligner->Push(audio, frame);
+	});
+
     player->Play("rtsp://184.72.239.149/vod/mp4://BigBuckBunny_175k.mov");
 
 	getchar();
+	player->Stop();
+	aligner->Flush();
+	loop->Stop();
+	printf("%zu video frames, %zu bytes, %zu audio frames\n", frames, bytes, audioFrames);
+	::fclose(fp);
 	return 0;
 }
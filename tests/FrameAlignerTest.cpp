@@ -0,0 +1,114 @@
+//
+//  FrameAlignerTest.cpp
+//  Simple-Rtsp-Client
+//
+
+#include <chrono>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include "FrameAligner.hpp"
+
+using namespace RK;
+
+typedef std::chrono::steady_clock Clock;
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+// what came out, as "track:wallclock" in output order
+struct Collector {
+    std::mutex lock;
+    std::string out;
+    Clock::time_point last;
+
+    void Add(int track, const MediaFrame &frame) {
+        std::lock_guard<std::mutex> guard(lock);
+        out += out.empty() ? "" : " ";
+        out += std::to_string(track) + ":" + std::to_string(frame.wallclock);
+        last = Clock::now();
+    }
+    std::string Get() {
+        std::lock_guard<std::mutex> guard(lock);
+        return out;
+    }
+};
+
+static void Push(FrameAligner &aligner, int track, int64_t wallclock) {
+    unsigned char payload[1] = {0};
+    MediaFrame frame = MediaFrame();
+    frame.data = payload;
+    frame.size = sizeof(payload);
+    frame.wallclock = wallclock;
+    aligner.Push(track, frame);
+}
+
+int main() {
+    EventLoop::Ptr loop = std::make_shared<EventLoop>();
+    loop->Start();
+
+    // tracks pushed one after the other come out interleaved by wall
+    // clock, the newest frame waits until the other track passed it
+    {
+        Collector collector;
+        FrameAligner aligner(loop, 10000, [&collector](int track, const MediaFrame &frame) {
+            collector.Add(track, frame);
+        });
+        int video = aligner.AddTrack();
+        int audio = aligner.AddTrack();
+        for (int64_t wallclock : {100, 300, 500}) {
+            Push(aligner, video, wallclock);
+        }
+        for (int64_t wallclock : {200, 400, 600}) {
+            Push(aligner, audio, wallclock);
+        }
+        loop->RunInLoopSync([] {});
+        CHECK(collector.Get() == "0:100 1:200 0:300 1:400 0:500");
+        aligner.Flush();
+        CHECK(collector.Get() == "0:100 1:200 0:300 1:400 0:500 1:600");
+    }
+
+    // a silent track holds the other one for max delay, not longer
+    {
+        Collector collector;
+        FrameAligner aligner(loop, 50, [&collector](int track, const MediaFrame &frame) {
+            collector.Add(track, frame);
+        });
+        int video = aligner.AddTrack();
+        aligner.AddTrack();
+        Clock::time_point start = Clock::now();
+        Push(aligner, video, 100);
+        Push(aligner, video, 200);
+        loop->RunInLoopSync([] {});
+        CHECK(collector.Get().empty());
+        for (int i = 0; i < 100 && collector.Get() != "0:100 0:200"; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        CHECK(collector.Get() == "0:100 0:200");
+        double waited = std::chrono::duration<double, std::milli>(collector.last - start).count();
+        CHECK(waited >= 50 && waited < 300);
+    }
+
+    // no sender report yet, nothing to align against
+    {
+        Collector collector;
+        FrameAligner aligner(loop, 10000, [&collector](int track, const MediaFrame &frame) {
+            collector.Add(track, frame);
+        });
+        int video = aligner.AddTrack();
+        aligner.AddTrack();
+        Push(aligner, video, 0);
+        loop->RunInLoopSync([] {});
+        CHECK(collector.Get() == "0:0");
+    }
+
+    loop->Stop();
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
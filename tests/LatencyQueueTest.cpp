@@ -0,0 +1,100 @@
+//
+//  LatencyQueueTest.cpp
+//  Simple-Rtsp-Client
+//
+
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "LatencyQueue.hpp"
+
+using namespace RK;
+
+struct TestFrame {
+    const char *name;
+    bool keyframe;
+    bool reference;
+    bool damaged;
+};
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+// pushes the frames while the consumer is held on the first one, so
+// everything before a damaged frame is still queued when it arrives
+static std::string Replay(const std::vector<TestFrame> &frames, LatencyStats *stats) {
+    std::mutex lock;
+    std::string delivered;
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    size_t expected = 0;
+
+    LatencyQueue queue(10000, [&](const MediaFrame &frame) {
+        released.wait();
+        std::lock_guard<std::mutex> guard(lock);
+        delivered += delivered.empty() ? "" : " ";
+        delivered += std::string((const char *)frame.data, frame.size);
+    });
+
+    unsigned char payload[8];
+    for (const TestFrame &test : frames) {
+        size_t size = std::string(test.name).copy((char *)payload, sizeof(payload));
+        MediaFrame frame = MediaFrame();
+        frame.data = payload;
+        frame.size = size;
+        frame.keyframe = test.keyframe;
+        queue.Push(frame, test.reference, test.damaged, LatencyQueue::Clock::now());
+    }
+    release.set_value();
+
+    LatencyStats now = queue.GetStats();
+    expected = frames.size() - now.droppedNonRef - now.droppedResync;
+    for (int i = 0; i < 200 && queue.GetStats().delivered < expected; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    *stats = queue.GetStats();
+    std::lock_guard<std::mutex> guard(lock);
+    return delivered;
+}
+
+int main() {
+    LatencyStats stats;
+
+    // a damaged reference frame drops what predicts from it up to the
+    // next clean idr, and leaves the frames queued before it alone
+    std::string out = Replay({
+        {"I0", true, true, false}, {"P1", false, true, false}, {"I2", true, true, false}, {"P3", false, true, false},
+        {"P4", false, true, true}, {"P5", false, true, false}, {"P6", false, true, false},
+    }, &stats);
+    CHECK(out == "I0 P1 I2 P3");
+    CHECK(stats.droppedResync == 3);
+    CHECK(stats.droppedNonRef == 0);
+
+    // recovery starts at the next clean idr, a damaged one does not count
+    out = Replay({
+        {"I0", true, true, false}, {"P1", false, true, true}, {"I2", true, true, true}, {"P3", false, true, false},
+        {"I4", true, true, false}, {"P5", false, true, false},
+    }, &stats);
+    CHECK(out == "I0 I4 P5");
+    CHECK(stats.droppedResync == 3);
+
+    // a damaged non-reference frame only costs itself
+    out = Replay({
+        {"I0", true, true, false}, {"b1", false, false, true}, {"P2", false, true, false},
+    }, &stats);
+    CHECK(out == "I0 P2");
+    CHECK(stats.droppedNonRef == 1);
+    CHECK(stats.droppedResync == 0);
+
+    if (failures) {
+        printf("%d checks failed (last run delivered \"%s\")\n", failures, out.c_str());
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
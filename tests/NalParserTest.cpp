@@ -0,0 +1,200 @@
+//
+//  NalParserTest.cpp
+//  Simple-Rtsp-Client
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "NalParser.hpp"
+
+using namespace RK;
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+// one byte at a time, what every scanner has to agree with
+static const unsigned char *FindStartCodeReference(const unsigned char *p, const unsigned char *end) {
+    for (; p + 2 < end; p++) {
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1) {
+            return p;
+        }
+    }
+    return end;
+}
+
+static std::vector<unsigned char> RemoveReference(const std::vector<unsigned char> &src) {
+    std::vector<unsigned char> out;
+    int zeros = 0;
+    for (unsigned char c : src) {
+        if (zeros >= 2 && c == 3) {
+            zeros = 0;
+            continue;
+        }
+        out.push_back(c);
+        zeros = c == 0 ? zeros + 1 : 0;
+    }
+    return out;
+}
+
+// mostly zeros, ones and threes so matches and near misses are dense
+static std::vector<unsigned char> RandomBuffer(size_t size) {
+    static const unsigned char bytes[] = {0, 0, 0, 0, 1, 3, 2, 0x80, 0xff};
+    std::vector<unsigned char> buf(size);
+    for (size_t i = 0; i < size; i++) {
+        buf[i] = bytes[rand() % sizeof(bytes)];
+    }
+    return buf;
+}
+
+// every match in the buffer, from every offset, the way ForEachNalu walks it
+static void CheckScanners(const std::vector<StartCodeScanner> &scanners, const unsigned char *data, size_t size) {
+    const unsigned char *end = data + size;
+    for (size_t start = 0; start <= size; start++) {
+        const unsigned char *expected = FindStartCodeReference(data + start, end);
+        for (size_t i = 0; i < scanners.size(); i++) {
+            if (scanners[i](data + start, end) != expected) {
+                printf("scanner %zu: size %zu start %zu found %td expected %td\n", i, size, start,
+                       scanners[i](data + start, end) - data, expected - data);
+                failures++;
+                return;
+            }
+        }
+    }
+}
+
+static void TestScanners() {
+    std::vector<StartCodeScanner> scanners = StartCodeScanners();
+    CHECK(!scanners.empty());
+    printf("%zu start code scanners\n", scanners.size());
+
+    // every length around the 16 and 32 byte blocks, a match at each
+    // position including the very last one, and no match at all
+    for (size_t size = 0; size <= 100; size++) {
+        std::vector<unsigned char> buf(size + 1, 0xaa);
+        CheckScanners(scanners, buf.data() + 1, size);
+        for (size_t at = 0; at + 3 <= size; at++) {
+            std::fill(buf.begin(), buf.end(), 0xaa);
+            buf[1 + at] = 0;
+            buf[1 + at + 1] = 0;
+            buf[1 + at + 2] = 1;
+            CheckScanners(scanners, buf.data() + 1, size);
+        }
+        // 00 00 cut off by the end, and all zeros
+        if (size >= 2) {
+            std::fill(buf.begin(), buf.end(), 0xaa);
+            buf[size - 1] = 0;
+            buf[size] = 0;
+            CheckScanners(scanners, buf.data() + 1, size);
+        }
+        std::fill(buf.begin(), buf.end(), 0);
+        CheckScanners(scanners, buf.data() + 1, size);
+    }
+
+    srand(1);
+    for (int round = 0; round < 300; round++) {
+        std::vector<unsigned char> buf = RandomBuffer(rand() % 300);
+        CheckScanners(scanners, buf.data(), buf.size());
+    }
+}
+
+static void TestForEachNalu() {
+    const unsigned char stream[] = {
+        0, 0, 0, 1, 0x67, 0x42,
+        0, 0, 1, 0x68, 0xce, 0x00,
+        0, 0, 0, 1, 0x65, 0, 0, 3, 1,
+    };
+    std::vector<std::string> nalus;
+    ForEachNalu(stream, sizeof(stream), [&nalus](const unsigned char *nalu, size_t size) {
+        nalus.push_back(std::string((const char *)nalu, size));
+    });
+    CHECK(nalus.size() == 3);
+    CHECK(nalus.size() == 3 && nalus[0] == std::string("\x67\x42", 2));
+    // a trailing zero before a 4 byte start code belongs to the start code
+    CHECK(nalus.size() == 3 && nalus[1] == std::string("\x68\xce", 2));
+    CHECK(nalus.size() == 3 && nalus[2] == std::string("\x65\x00\x00\x03\x01", 5));
+}
+
+static void TestEmulationPrevention() {
+    srand(2);
+    for (int round = 0; round < 300; round++) {
+        std::vector<unsigned char> src = RandomBuffer(rand() % 300);
+        std::vector<unsigned char> expected = RemoveReference(src);
+        std::vector<unsigned char> dst(src.size());
+        dst.resize(RemoveEmulationPrevention(src.data(), src.size(), dst.data()));
+        CHECK(dst == expected);
+
+        // in place
+        size_t size = RemoveEmulationPrevention(src.data(), src.size(), src.data());
+        src.resize(size);
+        CHECK(src == expected);
+    }
+}
+
+static void TestSps() {
+    VideoParams params;
+
+    // baseline 3.1, 1280x720, vui timing 25 fps
+    const unsigned char h264[] = {
+        0x67, 0x42, 0xc0, 0x1f, 0xda, 0x01, 0x40, 0x16, 0xe8, 0x40, 0x00, 0x00,
+        0x03, 0x00, 0x40, 0x00, 0x00, 0x0c, 0x83, 0xc6, 0x0c, 0xa8,
+    };
+    CHECK(ParseH264Sps(h264, sizeof(h264), &params));
+    CHECK(params.codec == VideoCodecH264 && params.profile == 66 && params.level == 31);
+    CHECK(params.width == 1280 && params.height == 720);
+    CHECK(params.chromaFormat == 1 && params.bitDepth == 8 && params.framerate == 25);
+
+    // cut inside the vui, only the framerate is lost
+    CHECK(ParseH264Sps(h264, 12, &params) && params.width == 1280 && params.framerate == 0);
+    CHECK(!ParseH264Sps(h264, 5, &params));
+    CHECK(!ParseH264Sps(h264 + 1, sizeof(h264) - 1, &params));
+
+    // main 4.0, 1920x1080 cropped from 1088, no vui timing
+    const unsigned char h265[] = {
+        0x42, 0x01, 0x01, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00, 0x90, 0x00, 0x00,
+        0x03, 0x00, 0x00, 0x03, 0x00, 0x78, 0xa0, 0x03, 0xc0, 0x80, 0x10, 0xe5,
+        0x96, 0x56, 0x69, 0x24, 0xca, 0xf0, 0x16, 0x9c, 0x20,
+    };
+    CHECK(ParseH265Sps(h265, sizeof(h265), &params));
+    CHECK(params.codec == VideoCodecH265 && params.profile == 1 && params.tier == 0 && params.level == 120);
+    CHECK(params.width == 1920 && params.height == 1080);
+    CHECK(params.chromaFormat == 1 && params.bitDepth == 8 && params.framerate == 0);
+
+    // main 10 high tier 5.1, 3840x2160 cropped from 2176, with scaling
+    // lists, pcm, an inter predicted short term set, long term pictures
+    // and a vui of 60000 / 1001
+    const unsigned char h265Vui[] = {
+        0x42, 0x01, 0x01, 0x22, 0x20, 0x00, 0x00, 0x03, 0x00, 0x90, 0x00, 0x00,
+        0x03, 0x00, 0x00, 0x03, 0x00, 0x99, 0xa0, 0x01, 0xe0, 0x20, 0x02, 0x20,
+        0x7c, 0x4b, 0x65, 0x95, 0xe4, 0x91, 0xbd, 0x97, 0xf9, 0x7f, 0xaa, 0xaa,
+        0xaa, 0xac, 0x20, 0x5f, 0xe5, 0xfe, 0x5f, 0xe5, 0xfe, 0x5f, 0xe5, 0xfe,
+        0x5f, 0xe5, 0xfe, 0xaf, 0x77, 0xb1, 0x1a, 0xd6, 0xb4, 0x94, 0x9b, 0x11,
+        0xe4, 0x3f, 0xfc, 0x00, 0x10, 0x00, 0x0e, 0xd4, 0x24, 0x40, 0x26, 0xd8,
+        0xfc, 0x00, 0x00, 0x0f, 0xa4, 0x00, 0x03, 0xa9, 0x80, 0x40,
+    };
+    CHECK(ParseH265Sps(h265Vui, sizeof(h265Vui), &params));
+    CHECK(params.profile == 2 && params.tier == 1 && params.level == 153);
+    CHECK(params.width == 3840 && params.height == 2160 && params.bitDepth == 10);
+    CHECK(params.framerate > 59.93 && params.framerate < 59.95);
+
+    // cut before the timing, the picture size still comes through
+    CHECK(ParseH265Sps(h265Vui, sizeof(h265Vui) - 12, &params) && params.width == 3840 && params.framerate == 0);
+    CHECK(!ParseH265Sps(h264, sizeof(h264), &params));
+}
+
+int main() {
+    TestScanners();
+    TestForEachNalu();
+    TestEmulationPrevention();
+    TestSps();
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
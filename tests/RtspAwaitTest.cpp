@@ -0,0 +1,180 @@
+//
+//  RtspAwaitTest.cpp
+//  Simple-Rtsp-Client
+//
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "RtspAwait.hpp"
+
+using namespace RK;
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+// fire and forget coroutine, done is set once the body returned
+struct Task {
+    struct promise_type {
+        Task get_return_object() { return Task(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+static Task Describe(RtspSession session, std::promise<RtspResult> *done) {
+    RtspResult result = co_await session.Describe();
+    done->set_value(result);
+}
+
+static Task Connect(RtspSession session, std::string url, std::promise<RtspResult> *done) {
+    RtspResult result = co_await session.Connect(url);
+    done->set_value(result);
+}
+
+// several requests in a row that all complete inside await_suspend
+static Task Repeat(RtspSession session, int count, std::promise<int> *done) {
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        RtspResult result = co_await session.GetParameter("");
+        failed += result.status == 0;
+    }
+    done->set_value(failed);
+}
+
+static bool Wait(std::future<RtspResult> &future, RtspResult *result) {
+    if (future.wait_for(std::chrono::seconds(5)) != std::future_status::ready) {
+        return false;
+    }
+    *result = future.get();
+    return true;
+}
+
+// answers every request with 200, describe gets a one track sdp
+static void Serve(int listener) {
+    int fd = ::accept(listener, nullptr, nullptr);
+    if (fd < 0) {
+        return;
+    }
+    std::string pending;
+    char buf[2048];
+    ssize_t n;
+    while ((n = ::recv(fd, buf, sizeof(buf), 0)) > 0) {
+        pending.append(buf, n);
+        size_t end;
+        while ((end = pending.find("\r\n\r\n")) != std::string::npos) {
+            std::string request = pending.substr(0, end);
+            pending.erase(0, end + 4);
+            const char *cseq = strstr(request.c_str(), "CSeq: ");
+            std::string response = "RTSP/1.0 200 OK\r\nCSeq: " + std::to_string(cseq ? atoi(cseq + 6) : 0) + "\r\n";
+            if (request.compare(0, 8, "DESCRIBE") == 0) {
+                std::string sdp = "v=0\r\no=- 0 0 IN IP4 127.0.0.1\r\ns=test\r\nc=IN IP4 0.0.0.0\r\nt=0 0\r\n"
+                                  "m=video 0 RTP/AVP 96\r\na=rtpmap:96 H264/90000\r\na=control:trackID=0\r\n";
+                response += "Content-Type: application/sdp\r\nContent-Length: " + std::to_string(sdp.size()) + "\r\n\r\n" + sdp;
+            } else {
+                response += "\r\n";
+            }
+            ::send(fd, response.data(), response.size(), 0);
+        }
+    }
+    ::close(fd);
+}
+
+int main() {
+    EventLoop::Ptr loop = std::make_shared<EventLoop>();
+    loop->Start();
+
+    // not connected: the loop completes the request while the caller is
+    // still inside await_suspend, or right after it
+    {
+        RtspPlayer::Ptr player = std::make_shared<RtspPlayer>(loop);
+        for (int i = 0; i < 1000; i++) {
+            std::promise<RtspResult> done;
+            std::future<RtspResult> future = done.get_future();
+            Describe(RtspSession(player), &done);
+            RtspResult result;
+            CHECK(Wait(future, &result));
+            CHECK(result.method == RTSPDESCRIBE && result.status == 0 && result.reason == "not connected");
+        }
+        player->Stop();
+    }
+
+    // on the loop thread every request completes inline, the coroutine
+    // goes on without ever suspending
+    {
+        RtspPlayer::Ptr player = std::make_shared<RtspPlayer>(loop);
+        std::promise<int> done;
+        std::future<int> future = done.get_future();
+        loop->RunInLoopSync([&] { Repeat(RtspSession(player), 100, &done); });
+        CHECK(future.wait_for(std::chrono::seconds(0)) == std::future_status::ready && future.get() == 100);
+
+        std::promise<RtspResult> connected;
+        std::future<RtspResult> connect = connected.get_future();
+        loop->RunInLoopSync([&] { Connect(RtspSession(player), "http://nowhere", &connected); });
+        RtspResult result;
+        CHECK(Wait(connect, &result));
+        CHECK(result.method == RTSPCONNECT && result.status == 0 && result.reason == "invalid url");
+        player->Stop();
+    }
+
+    // a stopped player completes at once instead of hanging the coroutine
+    {
+        RtspPlayer::Ptr player = std::make_shared<RtspPlayer>(loop);
+        player->Stop();
+        std::promise<RtspResult> done;
+        std::future<RtspResult> future = done.get_future();
+        Describe(RtspSession(player), &done);
+        RtspResult result;
+        CHECK(Wait(future, &result));
+        CHECK(result.status == 0 && result.reason == "terminated");
+    }
+
+    // a real exchange resumes on the loop thread with the server's answer
+    {
+        int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        ::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        CHECK(::bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == 0 && ::listen(listener, 1) == 0);
+        CHECK(::getsockname(listener, (struct sockaddr *)&addr, &len) == 0);
+        std::thread server(Serve, listener);
+
+        RtspPlayer::Ptr player = std::make_shared<RtspPlayer>(loop);
+        std::string url = "rtsp://127.0.0.1:" + std::to_string(ntohs(addr.sin_port)) + "/test";
+        std::promise<RtspResult> connected;
+        std::future<RtspResult> connect = connected.get_future();
+        Connect(RtspSession(player), url, &connected);
+        RtspResult result;
+        CHECK(Wait(connect, &result) && result.Succeeded());
+
+        std::promise<RtspResult> described;
+        std::future<RtspResult> describe = described.get_future();
+        Describe(RtspSession(player), &described);
+        CHECK(Wait(describe, &result) && result.status == 200 && result.method == RTSPDESCRIBE);
+
+        player->Stop();
+        server.join();
+        ::close(listener);
+    }
+
+    loop->Stop();
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
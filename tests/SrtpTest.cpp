@@ -0,0 +1,175 @@
+//
+//  SrtpTest.cpp
+//  Simple-Rtsp-Client
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "Srtp.hpp"
+#ifdef RTSP_SRTP
+#include <openssl/evp.h>
+#endif
+
+using namespace RK;
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+typedef std::vector<unsigned char> Bytes;
+
+#ifdef RTSP_SRTP
+
+static Bytes Hex(const char *hex) {
+    Bytes out;
+    for (const char *p = hex; p[0] && p[1]; p += 2) {
+        unsigned int byte = 0;
+        sscanf(p, "%2x", &byte);
+        out.push_back((unsigned char)byte);
+    }
+    return out;
+}
+
+static Bytes Concat(const Bytes &a, const Bytes &b) {
+    Bytes out = a;
+    out.insert(out.end(), b.begin(), b.end());
+    return out;
+}
+
+// reaches the session key entry and the kdf
+class SrtpProbe : public SrtpContext {
+public:
+    using SrtpContext::InitSession;
+    using SrtpContext::Derive;
+};
+
+// rfc 3711 b.3
+static void TestKeyDerivation() {
+    Bytes master = Hex("E1F97A0D3E018BE0D64FA32C06DE4139");
+    Bytes salt = Hex("0EC675AD498AFEEBB6960B3AABE6");
+    SrtpProbe probe;
+    CHECK(probe.Init("AES_CM_128_HMAC_SHA1_80", Concat(master, salt).data(), 30, Bytes()));
+
+    unsigned char out[20];
+    CHECK(probe.Derive(master.data(), salt.data(), 0, out, 16) && Bytes(out, out + 16) == Hex("C61E7A93744F39EE10734AFE3FF7A087"));
+    CHECK(probe.Derive(master.data(), salt.data(), 2, out, 14) && Bytes(out, out + 14) == Hex("30CBBC08863D8C85D49DB34A9AE1"));
+    CHECK(probe.Derive(master.data(), salt.data(), 1, out, 20) && Bytes(out, out + 20) == Hex("CEBE321F6FF7716B6FD4AB49AF256A156D38BAA4"));
+}
+
+// rfc 3711 b.2 keystream at ssrc 0, index 0, authenticated over packet || roc
+static void TestCounterMode() {
+    Bytes key = Concat(Hex("2B7E151628AED2A6ABF7158809CF4F3C"), Hex("F0F1F2F3F4F5F6F7F8F9FAFBFCFD"));
+    Bytes auth = Hex("CEBE321F6FF7716B6FD4AB49AF256A156D38BAA4");
+    SrtpProbe srtp;
+    CHECK(srtp.InitSession("AES_CM_128_HMAC_SHA1_80", key.data(), key.data(), auth.data(), auth.data(), Bytes()));
+
+    Bytes packet = Concat(Hex("806000000000000000000000"),
+                          Hex("E03EAD0935C95E80E166B16DD92B4EB4D23513162B02D0F72A43A2FE4A5F97AB41E95B3BB0A2E8DD477901E4FCA894C0"));
+    Bytes mac = Concat(packet, Hex("00000000"));
+    unsigned char tag[20];
+    size_t tagSize = 0;
+    CHECK(EVP_Q_mac(NULL, "HMAC", NULL, "SHA1", NULL, auth.data(), auth.size(), mac.data(), mac.size(), tag, sizeof(tag), &tagSize));
+    packet.insert(packet.end(), tag, tag + 10);
+
+    Bytes forged = packet;
+    forged[20] ^= 1;
+    size_t size = forged.size();
+    CHECK(!srtp.UnprotectRtp(forged.data(), &size));
+
+    size = packet.size();
+    CHECK(srtp.UnprotectRtp(packet.data(), &size) && size == 60);
+    CHECK(Bytes(packet.begin() + 12, packet.begin() + 60) == Bytes(48, 0));
+}
+
+// rfc 7714 16.1.1 and 17.1.1
+static void TestGcm() {
+    Bytes key = Concat(Hex("000102030405060708090a0b0c0d0e0f"), Hex("517569642070726f2071756f"));
+    SrtpProbe srtp;
+    CHECK(srtp.InitSession("AEAD_AES_128_GCM", key.data(), key.data(), NULL, NULL, Bytes()));
+
+    Bytes rtp = Hex("8040f17b8041f8d35501a0b2"
+                    "f24de3a3fb34de6cacba861c9d7e4bcabe633bd50d294e6f42a5f47a51c7d19b36de3adf8833"
+                    "899d7f27beb16a9152cf765ee4390cce");
+    Bytes replayed = rtp;
+    size_t size = rtp.size();
+    CHECK(srtp.UnprotectRtp(rtp.data(), &size));
+    CHECK(std::string((const char *)rtp.data() + 12, size - 12) == "Gallia est omnis divisa in partes tres");
+    size = replayed.size();
+    CHECK(!srtp.UnprotectRtp(replayed.data(), &size));
+
+    Bytes rtcp = Hex("81c8000d4d617273"
+                     "63e94885dcdab67ca727d7662f6b7e997ff5c0f76c06f32dc676a5f1730d6fda4ce09b4686303ded0bb9275b"
+                     "c84aa45896cf4d2fc5abf87245d9eade"
+                     "800005d4");
+    size = rtcp.size();
+    CHECK(srtp.UnprotectRtcp(rtcp.data(), &size));
+    CHECK(Bytes(rtcp.begin(), rtcp.begin() + size) ==
+          Hex("81c8000d4d6172734e5450314e54503252545020"
+              "0000042a0000e9304c756e61deadbeefdeadbeefdeadbeefdeadbeefdeadbeef"));
+    CHECK(srtp.Dropped() == 1);
+}
+
+// our reports come back out of a second context keyed the same, once
+static void TestRoundTrip(const char *suite, size_t keySize, const Bytes &mki) {
+    Bytes master(keySize);
+    for (size_t i = 0; i < master.size(); i++) {
+        master[i] = (unsigned char)(i * 7 + 1);
+    }
+    SrtpContext sender, receiver;
+    CHECK(sender.Init(suite, master.data(), master.size(), mki));
+    CHECK(receiver.Init(suite, master.data(), master.size(), mki));
+
+    Bytes report = Hex("80c900011234567800000000");
+    for (int i = 0; i < 3; i++) {
+        Bytes packet = report;
+        packet.resize(report.size() + sender.Overhead());
+        size_t size = report.size();
+        CHECK(sender.ProtectRtcp(packet.data(), &size) && size == report.size() + sender.Overhead());
+        CHECK(::memcmp(packet.data() + 8, report.data() + 8, 4) != 0);
+
+        Bytes replayed(packet.begin(), packet.begin() + size);
+        size_t replayedSize = replayed.size();
+        CHECK(receiver.UnprotectRtcp(packet.data(), &size));
+        CHECK(Bytes(packet.begin(), packet.begin() + size) == report);
+        CHECK(!receiver.UnprotectRtcp(replayed.data(), &replayedSize));
+    }
+    CHECK(receiver.Dropped() == 3);
+}
+
+int main() {
+    CHECK(SrtpContext::Available());
+    TestKeyDerivation();
+    TestCounterMode();
+    TestGcm();
+    TestRoundTrip("AES_CM_128_HMAC_SHA1_80", 30, Bytes());
+    TestRoundTrip("AES_256_CM_HMAC_SHA1_32", 46, Hex("0102"));
+    TestRoundTrip("AEAD_AES_128_GCM", 28, Bytes());
+    TestRoundTrip("AEAD_AES_256_GCM", 44, Hex("0a"));
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
+
+#else
+
+int main() {
+    // built without openssl every suite is refused
+    SrtpContext srtp;
+    unsigned char key[30] = {0};
+    CHECK(!SrtpContext::Available());
+    CHECK(!srtp.Init("AES_CM_128_HMAC_SHA1_80", key, sizeof(key), Bytes()));
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("ok, built without openssl\n");
+    return 0;
+}
+
+#endif